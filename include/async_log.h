@@ -0,0 +1,284 @@
+/**
+ * This async_log.h declares the asynchronous logger: the tasks capture the
+ * log records without formatting them and the logger task formats and
+ * writes them on the console.
+ *
+ * MIT License
+ *
+ * ESP32 MQTT - Samples code
+ * Copyright (c) 2021 Antonio Musarra's Blog - https://www.dontesta.it
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in the
+ * Software without restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the
+ * Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef ASYNC_LOG_H
+#define ASYNC_LOG_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <ArduinoLog.h>
+#include <type_traits>
+#include "task_metrics.h"
+
+/**
+ * A log call stores the pointer of the format string (in flash) and the raw
+ * arguments in a fixed size record; the strings are copied in the record,
+ * because they can be temporary. Every registered task has its own
+ * lock-free ring, so the producer never blocks and never formats: when the
+ * ring is full the record is dropped and counted. The other contexts share
+ * a ring protected by a spinlock.
+ *
+ * The format specifiers are the ones of ArduinoLog: %s %S %d %i %l %u %D %F
+ * %x %X %b %B %c %t %T and %%.
+ *
+ * Until start() is called (during the setup), and for the calls made in
+ * the logger task itself, the records are formatted and written
+ * synchronously: the strings are not copied, so they are never truncated
+ * (the logger task logs the metrics messages whole). A call in the logger
+ * task blocks it for the time of the console write.
+ */
+
+/**
+ * Max level of the records compiled in the firmware (LOG_LEVEL_*). The
+ * LOG_* macros of the higher levels expand to nothing, so the calls and the
+ * evaluation of their arguments are removed from the image.
+ */
+#ifndef LOG_COMPILE_LEVEL
+#define LOG_COMPILE_LEVEL LOG_LEVEL_VERBOSE
+#endif
+
+#if LOG_COMPILE_LEVEL >= LOG_LEVEL_FATAL
+#define LOG_FATAL(...) Logger.fatal(__VA_ARGS__)
+#else
+#define LOG_FATAL(...) do {} while (0)
+#endif
+
+#if LOG_COMPILE_LEVEL >= LOG_LEVEL_ERROR
+#define LOG_ERROR(...) Logger.error(__VA_ARGS__)
+#else
+#define LOG_ERROR(...) do {} while (0)
+#endif
+
+#if LOG_COMPILE_LEVEL >= LOG_LEVEL_WARNING
+#define LOG_WARNING(...) Logger.warning(__VA_ARGS__)
+#else
+#define LOG_WARNING(...) do {} while (0)
+#endif
+
+#if LOG_COMPILE_LEVEL >= LOG_LEVEL_NOTICE
+#define LOG_NOTICE(...) Logger.notice(__VA_ARGS__)
+#else
+#define LOG_NOTICE(...) do {} while (0)
+#endif
+
+#if LOG_COMPILE_LEVEL >= LOG_LEVEL_TRACE
+#define LOG_TRACE(...) Logger.trace(__VA_ARGS__)
+#else
+#define LOG_TRACE(...) do {} while (0)
+#endif
+
+#if LOG_COMPILE_LEVEL >= LOG_LEVEL_VERBOSE
+#define LOG_VERBOSE(...) Logger.verbose(__VA_ARGS__)
+#else
+#define LOG_VERBOSE(...) do {} while (0)
+#endif
+
+// Number of the records of every ring (power of two)
+#ifndef ASYNC_LOG_RING_SIZE
+#define ASYNC_LOG_RING_SIZE 8
+#endif
+
+// Max number of the arguments and size of the copied strings of a record
+#define ASYNC_LOG_MAX_ARGS 6
+#define ASYNC_LOG_TEXT_SIZE 128
+
+// Type of an argument of a log record
+enum LogArgType
+{
+  Log_Arg_Int = 0,
+  Log_Arg_Unsigned = 1,
+  Log_Arg_Double = 2,
+  Log_Arg_String = 3,
+  Log_Arg_Flash = 4,
+  Log_Arg_Pointer = 5
+};
+
+union LogArg
+{
+  int32_t i;
+  uint32_t u;
+  double d;
+  uint16_t offset;
+  const __FlashStringHelper *flash;
+  const char *pointer;
+};
+
+struct LogRecord
+{
+  const __FlashStringHelper *format;
+  uint8_t level;
+  uint8_t argc;
+  uint8_t textLength;
+  bool truncated;
+  // Written synchronously: the strings are pointed, not copied
+  bool direct;
+  uint8_t types[ASYNC_LOG_MAX_ARGS];
+  LogArg args[ASYNC_LOG_MAX_ARGS];
+  char text[ASYNC_LOG_TEXT_SIZE];
+};
+
+class AsyncLogging
+{
+public:
+  /**
+   * Init the logger (records formatted synchronously until start)
+   *
+   * level: Max level of the records (LOG_LEVEL_*)
+   * output: Console
+   */
+  void begin(int level, Print *output);
+
+  /**
+   * Register the task as producer with its own ring
+   */
+  void registerTask(TaskId taskId, TaskHandle_t handle);
+
+  /**
+   * Defer the records to the logger task, notified at every record
+   */
+  void start(TaskHandle_t logger);
+
+  /**
+   * Format and write the records of all the rings (logger task only)
+   *
+   * return: Number of the records written
+   */
+  uint32_t drain();
+
+  /**
+   * Add the counters of the logger to the JSON message:
+   *  log: {written, dropped, truncated}
+   */
+  void report(JsonDocument &message);
+
+  template <typename... Args>
+  void fatal(const __FlashStringHelper *format, const Args &...args)
+  {
+    log(LOG_LEVEL_FATAL, format, args...);
+  }
+
+  template <typename... Args>
+  void error(const __FlashStringHelper *format, const Args &...args)
+  {
+    log(LOG_LEVEL_ERROR, format, args...);
+  }
+
+  template <typename... Args>
+  void warning(const __FlashStringHelper *format, const Args &...args)
+  {
+    log(LOG_LEVEL_WARNING, format, args...);
+  }
+
+  template <typename... Args>
+  void notice(const __FlashStringHelper *format, const Args &...args)
+  {
+    log(LOG_LEVEL_NOTICE, format, args...);
+  }
+
+  template <typename... Args>
+  void trace(const __FlashStringHelper *format, const Args &...args)
+  {
+    log(LOG_LEVEL_TRACE, format, args...);
+  }
+
+  template <typename... Args>
+  void verbose(const __FlashStringHelper *format, const Args &...args)
+  {
+    log(LOG_LEVEL_VERBOSE, format, args...);
+  }
+
+private:
+  template <typename... Args>
+  void log(int recordLevel, const __FlashStringHelper *format, const Args &...args)
+  {
+    if (recordLevel > level)
+    {
+      return;
+    }
+
+    LogRecord record;
+
+    record.format = format;
+    record.level = recordLevel;
+    record.argc = 0;
+    record.textLength = 0;
+    record.truncated = false;
+    record.direct = synchronous();
+
+    int unused[] = {0, (add(record, args), 0)...};
+    (void)unused;
+
+    submit(record);
+  }
+
+  void submit(const LogRecord &record);
+
+  /**
+   * Return true if the records of the caller are written synchronously
+   * (before the start or in the logger task)
+   */
+  static bool synchronous();
+
+  // Capture of the arguments
+  static LogArg *next(LogRecord &record, LogArgType type);
+  static void add(LogRecord &record, const char *value);
+  static void add(LogRecord &record, const String &value);
+  static void add(LogRecord &record, const __FlashStringHelper *value);
+  static void add(LogRecord &record, double value);
+  static void add(LogRecord &record, bool value);
+  static void add(LogRecord &record, char value);
+
+  template <typename T>
+  static typename std::enable_if<std::is_integral<T>::value || std::is_enum<T>::value>::type
+  add(LogRecord &record, T value)
+  {
+    if (std::is_unsigned<T>::value)
+    {
+      LogArg *arg = next(record, Log_Arg_Unsigned);
+
+      if (arg != NULL)
+      {
+        arg->u = (uint32_t)value;
+      }
+    }
+    else
+    {
+      LogArg *arg = next(record, Log_Arg_Int);
+
+      if (arg != NULL)
+      {
+        arg->i = (int32_t)value;
+      }
+    }
+  }
+
+  int level = LOG_LEVEL_SILENT;
+  Print *output = NULL;
+};
+
+extern AsyncLogging Logger;
+
+#endif
@@ -0,0 +1,320 @@
+/**
+ * This bme280.h declares the driver of the Bosch BME280 sensor (temperature,
+ * humidity and pressure) on the I2C bus.
+ *
+ * MIT License
+ *
+ * ESP32 MQTT - Samples code
+ * Copyright (c) 2021 Antonio Musarra's Blog - https://www.dontesta.it
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in the
+ * Software without restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the
+ * Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef BME280_H
+#define BME280_H
+
+#include <Arduino.h>
+#include <Wire.h>
+
+/**
+ * A sample is a single burst read of the data registers 0xF7-0xFE
+ * (pressure, temperature and humidity): the three channels are compensated
+ * from the same raw block with the formulas of the datasheet (section 4.2.3
+ * and 8.2), temperature first for t_fine. The altitude is derived from the
+ * compensated pressure, without other reads.
+ *
+ * The acquisition is set by a profile: mode, oversampling of every channel,
+ * IIR filter and standby time (normal mode). In forced mode the sensor
+ * sleeps between the samples (no self-heating of the die, about 0.1 µA) and
+ * a conversion is started by trigger(): the data registers are ready after
+ * measurement_time_us() of the profile.
+ */
+
+// I2C addresses (SDO to GND or to VDDIO)
+#define BME280_ADDRESS 0x76
+#define BME280_ADDRESS_ALTERNATE 0x77
+
+// Standard atmospheric pressure at sea level in hPa
+#define BME280_SEA_LEVEL_HPA 1013.25F
+
+// Interval in ms of the polls of the copy of the trimming parameters after
+// a soft reset, and max number of the polls
+#define BME280_RESET_MS 10
+#define BME280_RESET_POLLS 10
+
+// Span in Pa of the pressure around the anchor of the altitude cache
+#define BME280_ALTITUDE_SPAN 100.0F
+
+// Mode (ctrl_meas[1:0])
+enum Bme280Mode
+{
+  Bme280_Mode_Sleep = 0,
+  Bme280_Mode_Forced = 1,
+  Bme280_Mode_Normal = 3
+};
+
+// Oversampling of a channel (osrs_t, osrs_p, osrs_h)
+enum Bme280Oversampling
+{
+  Bme280_Oversampling_Skipped = 0,
+  Bme280_Oversampling_X1 = 1,
+  Bme280_Oversampling_X2 = 2,
+  Bme280_Oversampling_X4 = 3,
+  Bme280_Oversampling_X8 = 4,
+  Bme280_Oversampling_X16 = 5
+};
+
+// Coefficient of the IIR filter (config[4:2])
+enum Bme280Filter
+{
+  Bme280_Filter_Off = 0,
+  Bme280_Filter_X2 = 1,
+  Bme280_Filter_X4 = 2,
+  Bme280_Filter_X8 = 3,
+  Bme280_Filter_X16 = 4
+};
+
+// Standby time in normal mode (config[7:5])
+enum Bme280Standby
+{
+  Bme280_Standby_0_5_Ms = 0,
+  Bme280_Standby_62_5_Ms = 1,
+  Bme280_Standby_125_Ms = 2,
+  Bme280_Standby_250_Ms = 3,
+  Bme280_Standby_500_Ms = 4,
+  Bme280_Standby_1000_Ms = 5,
+  Bme280_Standby_10_Ms = 6,
+  Bme280_Standby_20_Ms = 7
+};
+
+// Acquisition profile
+struct Bme280Profile
+{
+  const char *name;
+  Bme280Mode mode;
+  Bme280Oversampling temperature;
+  Bme280Oversampling pressure;
+  Bme280Oversampling humidity;
+  Bme280Filter filter;
+  Bme280Standby standby;
+};
+
+/**
+ * Predefined profiles (recommended modes of the datasheet, section 3.5):
+ *  weather: forced, x1 on all the channels, no filter (default)
+ *  humidity: forced, temperature and humidity x1, pressure skipped
+ *  indoor: normal 0.5 ms, temperature x2, pressure x16, humidity x1, filter x16
+ *  continuous: normal 0.5 ms, x16 on all the channels, no filter
+ */
+#define BME280_PROFILE_DEFAULT "weather"
+
+/**
+ * Return a predefined profile by name (NULL if not found)
+ */
+const Bme280Profile *bme280_profile(const char *name);
+
+// Raw values of the data registers
+struct Bme280Raw
+{
+  int32_t pressure;
+  int32_t temperature;
+  int32_t humidity;
+};
+
+// Compensated values
+struct Bme280Sample
+{
+  float temperature; // °C
+  float humidity;    // %RH
+  float pressure;    // Pa
+};
+
+// Trimming parameters (factory calibration stored in the sensor)
+struct Bme280Calibration
+{
+  uint16_t t1;
+  int16_t t2;
+  int16_t t3;
+
+  uint16_t p1;
+  int16_t p2;
+  int16_t p3;
+  int16_t p4;
+  int16_t p5;
+  int16_t p6;
+  int16_t p7;
+  int16_t p8;
+  int16_t p9;
+
+  uint8_t h1;
+  int16_t h2;
+  uint8_t h3;
+  int16_t h4;
+  int16_t h5;
+  int8_t h6;
+};
+
+class Bme280
+{
+public:
+  /**
+   * Check the chip, reset it, read the trimming parameters and configure
+   * the profile. The bus is started by the caller (it's shared by the
+   * sensors): begin() doesn't call wire.begin().
+   *
+   * return: false if the sensor doesn't answer or it isn't a BME280
+   */
+  bool begin(const Bme280Profile &profile, uint8_t address = BME280_ADDRESS,
+             TwoWire &wire = Wire);
+
+  /**
+   * The steps of begin(), for an init that doesn't wait (e.g. a recovery
+   * driven by timers): reset() checks the chip at the address and bus of the
+   * last begin() and starts a soft reset, updating() is busy until the
+   * trimming parameters are copied (after BME280_RESET_MS, polled up to
+   * BME280_RESET_POLLS times), load() reads them and configures the profile
+   *
+   * return: false on a bus error (or if the chip isn't a BME280)
+   */
+  bool reset();
+  bool updating(bool &busy);
+  bool load(const Bme280Profile &profile);
+
+  /**
+   * Configure a profile (the sensor goes to sleep first, the config
+   * register is ignored in normal mode)
+   */
+  bool configure(const Bme280Profile &profile);
+
+  /**
+   * Start a conversion in forced mode (nothing in normal mode)
+   */
+  bool trigger();
+
+  /**
+   * Return the current profile
+   */
+  const Bme280Profile &profile() const
+  {
+    return *currentProfile;
+  }
+
+  /**
+   * Read a sample with a single burst of the data registers
+   *
+   * return: false on a bus error
+   */
+  bool read(Bme280Sample &sample);
+
+  /**
+   * Read the raw values with a single burst of the data registers
+   *
+   * return: false on a bus error
+   */
+  bool read_raw(Bme280Raw &raw);
+
+  /**
+   * Read the status register: busy is true while a conversion is running
+   *
+   * return: false on a bus error
+   */
+  bool measuring(bool &busy);
+
+  /**
+   * Compensate a raw block with the trimming parameters of the sensor
+   */
+  Bme280Sample compensate(const Bme280Raw &raw) const
+  {
+    return compensate(calibration, raw);
+  }
+
+  /**
+   * Return the number of the I2C transactions since the begin
+   */
+  uint32_t transactions() const
+  {
+    return transactionCount;
+  }
+
+  /**
+   * Compensate a raw block with the trimming parameters (datasheet formulas,
+   * 32-bit integer temperature and humidity, 64-bit integer pressure)
+   */
+  static Bme280Sample compensate(const Bme280Calibration &calibration, const Bme280Raw &raw);
+
+  /**
+   * Return the max time in µs of a conversion with a profile (datasheet,
+   * section 9.1)
+   */
+  static uint32_t measurement_time_us(const Bme280Profile &profile);
+
+  /**
+   * Return the altitude in m of a pressure
+   *
+   * pressure: Pressure in Pa
+   * seaLevel: Pressure at the sea level in hPa
+   */
+  static float altitude(float pressure, float seaLevel = BME280_SEA_LEVEL_HPA);
+
+private:
+  bool write_register(uint8_t reg, uint8_t value);
+  bool read_registers(uint8_t reg, uint8_t *buffer, size_t length);
+
+  TwoWire *wire = NULL;
+  uint8_t address = BME280_ADDRESS;
+  Bme280Calibration calibration;
+  const Bme280Profile *currentProfile = NULL;
+  uint8_t ctrlMeas = 0;
+  uint32_t transactionCount = 0;
+};
+
+/**
+ * Altitude of the pressures of a sensor with a reference pressure at sea
+ * level (QNH). The barometric formula (powf) is computed only when the
+ * pressure moves more than BME280_ALTITUDE_SPAN Pa from the anchor of the
+ * cache: in between the altitude is the tangent at the anchor, with an
+ * error of a few mm on the span.
+ */
+class Bme280Altimeter
+{
+public:
+  /**
+   * Set the pressure at sea level in hPa (the cache is cleared)
+   */
+  void set_sea_level(float seaLevel);
+
+  /**
+   * Return the pressure at sea level in hPa
+   */
+  float sea_level() const
+  {
+    return seaLevel;
+  }
+
+  /**
+   * Return the altitude in m of a pressure in Pa (NAN if the pressure is
+   * NAN)
+   */
+  float altitude(float pressure);
+
+private:
+  float seaLevel = BME280_SEA_LEVEL_HPA;
+  float anchorPressure = NAN;
+  float anchorAltitude = 0.0F;
+  float slope = 0.0F;
+};
+
+#endif
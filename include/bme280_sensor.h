@@ -0,0 +1,144 @@
+/**
+ * This bme280_sensor.h declares the sensor driver of a BME280 (readings of
+ * temperature, humidity, pressure and altitude).
+ *
+ * MIT License
+ *
+ * ESP32 MQTT - Samples code
+ * Copyright (c) 2021 Antonio Musarra's Blog - https://www.dontesta.it
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in the
+ * Software without restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the
+ * Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef BME280_SENSOR_H
+#define BME280_SENSOR_H
+
+#include <Arduino.h>
+#include <Wire.h>
+#include "bme280.h"
+#include "sensor.h"
+#include "sensor_acquisition.h"
+
+// Margin in ms of the trigger of a conversion before the deadline
+#define BME280_TRIGGER_MARGIN 1
+
+/**
+ * Change in m of the altitude before it's read again: the altitude of a
+ * fixed site only moves with the weather, so the readings in between are
+ * skipped (its aggregates are not published in the windows without them)
+ */
+#ifndef BME280_ALTITUDE_THRESHOLD
+#define BME280_ALTITUDE_THRESHOLD 1.0F
+#endif
+
+class Bme280Sensor : public SensorDriver
+{
+public:
+  /**
+   * Init the sensor at an address of a bus and configure the profile
+   *
+   * bus: Index of the bus (for the identification)
+   * return: false if the sensor doesn't answer or it isn't a BME280
+   */
+  bool begin(const Bme280Profile &profile, uint8_t address, TwoWire &wire, uint8_t bus);
+
+  /**
+   * Configure a profile (sampler task)
+   */
+  bool configure(const Bme280Profile &profile)
+  {
+    return device.configure(profile);
+  }
+
+  /**
+   * Set the pressure at sea level in hPa of the altitude (sampler task)
+   */
+  void set_sea_level(float seaLevel)
+  {
+    altimeter.set_sea_level(seaLevel);
+    reportedAltitude = NAN;
+  }
+
+  const char *name() const override
+  {
+    return "bme280";
+  }
+
+  uint16_t location() const override
+  {
+    return (bus << 8) | address;
+  }
+
+  void attach(uint8_t channel, uint32_t id) override
+  {
+    this->id = id;
+  }
+
+  /**
+   * Measurement time of the profile plus the margin (0 in normal mode, the
+   * sensor converts continuously)
+   */
+  uint32_t trigger_lead() const override;
+
+  /**
+   * Measurement time of the profile plus the margin and 1 ms for the read,
+   * in both modes (in normal mode a faster read gets the same sample again)
+   */
+  uint32_t min_period() const override;
+
+  void trigger() override
+  {
+    acquisition.trigger();
+  }
+
+  void read(SensorCallback callback, void *arg) override;
+
+  /**
+   * Init again the sensor with its profile (reset, trimming parameters and
+   * configuration), e.g. after a power cycle of the sensor or of the bus.
+   * The steps are driven by the timers of the acquisition.
+   */
+  void recover(SensorRecoverCallback callback, void *arg) override
+  {
+    acquisition.recover(device.profile(), callback, arg);
+  }
+
+  /**
+   * bus, address
+   */
+  void describe(JsonObject object) override;
+
+  /**
+   * profile, qnh, transactions and time of the phases of the acquisition
+   */
+  void report(JsonObject object) override;
+
+private:
+  static void on_sample(void *arg, bool ok, const Bme280Sample &sample);
+
+  Bme280 device;
+  SensorAcquisition acquisition;
+  Bme280Altimeter altimeter;
+  float reportedAltitude = NAN;
+  uint8_t bus = 0;
+  uint8_t address = BME280_ADDRESS;
+  uint32_t id = 0;
+
+  SensorCallback pendingCallback = NULL;
+  void *pendingArg = NULL;
+};
+
+#endif
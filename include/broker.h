@@ -0,0 +1,126 @@
+/**
+ * This broker.h declares the list of the MQTT Brokers and their health
+ * scoring used to select the broker to connect to.
+ *
+ * MIT License
+ *
+ * ESP32 MQTT - Samples code
+ * Copyright (c) 2021 Antonio Musarra's Blog - https://www.dontesta.it
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in the
+ * Software without restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the
+ * Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef BROKER_H
+#define BROKER_H
+
+#include <stdint.h>
+
+// Max number of the MQTT Brokers (the primary and the fallbacks)
+#define BROKER_MAX 4
+
+/**
+ * MQTT Broker and its health.
+ *
+ * The score of the broker is a latency in ms (lower is better) that sums the
+ * connect time, the round trip time measured while connected, a penalty for
+ * every failed publish and a penalty for the position in the list, so that
+ * the primary is preferred when healthy.
+ */
+struct Broker
+{
+  const char *host;
+  uint16_t port;
+
+  // EWMA of the connect time and of the round trip time in ms
+  uint32_t connectMs;
+  uint32_t rttMs;
+
+  // Failed publishes since the last connect
+  uint16_t publishFailures;
+
+  // Consecutive failed connects and time (ms) of the last one
+  uint16_t connectFailures;
+  unsigned long lastFailureAt;
+};
+
+/**
+ * Add a broker to the list (the first added is the primary)
+ */
+void broker_add(const char *host, uint16_t port);
+
+/**
+ * Return the number of the brokers
+ */
+int broker_count();
+
+/**
+ * Return the broker by index
+ */
+Broker *broker_get(int index);
+
+/**
+ * Return the index of the current (last connected or attempted) broker
+ */
+int broker_current_index();
+
+/**
+ * Select the broker for the next connect attempt
+ *
+ * waitMs: Time in ms to wait before the attempt (backoff after failures)
+ * return: Index of the selected broker
+ */
+int broker_select(unsigned long *waitMs);
+
+/**
+ * Return the score of the broker (lower is better)
+ */
+uint32_t broker_score(int index);
+
+/**
+ * Record the outcome of a connect attempt
+ */
+void broker_on_connect(int index, uint32_t connectMs);
+void broker_on_connect_failed(int index);
+
+/**
+ * Record the round trip time measured on the current broker
+ */
+void broker_on_rtt(uint32_t rttMs);
+
+/**
+ * Record the outcome of a publish on the current broker
+ */
+void broker_on_publish(bool published);
+
+/**
+ * Check if a broker ahead of the current one in the list is back and scores
+ * better than the current one. Every BROKER_FAILBACK_PROBE_MS the brokers
+ * ahead are probed, one at a time, with a non-blocking TCP connect to their
+ * cached address: the call never blocks, it starts the connect and the
+ * following calls poll it (up to BROKER_PROBE_TIMEOUT_MS).
+ *
+ * return: true if the client should disconnect to fail back
+ */
+bool broker_should_fail_back();
+
+/**
+ * Return the time in ms the caller can wait before the next call of
+ * broker_should_fail_back (short while a probe is in progress, UINT32_MAX
+ * on the primary)
+ */
+uint32_t broker_fail_back_wait_ms();
+
+#endif
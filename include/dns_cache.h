@@ -0,0 +1,65 @@
+/**
+ * This dns_cache.h declares the cache of the DNS resolutions of the MQTT
+ * Brokers host names.
+ *
+ * MIT License
+ *
+ * ESP32 MQTT - Samples code
+ * Copyright (c) 2021 Antonio Musarra's Blog - https://www.dontesta.it
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in the
+ * Software without restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the
+ * Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef DNS_CACHE_H
+#define DNS_CACHE_H
+
+#include <Arduino.h>
+
+/**
+ * The cache keeps the last good address of every host name for a fixed
+ * DNS_CACHE_TTL_MS (5 minutes by default), not for the TTL of the DNS
+ * record: WiFi.hostByName returns only the address, so a record with a
+ * shorter TTL can be served up to DNS_CACHE_TTL_MS after its change. When the refresh of an expired entry fails, the stale
+ * address is served (and the refresh retried after DNS_CACHE_RETRY_MS), so
+ * a resolver outage doesn't stop the reconnections.
+ */
+
+/**
+ * Resolve the host name (or parse the IP address) through the cache
+ *
+ * host: Host name or IP address
+ * address: Resolved address
+ * return: true if an address (fresh or stale) is available
+ */
+bool dns_cache_resolve(const char *host, IPAddress &address);
+
+/**
+ * Return the address of the host name without a lookup: the IP address
+ * itself or the cached address, even if expired
+ *
+ * return: false if the host name is not cached
+ */
+bool dns_cache_lookup(const char *host, IPAddress &address);
+
+/**
+ * Expire the entry of the host name (the address is kept as stale), for
+ * example after a failed connect to the cached address. The entry is kept
+ * if the host was looked up less than DNS_CACHE_RETRY_MS ago, so the failed
+ * connects of a backoff refresh it at most once per retry time.
+ */
+void dns_cache_expire(const char *host);
+
+#endif
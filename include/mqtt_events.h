@@ -0,0 +1,59 @@
+/**
+ * This mqtt_events.h declares the wait of the MQTT pump on its events: data
+ * on the MQTT socket, messages queued by the other tasks or a timeout.
+ *
+ * MIT License
+ *
+ * ESP32 MQTT - Samples code
+ * Copyright (c) 2021 Antonio Musarra's Blog - https://www.dontesta.it
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in the
+ * Software without restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the
+ * Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef MQTT_EVENTS_H
+#define MQTT_EVENTS_H
+
+#include <stdint.h>
+
+/**
+ * The MQTT pump sleeps in select() on the MQTT socket and on a loopback UDP
+ * socket. The other tasks wake it by sending one byte on the loopback
+ * socket (self-pipe), at most one pending wake at a time.
+ */
+
+/**
+ * Create the loopback socket used to wake the MQTT pump
+ *
+ * return: false if the socket can't be created (the wait falls back to
+ * the timeout only)
+ */
+bool mqtt_events_begin();
+
+/**
+ * Wake the MQTT pump (any task)
+ */
+void mqtt_events_wake();
+
+/**
+ * Wait until the MQTT socket is readable, a wake is received or the
+ * timeout expires (MQTT pump task only)
+ *
+ * socketFd: File descriptor of the MQTT socket (-1 if not connected)
+ * timeoutMs: Max time to wait in ms
+ */
+void mqtt_events_wait(int socketFd, uint32_t timeoutMs);
+
+#endif
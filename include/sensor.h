@@ -0,0 +1,345 @@
+/**
+ * This sensor.h declares the interface of the sensor drivers, the static
+ * registry of the sensors and their sampling on the timer wheel.
+ *
+ * MIT License
+ *
+ * ESP32 MQTT - Samples code
+ * Copyright (c) 2021 Antonio Musarra's Blog - https://www.dontesta.it
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in the
+ * Software without restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the
+ * Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef SENSOR_H
+#define SENSOR_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include "window_stats.h"
+
+/**
+ * Every sensor is a driver registered at boot with its sampling period.
+ * The reads of a sensor are scheduled on deadlines, multiples of its period
+ * on the wall clock (epoch time), so the devices of a fleet read at the
+ * same instants; a driver that needs a conversion is triggered before the
+ * deadline by its lead time. The read is asynchronous: the driver completes
+ * it (now or later, from another timer) with typed readings.
+ *
+ * The readings are accumulated in a window (the telemetry interval, a
+ * multiple of the sampling period aligned on the wall clock too) with
+ * streaming statistics: at the end of the window a uniform record with the
+ * aggregates of every quantity is delivered to the sink, so the spikes
+ * between two publishes are seen without publishing every sample.
+ *
+ * A sensor failed after SENSOR_ERROR_THRESHOLD consecutive read errors:
+ * its reads are suspended (the windows are still closed, empty, so the
+ * telemetry keeps reporting the health) and the driver is asked to recover
+ * on a backoff schedule, from SENSOR_RETRY_MIN to SENSOR_RETRY_MAX ms. A
+ * recovered sensor is scheduled again, without a reboot.
+ *
+ * The scheduling runs on the owner of the timer wheel (sampler task). The
+ * telemetry encoder iterates the readings of a record, so a new sensor
+ * needs only its driver.
+ */
+
+// Max number of the registered sensors
+#ifndef SENSOR_REGISTRY_MAX
+#define SENSOR_REGISTRY_MAX 8
+#endif
+
+// Max number of the readings of a record
+#define SENSOR_READINGS_MAX 4
+
+/**
+ * A deadline is realigned when its phase error on the wall clock, caused
+ * by an NTP sync or by the drift correction, exceeds the tolerance in ms
+ */
+#define SENSOR_ALIGN_TOLERANCE 2
+
+// Consecutive read errors of a failed sensor
+#ifndef SENSOR_ERROR_THRESHOLD
+#define SENSOR_ERROR_THRESHOLD 3
+#endif
+
+// Backoff in ms of the recovery of a failed sensor (doubled at every retry)
+#define SENSOR_RETRY_MIN 1000
+#define SENSOR_RETRY_MAX 300000
+
+// Interval in ms of the attempts to start the timers of a sensor that
+// couldn't be started (pool of the timer wheel empty)
+#define SENSOR_TIMER_RETRY_MS 100
+
+// Health of a sensor
+enum SensorHealth
+{
+  Sensor_Healthy = 0,
+  Sensor_Failed = 1
+};
+
+// Physical quantity of a reading (name and unit in sensor_quantity_*)
+enum SensorQuantity
+{
+  Quantity_Temperature = 0, // °C
+  Quantity_Humidity = 1,    // %RH
+  Quantity_Pressure = 2,    // Pa
+  Quantity_Altitude = 3,    // m
+  Quantity_Co2 = 4,         // ppm
+  Quantity_Illuminance = 5, // lx
+  Quantity_Current = 6,     // A
+  Quantity_Count = 7
+};
+
+struct SensorReading
+{
+  uint8_t quantity;
+  float value;
+};
+
+// Aggregates of a quantity over a window (only count if it's empty)
+struct SensorAggregate
+{
+  uint8_t quantity;
+  uint32_t count;
+  float min;
+  float max;
+  float mean;
+  float stddev;
+};
+
+/**
+ * Record of a window: channel (index of the sensor in the registry), health
+ * and read errors so far, reads in the window, aggregates of every
+ * quantity, version of the calibrations, time of the last sample
+ * (monotonic µs), its deadline (epoch ms, 0 if not synced), lateness in ms
+ * from the deadline and deadlines missed so far
+ */
+struct SensorRecord
+{
+  uint8_t channel;
+  uint8_t health;
+  uint8_t count;
+  uint16_t reads;
+  uint32_t errors;
+  uint32_t calibration;
+  uint32_t sequence;
+  int64_t sampledAt;
+  int64_t deadline;
+  uint32_t lateness;
+  uint32_t missed;
+  SensorAggregate aggregates[SENSOR_READINGS_MAX];
+};
+
+/**
+ * Callback of a completed read
+ *
+ * arg: Argument given with the read
+ * ok: False on a bus error (the readings are NAN)
+ * readings: Readings of the sensor
+ * count: Number of the readings
+ */
+typedef void (*SensorCallback)(void *arg, bool ok, const SensorReading *readings,
+                               uint8_t count);
+
+/**
+ * Callback of a completed recovery
+ *
+ * arg: Argument given with the recovery
+ * ok: true if the sensor is working again
+ */
+typedef void (*SensorRecoverCallback)(void *arg, bool ok);
+
+class SensorDriver
+{
+public:
+  virtual ~SensorDriver() {}
+
+  /**
+   * Return the name of the driver (es. bme280)
+   */
+  virtual const char *name() const = 0;
+
+  /**
+   * Return the location of the sensor, the same at every boot (es. bus and
+   * address): with the name of the driver it identifies the sensor
+   */
+  virtual uint16_t location() const
+  {
+    return 0;
+  }
+
+  /**
+   * Called at the registration with the index of the sensor (its channel,
+   * that depends on the sensors found at boot) and its id (sensor_id)
+   */
+  virtual void attach(uint8_t channel, uint32_t id) {}
+
+  /**
+   * Return the time in ms of a conversion started by trigger() (0 if the
+   * driver reads without a conversion)
+   */
+  virtual uint32_t trigger_lead() const
+  {
+    return 0;
+  }
+
+  /**
+   * Return the min sampling period in ms (a fresh sample on every read)
+   */
+  virtual uint32_t min_period() const
+  {
+    return trigger_lead() + 1;
+  }
+
+  /**
+   * Start a conversion, one lead time before the deadline
+   */
+  virtual void trigger() {}
+
+  /**
+   * Read the sensor: the callback runs now or when the data are ready
+   */
+  virtual void read(SensorCallback callback, void *arg) = 0;
+
+  /**
+   * Init again a failed sensor: the callback runs now or when the recovery
+   * is over (the waits are timers, the sampler is never blocked)
+   */
+  virtual void recover(SensorRecoverCallback callback, void *arg)
+  {
+    callback(arg, false);
+  }
+
+  /**
+   * Add the identification of the sensor (es. bus and address) to a JSON
+   * object
+   */
+  virtual void describe(JsonObject object) {}
+
+  /**
+   * Add the metrics of the driver since the last report to a JSON object
+   */
+  virtual void report(JsonObject object) {}
+};
+
+/**
+ * Sink of the records (called by the sampler task)
+ */
+typedef void (*SensorSink)(const SensorRecord &record);
+
+/**
+ * Hook of the readings of every successful read of a sensor (called by the
+ * sampler task)
+ *
+ * channel: Index of the sensor
+ * scheduledMs: Deadline (millis) of the read
+ */
+typedef void (*SensorHook)(void *arg, uint8_t channel, uint32_t scheduledMs,
+                           const SensorReading *readings, uint8_t count);
+
+/**
+ * Register a sensor (at boot, or on the sampler task after sensors_start)
+ *
+ * periodMs: Sampling period in ms
+ * windowMs: Window in ms of the aggregates (a multiple of the period)
+ * return: Index of the sensor (-1 if the registry is full)
+ */
+int sensor_register(SensorDriver *driver, uint32_t periodMs, uint32_t windowMs);
+
+/**
+ * Return the number of the registered sensors
+ */
+int sensor_count();
+
+/**
+ * Return the driver of a sensor
+ */
+SensorDriver *sensor_driver(int index);
+
+/**
+ * Return the id of a sensor, stable across the boots unlike its index: a
+ * hash of the name of the driver, of its location and of its order among
+ * the sensors with the same name and location (es. the simulated ones)
+ */
+uint32_t sensor_id(int index);
+
+/**
+ * Return the sampling period in ms of a sensor
+ */
+uint32_t sensor_period(int index);
+
+/**
+ * Return the window in ms of the aggregates of a sensor
+ */
+uint32_t sensor_window(int index);
+
+/**
+ * Change the sampling period of a sensor (sampler task): the sensor is
+ * scheduled again, the window of the aggregates doesn't change
+ */
+void sensor_set_period(int index, uint32_t periodMs);
+
+/**
+ * Set the hook of the readings of a sensor (sampler task, NULL to remove
+ * it)
+ */
+void sensor_set_hook(int index, SensorHook hook, void *arg);
+
+/**
+ * Add the health of a sensor to a JSON object: health (ok or failed), read
+ * errors, failures, recoveries and timers not started (timerFailures)
+ */
+void sensor_report_health(int index, JsonObject object);
+
+/**
+ * Return the number of the failed sensors
+ */
+int sensors_failed();
+
+/**
+ * Start the sampling of every sensor (sampler task, after timer_wheel_begin)
+ */
+void sensors_start(SensorSink sink);
+
+/**
+ * Schedule again the timers of every sensor, after a change of the lead
+ * times (sampler task)
+ */
+void sensors_schedule();
+
+/**
+ * Start again the timers of the sensors that couldn't be started, at most
+ * every SENSOR_TIMER_RETRY_MS (sampler task, at every wake up)
+ *
+ * return: Time in ms to the next attempt (UINT32_MAX if none is pending)
+ */
+uint32_t sensors_retry_timers();
+
+/**
+ * Return the name and the unit of a quantity
+ */
+const char *sensor_quantity_name(uint8_t quantity);
+const char *sensor_quantity_unit(uint8_t quantity);
+
+/**
+ * Add a record to a JSON message: sensor name, index, identification,
+ * health and read errors, one object for every quantity read in the window
+ * (named by it) with the aggregates {count, min, max, mean, stddev},
+ * version of the calibrations (calVersion), window (interval), sampling
+ * period, deadline, lateness and missed deadlines
+ */
+void sensor_encode(const SensorRecord &record, JsonDocument &message);
+
+#endif
@@ -0,0 +1,164 @@
+/**
+ * This sensor_acquisition.h declares the non-blocking acquisition of the
+ * BME280 as a state machine on the timer wheel of the sampler.
+ *
+ * MIT License
+ *
+ * ESP32 MQTT - Samples code
+ * Copyright (c) 2021 Antonio Musarra's Blog - https://www.dontesta.it
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in the
+ * Software without restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the
+ * Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef SENSOR_ACQUISITION_H
+#define SENSOR_ACQUISITION_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include "bme280.h"
+#include "sensor.h"
+#include "timer_wheel.h"
+
+/**
+ * An acquisition runs in four phases: trigger of the conversion (forced
+ * mode), conversion, burst read of the data registers and compensation.
+ * The conversion is never waited for: a one-shot timer polls the status
+ * register when the measurement time of the profile is over (and then every
+ * ms, up to SENSOR_POLL_MAX polls), and a read requested while the sensor is
+ * converting is completed by the poll that sees the data ready.
+ *
+ * The recovery of a failed sensor is driven by the same timers: soft reset,
+ * polls of the status every BME280_RESET_MS until the trimming parameters
+ * are copied, then their read and the configuration of the profile.
+ *
+ * Every step runs on the owner of the timer wheel (sampler task), the only
+ * user of the sensor, so neither the MQTT pump nor the command executor are
+ * ever stalled by the I2C bus. The time of every phase is recorded and
+ * reported with the task metrics.
+ */
+
+// Max number of the polls of the status after the measurement time
+#ifndef SENSOR_POLL_MAX
+#define SENSOR_POLL_MAX 10
+#endif
+
+// Phases of an acquisition
+enum SensorPhase
+{
+  Sensor_Phase_Trigger = 0,
+  Sensor_Phase_Conversion = 1,
+  Sensor_Phase_Read = 2,
+  Sensor_Phase_Compensate = 3,
+  Sensor_Phase_Count = 4
+};
+
+// State of the acquisition
+enum SensorState
+{
+  Sensor_Idle = 0,       // No conversion in progress (or normal mode)
+  Sensor_Converting = 1, // Conversion triggered, poll timer pending
+  Sensor_Ready = 2,      // Conversion completed, data not read yet
+  Sensor_Recovering = 3  // Soft reset in progress, poll timer pending
+};
+
+/**
+ * Callback of a completed read
+ *
+ * arg: Argument given with the request
+ * ok: False on a bus error
+ * sample: Compensated sample
+ */
+typedef void (*SensorReadCallback)(void *arg, bool ok, const Bme280Sample &sample);
+
+class SensorAcquisition
+{
+public:
+  /**
+   * Init the acquisition of a sensor already configured
+   */
+  void begin(Bme280 &sensor);
+
+  /**
+   * Start a conversion (forced mode) and its poll timer
+   */
+  void trigger();
+
+  /**
+   * Request a read: the callback runs now if no conversion is in progress,
+   * otherwise when the conversion is completed (a conversion whose poll
+   * timer couldn't be started is polled now)
+   */
+  void request(SensorReadCallback callback, void *arg);
+
+  /**
+   * Init again the sensor with a profile: the callback runs when the
+   * recovery is over (now if the sensor doesn't answer). A read requested
+   * meanwhile fails.
+   */
+  void recover(const Bme280Profile &profile, SensorRecoverCallback callback, void *arg);
+
+  /**
+   * Return the state of the acquisition
+   */
+  SensorState state() const
+  {
+    return currentState;
+  }
+
+  /**
+   * Add the time of every phase since the last report to a JSON object and
+   * start a new report window:
+   *  trigger, conversion, read, compensate: [count, avg (µs), max (µs)]
+   *  polls: number of the polls of the status
+   *  timerFailures: number of the poll timers not started (pool empty)
+   */
+  void report(JsonObject report);
+
+private:
+  static void on_poll(void *arg, uint32_t scheduledMs);
+  static void on_reset_poll(void *arg, uint32_t scheduledMs);
+
+  void poll();
+  void reset_poll();
+  void recovered(bool ok);
+  void complete();
+  void timer_failed();
+  void record(SensorPhase phase, uint32_t elapsedUs);
+
+  Bme280 *sensor = NULL;
+  volatile SensorState currentState = Sensor_Idle;
+
+  int64_t triggeredAt = 0;
+  int polls = 0;
+  TimerId pollTimer = TIMER_INVALID;
+
+  const Bme280Profile *recoverProfile = NULL;
+  SensorRecoverCallback recoverCallback = NULL;
+  void *recoverArg = NULL;
+
+  SensorReadCallback pendingCallback = NULL;
+  void *pendingArg = NULL;
+
+  // Time of the phases in the report window (under the lock)
+  portMUX_TYPE statsMux = portMUX_INITIALIZER_UNLOCKED;
+  uint32_t phaseCount[Sensor_Phase_Count] = {};
+  uint64_t phaseTotalUs[Sensor_Phase_Count] = {};
+  uint32_t phaseMaxUs[Sensor_Phase_Count] = {};
+  uint32_t pollCount = 0;
+  uint32_t timerFailures = 0;
+};
+
+#endif
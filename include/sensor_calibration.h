@@ -0,0 +1,106 @@
+/**
+ * This sensor_calibration.h declares the calibration of the readings of the
+ * sensors (offset, gain and linearisation table per channel and quantity).
+ *
+ * MIT License
+ *
+ * ESP32 MQTT - Samples code
+ * Copyright (c) 2021 Antonio Musarra's Blog - https://www.dontesta.it
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in the
+ * Software without restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the
+ * Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef SENSOR_CALIBRATION_H
+#define SENSOR_CALIBRATION_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+/**
+ * A calibration corrects the readings of a quantity of a sensor, once in
+ * the sample path of the registry (before the aggregates and the capture):
+ * the reading is first mapped by the piecewise-linear table, if any (the
+ * end segments extrapolate out of its range), then corrected by gain and
+ * offset:
+ *
+ *  value = gain * table(raw) + offset
+ *
+ * The calibrations are keyed by the id of the sensor (sensor_id), not by
+ * its channel: the channels depend on the sensors found at boot, a
+ * calibration stays with its sensor.
+ *
+ * The calibrations are a small static table owned by the sampler task. The
+ * version is a counter of the updates, stamped into the telemetry, so the
+ * consumers know which calibration produced the values.
+ */
+
+// Calibrations of the table (sensor and quantity pairs)
+#define SENSOR_CALIBRATION_MAX 8
+
+// Points of the linearisation table of a calibration
+#define SENSOR_CALIBRATION_POINTS 8
+
+struct SensorCalibration
+{
+  uint32_t sensor;
+  uint8_t quantity;
+  uint8_t points;
+  float offset;
+  float gain;
+  float raw[SENSOR_CALIBRATION_POINTS];
+  float corrected[SENSOR_CALIBRATION_POINTS];
+};
+
+/**
+ * Set the calibration of a quantity of a sensor (sampler task, or at boot
+ * before the start of the sensors): the points of the table are sorted, an
+ * identity (gain 1, offset 0, no table) removes the calibration
+ *
+ * return: false if the table of the calibrations is full or the calibration
+ *         has more than SENSOR_CALIBRATION_POINTS points
+ */
+bool sensor_calibration_set(const SensorCalibration &calibration);
+
+/**
+ * Return a calibration without effect for a quantity of a sensor
+ *
+ * sensor: Id of the sensor (sensor_id)
+ */
+SensorCalibration sensor_calibration_identity(uint32_t sensor, uint8_t quantity);
+
+/**
+ * Apply the calibration of a quantity of a sensor to a reading (the
+ * reading as it is without a calibration)
+ */
+float sensor_calibration_apply(uint32_t sensor, uint8_t quantity, float value);
+
+/**
+ * Set the version of the calibrations
+ */
+void sensor_calibration_set_version(uint32_t version);
+
+/**
+ * Return the version of the calibrations
+ */
+uint32_t sensor_calibration_version();
+
+/**
+ * Add the calibrations of a sensor to a JSON object: one object for every
+ * quantity calibrated, with offset, gain and points of the table
+ */
+void sensor_calibration_report(uint32_t sensor, JsonObject object);
+
+#endif
@@ -0,0 +1,136 @@
+/**
+ * This sensor_capture.h declares the high-rate capture of a sensor in a RAM
+ * buffer, streamed afterwards in chunks.
+ *
+ * MIT License
+ *
+ * ESP32 MQTT - Samples code
+ * Copyright (c) 2021 Antonio Musarra's Blog - https://www.dontesta.it
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in the
+ * Software without restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the
+ * Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef SENSOR_CAPTURE_H
+#define SENSOR_CAPTURE_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include "sensor.h"
+
+/**
+ * A capture samples one channel of the registry at a high rate for a
+ * limited time: the period of the channel is shortened (down to the min
+ * period of its driver) and a hook of the registry copies the readings of
+ * every sample in a static buffer. The windows of the channel go on, so the
+ * normal telemetry continues during the capture with more reads per window.
+ *
+ * At the end of the time (or when the buffer is full) the period is
+ * restored and the capture is ready: its samples are encoded in JSON
+ * chunks by the publisher, at its own pace, then the capture is released.
+ * One capture at a time.
+ */
+
+// Samples of the buffer (16 bytes each)
+#ifndef SENSOR_CAPTURE_SAMPLES
+#define SENSOR_CAPTURE_SAMPLES 1024
+#endif
+
+// Readings of a sample kept by the capture (the first ones of the driver)
+#define SENSOR_CAPTURE_VALUES 3
+
+// Min period in ms of a capture (100 Hz)
+#define SENSOR_CAPTURE_PERIOD_MIN 10
+
+// Max duration in ms of a capture
+#define SENSOR_CAPTURE_DURATION_MAX 60000
+
+// Samples of a chunk
+#define SENSOR_CAPTURE_CHUNK_SAMPLES 9
+
+/**
+ * Max JSON text of a chunk: the fields other than the samples (clientId
+ * included), then every sample [offset, values...] with its separator (an
+ * offset of 5 digits, values of up to 14 characters). The publisher checks
+ * at compile time that a chunk fits in its payload.
+ */
+#define SENSOR_CAPTURE_SAMPLE_TEXT_MAX 56
+#define SENSOR_CAPTURE_CHUNK_TEXT_MAX \
+  (224 + SENSOR_CAPTURE_CHUNK_SAMPLES * SENSOR_CAPTURE_SAMPLE_TEXT_MAX)
+
+// Capacity of the JSON document of a chunk (the strings are not copied)
+#define SENSOR_CAPTURE_CHUNK_CAPACITY                                  \
+  (JSON_OBJECT_SIZE(9) + JSON_ARRAY_SIZE(SENSOR_CAPTURE_VALUES) +      \
+   JSON_ARRAY_SIZE(SENSOR_CAPTURE_CHUNK_SAMPLES) +                     \
+   SENSOR_CAPTURE_CHUNK_SAMPLES * JSON_ARRAY_SIZE(1 + SENSOR_CAPTURE_VALUES))
+
+enum SensorCaptureState
+{
+  Capture_Idle = 0,
+  Capture_Running = 1,
+  Capture_Ready = 2
+};
+
+/**
+ * Sample of a capture: offset in ms from the start and readings
+ */
+struct SensorCaptureSample
+{
+  uint32_t offset;
+  float values[SENSOR_CAPTURE_VALUES];
+};
+
+/**
+ * Start a capture (sampler task)
+ *
+ * channel: Index of the sensor in the registry
+ * periodMs: Sampling period in ms (0 for the min period of the driver)
+ * durationMs: Duration in ms
+ * ready: Called when the capture is ready to stream (sampler task)
+ * return: false if a capture is in progress or not streamed yet
+ */
+bool sensor_capture_start(int channel, uint32_t periodMs, uint32_t durationMs,
+                          void (*ready)());
+
+/**
+ * Return the state of the capture
+ */
+SensorCaptureState sensor_capture_state();
+
+/**
+ * Return the number of the samples of the capture
+ */
+uint32_t sensor_capture_count();
+
+/**
+ * Return the number of the chunks of a ready capture
+ */
+uint16_t sensor_capture_chunks();
+
+/**
+ * Add a chunk of a ready capture to a JSON message: channel, sensor, start
+ * (epoch ms, 0 if not synced), period, chunk index and count, quantities
+ * and the samples as arrays [offset, values...]
+ *
+ * index: Index of the chunk
+ */
+void sensor_capture_encode(uint16_t index, JsonDocument &message);
+
+/**
+ * Release a streamed capture (a new one can be started)
+ */
+void sensor_capture_release();
+
+#endif
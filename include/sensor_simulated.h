@@ -0,0 +1,78 @@
+/**
+ * This sensor_simulated.h declares a simulated sensor driver, for the tests
+ * of the sampling and encode pipeline without hardware.
+ *
+ * MIT License
+ *
+ * ESP32 MQTT - Samples code
+ * Copyright (c) 2021 Antonio Musarra's Blog - https://www.dontesta.it
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in the
+ * Software without restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the
+ * Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef SENSOR_SIMULATED_H
+#define SENSOR_SIMULATED_H
+
+#include <Arduino.h>
+#include "sensor.h"
+
+/**
+ * The simulated sensor reads a quantity without any bus: a sine wave on
+ * the monotonic time plus a pseudo-random noise. The read is completed at
+ * once, so many simulated sensors with short periods measure the cost of
+ * the scheduling, of the rings and of the encoder. They are registered with
+ * -DSENSOR_SIMULATED=n (see platformio.ini), and by test_sensor_registry on
+ * the host.
+ */
+
+class SimulatedSensor : public SensorDriver
+{
+public:
+  /**
+   * quantity: Quantity of the readings
+   * base: Mean value
+   * amplitude: Amplitude of the sine wave (the noise is 1% of it)
+   * wavePeriodMs: Period in ms of the sine wave
+   */
+  SimulatedSensor(SensorQuantity quantity = Quantity_Temperature, float base = 20.0F,
+                  float amplitude = 1.0F, uint32_t wavePeriodMs = 60000)
+      : quantity(quantity), base(base), amplitude(amplitude), wavePeriodMs(wavePeriodMs)
+  {
+  }
+
+  const char *name() const override
+  {
+    return "simulated";
+  }
+
+  void read(SensorCallback callback, void *arg) override;
+
+  /**
+   * reads
+   */
+  void report(JsonObject object) override;
+
+private:
+  SensorQuantity quantity;
+  float base;
+  float amplitude;
+  uint32_t wavePeriodMs;
+
+  uint32_t noiseState = 2463534242UL;
+  uint32_t reads = 0;
+};
+
+#endif
@@ -0,0 +1,98 @@
+/**
+ * This seqlock.h implements a sequence lock to publish a snapshot from one
+ * writer to many lock-free readers.
+ *
+ * MIT License
+ *
+ * ESP32 MQTT - Samples code
+ * Copyright (c) 2021 Antonio Musarra's Blog - https://www.dontesta.it
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in the
+ * Software without restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the
+ * Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef SEQLOCK_H
+#define SEQLOCK_H
+
+#include <atomic>
+#include <stdint.h>
+#include <string.h>
+#include <type_traits>
+
+/**
+ * Snapshot protected by a sequence lock.
+ *
+ * The writer makes the sequence odd, copies the value and makes the
+ * sequence even again. A reader copies the value between two reads of the
+ * sequence and retries when the sequence was odd or has changed, so it
+ * never blocks the writer and never returns a torn value.
+ *
+ * T: Snapshot type (trivially copyable)
+ */
+template <typename T>
+class Seqlock
+{
+  static_assert(std::is_trivially_copyable<T>::value, "T must be trivially copyable");
+
+public:
+  Seqlock() : sequence(0)
+  {
+    memset(&value, 0, sizeof(T));
+  }
+
+  /**
+   * Publish a new snapshot (single writer only)
+   */
+  void write(const T &snapshot)
+  {
+    uint32_t s = sequence.load(std::memory_order_relaxed);
+
+    sequence.store(s + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    memcpy(&value, &snapshot, sizeof(T));
+
+    sequence.store(s + 2, std::memory_order_release);
+  }
+
+  /**
+   * Read the last snapshot (any number of readers)
+   *
+   * return: Number of the snapshot (0 if nothing has been published yet)
+   */
+  uint32_t read(T &snapshot) const
+  {
+    uint32_t before;
+    uint32_t after;
+
+    do
+    {
+      before = sequence.load(std::memory_order_acquire);
+
+      memcpy(&snapshot, &value, sizeof(T));
+
+      std::atomic_thread_fence(std::memory_order_acquire);
+      after = sequence.load(std::memory_order_relaxed);
+    } while ((before & 1) != 0 || before != after);
+
+    return before / 2;
+  }
+
+private:
+  std::atomic<uint32_t> sequence;
+  T value;
+};
+
+#endif
@@ -0,0 +1,185 @@
+/**
+ * This spsc_ring.h implements a lock-free single-producer/single-consumer
+ * ring buffer of fixed size records.
+ *
+ * MIT License
+ *
+ * ESP32 MQTT - Samples code
+ * Copyright (c) 2021 Antonio Musarra's Blog - https://www.dontesta.it
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in the
+ * Software without restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the
+ * Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef SPSC_RING_H
+#define SPSC_RING_H
+
+#include <atomic>
+#include <stdint.h>
+#include <string.h>
+#include <type_traits>
+
+// Alignment of the producer and consumer indexes (no false sharing)
+#ifndef SPSC_RING_CACHE_LINE
+#define SPSC_RING_CACHE_LINE 64
+#endif
+
+// Policy when the ring is full
+enum SpscPolicy
+{
+  Spsc_Drop_Newest = 0,
+  Spsc_Overwrite_Oldest = 1
+};
+
+// Statistics of the ring
+struct SpscRingStats
+{
+  uint32_t pushed;
+  uint32_t popped;
+  uint32_t dropped;
+  uint32_t overwritten;
+};
+
+/**
+ * Lock-free ring between one producer task and one consumer task.
+ *
+ * The head is written only by the producer. The tail is advanced by the
+ * consumer and, with the overwrite-oldest policy, by the producer when the
+ * ring is full: both sides advance it with a compare and swap. The consumer
+ * copies the record before claiming it, so a record overwritten during the
+ * copy is discarded (the claim fails) and never read torn.
+ *
+ * T: Record type (trivially copyable)
+ * Capacity: Number of records (power of two)
+ * Policy: Spsc_Drop_Newest or Spsc_Overwrite_Oldest
+ */
+template <typename T, uint32_t Capacity, SpscPolicy Policy = Spsc_Drop_Newest>
+class SpscRing
+{
+  static_assert((Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+  static_assert(std::is_trivially_copyable<T>::value, "T must be trivially copyable");
+
+public:
+  SpscRing() : head(0), dropped(0), overwritten(0), pushed(0), tail(0), popped(0)
+  {
+  }
+
+  /**
+   * Push a record (producer only)
+   *
+   * return: false if the record has been dropped (ring full, drop-newest)
+   */
+  bool push(const T &item)
+  {
+    uint32_t h = head.load(std::memory_order_relaxed);
+    uint32_t t = tail.load(std::memory_order_acquire);
+
+    while (h - t == Capacity)
+    {
+      if (Policy == Spsc_Drop_Newest)
+      {
+        dropped.store(dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        return false;
+      }
+
+      // Discard the oldest record, unless the consumer claims it first
+      if (tail.compare_exchange_weak(t, t + 1, std::memory_order_acq_rel,
+                                     std::memory_order_acquire))
+      {
+        overwritten.store(overwritten.load(std::memory_order_relaxed) + 1,
+                          std::memory_order_relaxed);
+        break;
+      }
+    }
+
+    memcpy(&records[h & (Capacity - 1)], &item, sizeof(T));
+
+    head.store(h + 1, std::memory_order_release);
+    pushed.store(pushed.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+
+    return true;
+  }
+
+  /**
+   * Pop the oldest record (consumer only)
+   *
+   * return: false if the ring is empty
+   */
+  bool pop(T &item)
+  {
+    uint32_t t = tail.load(std::memory_order_acquire);
+
+    for (;;)
+    {
+      if (t == head.load(std::memory_order_acquire))
+      {
+        return false;
+      }
+
+      memcpy(&item, &records[t & (Capacity - 1)], sizeof(T));
+
+      // The claim fails if the producer has overwritten the record meanwhile
+      if (tail.compare_exchange_strong(t, t + 1, std::memory_order_acq_rel,
+                                       std::memory_order_acquire))
+      {
+        popped.store(popped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        return true;
+      }
+    }
+  }
+
+  /**
+   * Return the number of the records in the ring
+   */
+  uint32_t size() const
+  {
+    return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+  }
+
+  bool empty() const
+  {
+    return size() == 0;
+  }
+
+  /**
+   * Return the statistics of the ring
+   */
+  SpscRingStats stats() const
+  {
+    SpscRingStats ringStats;
+
+    ringStats.pushed = pushed.load(std::memory_order_relaxed);
+    ringStats.popped = popped.load(std::memory_order_relaxed);
+    ringStats.dropped = dropped.load(std::memory_order_relaxed);
+    ringStats.overwritten = overwritten.load(std::memory_order_relaxed);
+
+    return ringStats;
+  }
+
+private:
+  // Producer side
+  alignas(SPSC_RING_CACHE_LINE) std::atomic<uint32_t> head;
+  std::atomic<uint32_t> dropped;
+  std::atomic<uint32_t> overwritten;
+  std::atomic<uint32_t> pushed;
+
+  // Shared: advanced by the consumer (and by the producer on overwrite)
+  alignas(SPSC_RING_CACHE_LINE) std::atomic<uint32_t> tail;
+  std::atomic<uint32_t> popped;
+
+  alignas(SPSC_RING_CACHE_LINE) T records[Capacity];
+};
+
+#endif
@@ -0,0 +1,78 @@
+/**
+ * This task_metrics.h declares the instrumentation of the FreeRTOS tasks of
+ * the firmware (busy time and worst-case latency).
+ *
+ * MIT License
+ *
+ * ESP32 MQTT - Samples code
+ * Copyright (c) 2021 Antonio Musarra's Blog - https://www.dontesta.it
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in the
+ * Software without restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the
+ * Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef TASK_METRICS_H
+#define TASK_METRICS_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+// Task Identification
+enum TaskId
+{
+  Task_Mqtt = 0,
+  Task_Sampler = 1,
+  Task_Command = 2,
+  Task_Logger = 3,
+  Task_Count = 4
+};
+
+/**
+ * Start the measure of the idle time of the cores (FreeRTOS idle hooks)
+ */
+void task_metrics_begin();
+
+/**
+ * Register the handle of the task (used for the stack high water mark)
+ */
+void task_metrics_register(TaskId taskId, TaskHandle_t handle);
+
+/**
+ * Return the registered task running the caller (Task_Count if none)
+ */
+TaskId task_metrics_current();
+
+/**
+ * Mark the begin and the end of the work of the task. The time between the
+ * two calls is accounted as busy time of the task.
+ */
+void task_metrics_work_begin(TaskId taskId);
+void task_metrics_work_end(TaskId taskId);
+
+/**
+ * Record the latency in µs of an event handled by the task (for example
+ * the time from the arrival of a command to its execution)
+ */
+void task_metrics_latency(TaskId taskId, uint32_t latencyUs);
+
+/**
+ * Add the metrics of every task since the last report to the JSON message
+ * and start a new report window:
+ *  tasks: [{name, cpu (%), events, maxLatency (µs), stackFree}]
+ *  idle: [core 0 (%), core 1 (%)]
+ */
+void task_metrics_report(JsonDocument &message);
+
+#endif
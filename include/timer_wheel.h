@@ -0,0 +1,110 @@
+/**
+ * This timer_wheel.h declares the hierarchical timer wheel used for the
+ * periodic and the delayed work of the firmware.
+ *
+ * MIT License
+ *
+ * ESP32 MQTT - Samples code
+ * Copyright (c) 2021 Antonio Musarra's Blog - https://www.dontesta.it
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in the
+ * Software without restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the
+ * Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <Arduino.h>
+
+/**
+ * The wheel has a resolution of 1 ms and four levels: 256 slots of 1 ms,
+ * then 64 slots of 256 ms, 16.4 s and 17.5 min (about 18.6 hours). Start,
+ * cancel and expiry of a timer are O(1). The times are millis() values
+ * compared as differences, so the wrap of millis() is safe.
+ *
+ * The wheel is advanced by its owner task, that runs the callbacks of the
+ * expired timers: the callbacks must be short and must not block. The
+ * timers can be started and cancelled by any task.
+ */
+
+// Number of the timers in the preallocated pool
+#ifndef TIMER_WHEEL_POOL_SIZE
+#define TIMER_WHEEL_POOL_SIZE 32
+#endif
+
+// Identification of a timer (-1 if not valid): the index of the timer in
+// the pool in the low 16 bits and the generation of the entry in the high
+// ones, so a stale id doesn't match the entry once it's reused
+typedef int32_t TimerId;
+
+#define TIMER_INVALID ((TimerId)-1)
+
+/**
+ * Callback of an expired timer
+ *
+ * arg: Argument given at the start of the timer
+ * scheduledMs: Time (millis) the timer was scheduled to expire at
+ */
+typedef void (*TimerCallback)(void *arg, uint32_t scheduledMs);
+
+/**
+ * Init the wheel
+ *
+ * nowMs: Current time (millis)
+ * owner: Task that advances the wheel (notified when a timer is started)
+ */
+void timer_wheel_begin(uint32_t nowMs, TaskHandle_t owner);
+
+/**
+ * Start a timer
+ *
+ * delayMs: Time to the first expiry in ms
+ * periodMs: Period in ms of the following expiries (0 for a one-shot timer)
+ * return: Identification of the timer (TIMER_INVALID if the pool is empty)
+ */
+TimerId timer_start(uint32_t delayMs, uint32_t periodMs, TimerCallback callback,
+                    void *arg);
+
+/**
+ * Start a timer at an absolute time
+ *
+ * atMs: Time (millis) of the first expiry
+ */
+TimerId timer_start_at(uint32_t atMs, uint32_t periodMs, TimerCallback callback,
+                       void *arg);
+
+/**
+ * Cancel a timer and return it to the pool
+ *
+ * return: false if the timer already expired (one-shot) or was cancelled,
+ *         even if its entry of the pool now runs another timer
+ */
+bool timer_cancel(TimerId timerId);
+
+/**
+ * Run the callbacks of the timers expired up to now (owner task only).
+ * A periodic timer is rescheduled at an exact multiple of its period from
+ * the first expiry (no drift), skipping the expiries already missed.
+ */
+void timer_wheel_advance(uint32_t nowMs);
+
+/**
+ * Return the time in ms the owner can sleep before the next advance
+ * (UINT32_MAX if there is no timer). The value is exact for the timers of
+ * the first level and a lower bound for the others.
+ */
+uint32_t timer_wheel_sleep_ms(uint32_t nowMs);
+
+#endif
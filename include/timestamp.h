@@ -0,0 +1,95 @@
+/**
+ * This timestamp.h declares the timestamp service used to stamp every
+ * published message.
+ *
+ * MIT License
+ *
+ * ESP32 MQTT - Samples code
+ * Copyright (c) 2021 Antonio Musarra's Blog - https://www.dontesta.it
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in the
+ * Software without restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the
+ * Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef TIMESTAMP_H
+#define TIMESTAMP_H
+
+#include <ArduinoJson.h>
+#include <stdint.h>
+
+/**
+ * The timestamp service anchors the epoch time received by the last NTP sync
+ * to the microsecond monotonic counter of the ESP32 (esp_timer). Between two
+ * syncs the epoch time is extrapolated from the monotonic counter, corrected
+ * by the estimated drift of the local oscillator.
+ */
+
+/**
+ * Start the SNTP client and register the sync notification
+ *
+ * ntpServer: Host name of the NTP server
+ */
+void timestamp_begin(const char *ntpServer);
+
+/**
+ * Wait until the first NTP sync or the timeout expires
+ *
+ * timeoutMs: Max time to wait in ms
+ * return: true if the clock has been synced
+ */
+bool timestamp_wait_sync(uint32_t timeoutMs);
+
+/**
+ * Anchor the service to a new epoch time (in µs) received by NTP.
+ * It's called by the SNTP sync notification.
+ */
+void timestamp_on_sync(int64_t epochUs);
+
+/**
+ * Return the current epoch time in µs (0 if never synced)
+ */
+int64_t timestamp_now_us();
+
+/**
+ * Return the current epoch time in ms (0 if never synced)
+ */
+int64_t timestamp_now_ms();
+
+/**
+ * Convert a monotonic time (esp_timer, µs) to epoch time in ms
+ * (0 if never synced)
+ */
+int64_t timestamp_from_monotonic_ms(int64_t monotonicUs);
+
+/**
+ * Return the age in ms of the last NTP sync (-1 if never synced)
+ */
+int32_t timestamp_sync_age_ms();
+
+/**
+ * Return the estimated drift of the local oscillator in ppb
+ */
+int32_t timestamp_drift_ppb();
+
+/**
+ * Add the time attributes to a JSON message:
+ *  time: epoch time in seconds
+ *  timeMs: epoch time in ms
+ *  timeSyncAge: age in ms of the last NTP sync (-1 if never synced)
+ *  timeDrift: estimated drift of the local oscillator in ppm
+ */
+void timestamp_stamp(JsonDocument &message);
+
+#endif
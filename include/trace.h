@@ -0,0 +1,161 @@
+/**
+ * This trace.h declares the binary trace of the hot-path events (commands,
+ * relays, samples and publishes) for the profiling of the latencies.
+ *
+ * MIT License
+ *
+ * ESP32 MQTT - Samples code
+ * Copyright (c) 2021 Antonio Musarra's Blog - https://www.dontesta.it
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in the
+ * Software without restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the
+ * Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <Arduino.h>
+
+/**
+ * A trace record is 16 bytes: event id, core, task, cycle counter of the
+ * core and two arguments. The records are written in a RAM ring (the
+ * oldest are overwritten) by any task, with an atomic increment of the
+ * head: no lock and no formatting on the hot path.
+ *
+ * While the trace is running the CPU frequency is locked to the max, so
+ * the cycle counter is a stable clock. Sync records (cycle counter and
+ * esp_timer time) are written on every core at the start and then at least
+ * every second: the decoder (tools/trace_decode.py) uses them to put the
+ * two cores on the same time line.
+ *
+ * The trace can be removed from the image with -DTRACE_ENABLED=0.
+ */
+
+#ifndef TRACE_ENABLED
+#define TRACE_ENABLED 1
+#endif
+
+// Number of the records of the ring (power of two)
+#ifndef TRACE_RING_SIZE
+#define TRACE_RING_SIZE 1024
+#endif
+
+// Magic of the chunks of a binary dump
+#define TRACE_MAGIC "TRC1"
+
+// Events (keep in sync with tools/trace_decode.py)
+enum TraceEvent
+{
+  Trace_Sync = 0,
+  Trace_Command_Received = 1,
+  Trace_Command_Queued = 2,
+  Trace_Command_Begin = 3,
+  Trace_Command_Parsed = 4,
+  Trace_Gpio_Written = 5,
+  Trace_Command_End = 6,
+  Trace_Relay_Status_Queued = 7,
+  Trace_Publish_Begin = 8,
+  Trace_Publish_Serialized = 9,
+  Trace_Publish_End = 10,
+  Trace_Sample_Begin = 11,
+  Trace_Sample_End = 12,
+  Trace_Telemetry_Begin = 13,
+  Trace_Telemetry_Serialized = 14,
+  Trace_Telemetry_End = 15,
+  Trace_Sensor_Trigger = 16
+};
+
+struct TraceRecord
+{
+  uint16_t event;
+  uint8_t core;
+  uint8_t task;
+  uint32_t cycles;
+  uint32_t arg0;
+  uint32_t arg1;
+};
+
+/**
+ * Header of a chunk of a binary dump, followed by the records
+ */
+struct TraceChunkHeader
+{
+  char magic[4];
+  uint16_t cpuMhz;
+  uint16_t index;
+  uint16_t chunks;
+  uint16_t records;
+};
+
+/**
+ * Start the trace: lock the CPU frequency, write the sync records and
+ * clear the ring
+ */
+void trace_start();
+
+/**
+ * Stop the trace (the records are kept for the dump)
+ */
+void trace_stop();
+
+/**
+ * Return the number of the records in the ring
+ */
+uint32_t trace_count();
+
+/**
+ * Copy the records from the oldest (the trace must be stopped)
+ *
+ * first: Index of the first record to copy (0 is the oldest)
+ * return: Number of the records copied
+ */
+uint32_t trace_read(uint32_t first, TraceRecord *records, uint32_t max);
+
+/**
+ * Return the CPU frequency in MHz of the cycle counter
+ */
+uint16_t trace_cpu_mhz();
+
+/**
+ * Write the records on the console as hexadecimal lines (the trace must be
+ * stopped):
+ *  trace <cpuMhz> <records>
+ *  <32 hexadecimal digits for every record>
+ *  trace end
+ */
+void trace_dump_serial(Print &output);
+
+#if TRACE_ENABLED
+#define TRACE(event, arg0, arg1) trace_event(event, arg0, arg1)
+
+extern volatile bool traceRunning;
+
+void trace_write(uint16_t event, uint32_t arg0, uint32_t arg1);
+
+/**
+ * Write a record (only a flag test when the trace is stopped)
+ */
+static inline void trace_event(uint16_t event, uint32_t arg0, uint32_t arg1)
+{
+  if (traceRunning)
+  {
+    trace_write(event, arg0, arg1);
+  }
+}
+#else
+#define TRACE(event, arg0, arg1) do {} while (0)
+#endif
+
+#endif
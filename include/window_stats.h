@@ -0,0 +1,131 @@
+/**
+ * This window_stats.h declares the streaming statistics of the readings of a
+ * sensor over a telemetry window.
+ *
+ * MIT License
+ *
+ * ESP32 MQTT - Samples code
+ * Copyright (c) 2021 Antonio Musarra's Blog - https://www.dontesta.it
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in the
+ * Software without restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the
+ * Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef WINDOW_STATS_H
+#define WINDOW_STATS_H
+
+#include <math.h>
+#include <stdint.h>
+
+/**
+ * Streaming statistics of a window: count, min, max, mean and variance
+ * with the Welford algorithm (the mean and the sum of the squared
+ * differences are updated at every value, no catastrophic cancellation of
+ * sum(x^2) - sum(x)^2). Fixed size, no allocation; the NAN values (bus
+ * errors) are skipped.
+ */
+class WindowStats
+{
+public:
+  WindowStats()
+  {
+    reset();
+  }
+
+  /**
+   * Start a new window
+   */
+  void reset()
+  {
+    n = 0;
+    minimum = NAN;
+    maximum = NAN;
+    average = 0.0;
+    m2 = 0.0;
+  }
+
+  /**
+   * Add a value to the window
+   */
+  void add(float value)
+  {
+    if (isnan(value))
+    {
+      return;
+    }
+
+    n++;
+
+    double delta = value - average;
+
+    average += delta / n;
+    m2 += delta * (value - average);
+
+    if (n == 1 || value < minimum)
+    {
+      minimum = value;
+    }
+
+    if (n == 1 || value > maximum)
+    {
+      maximum = value;
+    }
+  }
+
+  uint32_t count() const
+  {
+    return n;
+  }
+
+  float min() const
+  {
+    return minimum;
+  }
+
+  float max() const
+  {
+    return maximum;
+  }
+
+  /**
+   * Return the mean (NAN if the window is empty)
+   */
+  float mean() const
+  {
+    return n > 0 ? (float)average : NAN;
+  }
+
+  /**
+   * Return the sample variance (0 with less than two values)
+   */
+  float variance() const
+  {
+    return n > 1 ? (float)(m2 / (n - 1)) : 0.0F;
+  }
+
+  float stddev() const
+  {
+    return sqrtf(variance());
+  }
+
+private:
+  uint32_t n;
+  float minimum;
+  float maximum;
+  double average;
+  double m2;
+};
+
+#endif
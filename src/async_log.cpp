@@ -0,0 +1,347 @@
+/**
+ * This async_log.cpp implements the asynchronous logger with deferred
+ * formatting.
+ *
+ * MIT License
+ *
+ * ESP32 MQTT - Samples code
+ * Copyright (c) 2021 Antonio Musarra's Blog - https://www.dontesta.it
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in the
+ * Software without restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the
+ * Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <Arduino.h>
+#include "async_log.h"
+#include "spsc_ring.h"
+
+AsyncLogging Logger;
+
+// One ring per registered task, the last one is shared by the other contexts
+#define LOG_RINGS (Task_Count + 1)
+#define LOG_SHARED_RING Task_Count
+
+static SpscRing<LogRecord, ASYNC_LOG_RING_SIZE, Spsc_Drop_Newest> rings[LOG_RINGS];
+static TaskHandle_t producers[Task_Count];
+static TaskHandle_t loggerTask = NULL;
+
+static portMUX_TYPE sharedMux = portMUX_INITIALIZER_UNLOCKED;
+
+static uint32_t written = 0;
+static volatile uint32_t truncated = 0;
+
+/**
+ * Return the argument as integer (for the integer specifiers)
+ */
+static int32_t arg_as_int(const LogRecord &record, int index)
+{
+  switch (record.types[index])
+  {
+  case Log_Arg_Double:
+    return (int32_t)record.args[index].d;
+  case Log_Arg_String:
+  case Log_Arg_Flash:
+  case Log_Arg_Pointer:
+    return 0;
+  default:
+    return record.args[index].i;
+  }
+}
+
+/**
+ * Write an argument with the format specifier
+ */
+static void print_arg(Print *output, char specifier, const LogRecord &record, int index)
+{
+  uint8_t type = record.types[index];
+  const LogArg &arg = record.args[index];
+
+  switch (specifier)
+  {
+  case 's':
+  case 'S':
+    if (type == Log_Arg_String)
+    {
+      output->print(record.text + arg.offset);
+    }
+    else if (type == Log_Arg_Pointer)
+    {
+      output->print(arg.pointer != NULL ? arg.pointer : "");
+    }
+    else if (type == Log_Arg_Flash)
+    {
+      output->print(arg.flash);
+    }
+    else
+    {
+      output->print(arg_as_int(record, index));
+    }
+    break;
+  case 'd':
+  case 'i':
+  case 'l':
+    output->print((long)arg_as_int(record, index));
+    break;
+  case 'u':
+    output->print((unsigned long)arg_as_int(record, index));
+    break;
+  case 'D':
+  case 'F':
+    output->print(type == Log_Arg_Double ? arg.d : (double)arg_as_int(record, index));
+    break;
+  case 'x':
+    output->print((unsigned long)arg_as_int(record, index), HEX);
+    break;
+  case 'X':
+    output->print("0x");
+    output->print((unsigned long)arg_as_int(record, index), HEX);
+    break;
+  case 'b':
+    output->print((unsigned long)arg_as_int(record, index), BIN);
+    break;
+  case 'B':
+    output->print("0b");
+    output->print((unsigned long)arg_as_int(record, index), BIN);
+    break;
+  case 'c':
+    output->print((char)arg_as_int(record, index));
+    break;
+  case 't':
+    output->print(arg_as_int(record, index) ? 'T' : 'F');
+    break;
+  case 'T':
+    output->print(arg_as_int(record, index) ? "true" : "false");
+    break;
+  }
+}
+
+/**
+ * Format and write a record
+ */
+static void write_record(Print *output, const LogRecord &record)
+{
+  const char *format = reinterpret_cast<const char *>(record.format);
+  int index = 0;
+
+  for (char c = pgm_read_byte(format); c != '\0'; c = pgm_read_byte(++format))
+  {
+    if (c != '%')
+    {
+      output->print(c);
+      continue;
+    }
+
+    c = pgm_read_byte(++format);
+
+    if (c == '\0')
+    {
+      break;
+    }
+
+    if (c == '%')
+    {
+      output->print(c);
+    }
+    else if (index < record.argc)
+    {
+      print_arg(output, c, record, index++);
+    }
+  }
+
+  written++;
+}
+
+void AsyncLogging::begin(int level, Print *output)
+{
+  this->level = level;
+  this->output = output;
+}
+
+void AsyncLogging::registerTask(TaskId taskId, TaskHandle_t handle)
+{
+  producers[taskId] = handle;
+}
+
+void AsyncLogging::start(TaskHandle_t logger)
+{
+  loggerTask = logger;
+}
+
+uint32_t AsyncLogging::drain()
+{
+  uint32_t count = 0;
+  LogRecord record;
+
+  for (int i = 0; i < LOG_RINGS; i++)
+  {
+    while (rings[i].pop(record))
+    {
+      write_record(output, record);
+      count++;
+    }
+  }
+
+  return count;
+}
+
+void AsyncLogging::report(JsonDocument &message)
+{
+  uint32_t dropped = 0;
+
+  for (int i = 0; i < LOG_RINGS; i++)
+  {
+    dropped += rings[i].stats().dropped;
+  }
+
+  JsonObject log = message.createNestedObject("log");
+
+  log["written"] = written;
+  log["dropped"] = dropped;
+  log["truncated"] = truncated;
+}
+
+void AsyncLogging::submit(const LogRecord &record)
+{
+  if (record.truncated)
+  {
+    truncated++;
+  }
+
+  // During the setup, and in the logger task itself, write it now
+  if (record.direct)
+  {
+    write_record(output, record);
+    return;
+  }
+
+  TaskHandle_t current = xTaskGetCurrentTaskHandle();
+
+  int ring = LOG_SHARED_RING;
+
+  for (int i = 0; i < Task_Count; i++)
+  {
+    if (producers[i] == current)
+    {
+      ring = i;
+      break;
+    }
+  }
+
+  if (ring == LOG_SHARED_RING)
+  {
+    portENTER_CRITICAL(&sharedMux);
+    rings[ring].push(record);
+    portEXIT_CRITICAL(&sharedMux);
+  }
+  else
+  {
+    rings[ring].push(record);
+  }
+
+  xTaskNotifyGive(loggerTask);
+}
+
+bool AsyncLogging::synchronous()
+{
+  return loggerTask == NULL || xTaskGetCurrentTaskHandle() == loggerTask;
+}
+
+LogArg *AsyncLogging::next(LogRecord &record, LogArgType type)
+{
+  if (record.argc == ASYNC_LOG_MAX_ARGS)
+  {
+    record.truncated = true;
+    return NULL;
+  }
+
+  record.types[record.argc] = type;
+
+  return &record.args[record.argc++];
+}
+
+void AsyncLogging::add(LogRecord &record, const char *value)
+{
+  LogArg *arg = next(record, record.direct ? Log_Arg_Pointer : Log_Arg_String);
+
+  if (arg == NULL)
+  {
+    return;
+  }
+
+  // Written before the return of the call: the string is still valid
+  if (record.direct)
+  {
+    arg->pointer = value;
+    return;
+  }
+
+  // No space left: point to the terminator of the previous string
+  if (record.textLength >= ASYNC_LOG_TEXT_SIZE)
+  {
+    arg->offset = ASYNC_LOG_TEXT_SIZE - 1;
+    record.truncated = true;
+    return;
+  }
+
+  // Copy of the string (truncated to the free space of the record)
+  size_t length = value != NULL ? strlen(value) : 0;
+  size_t available = ASYNC_LOG_TEXT_SIZE - record.textLength - 1;
+
+  if (length > available)
+  {
+    length = available;
+    record.truncated = true;
+  }
+
+  arg->offset = record.textLength;
+  memcpy(record.text + record.textLength, value, length);
+  record.text[record.textLength + length] = '\0';
+  record.textLength += length + 1;
+}
+
+void AsyncLogging::add(LogRecord &record, const String &value)
+{
+  add(record, value.c_str());
+}
+
+void AsyncLogging::add(LogRecord &record, const __FlashStringHelper *value)
+{
+  LogArg *arg = next(record, Log_Arg_Flash);
+
+  if (arg != NULL)
+  {
+    arg->flash = value;
+  }
+}
+
+void AsyncLogging::add(LogRecord &record, double value)
+{
+  LogArg *arg = next(record, Log_Arg_Double);
+
+  if (arg != NULL)
+  {
+    arg->d = value;
+  }
+}
+
+void AsyncLogging::add(LogRecord &record, bool value)
+{
+  add(record, (int32_t)value);
+}
+
+void AsyncLogging::add(LogRecord &record, char value)
+{
+  add(record, (int32_t)value);
+}
@@ -0,0 +1,403 @@
+/**
+ * This bme280.cpp implements the driver of the Bosch BME280 sensor with a
+ * single burst read for every sample.
+ *
+ * MIT License
+ *
+ * ESP32 MQTT - Samples code
+ * Copyright (c) 2021 Antonio Musarra's Blog - https://www.dontesta.it
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in the
+ * Software without restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the
+ * Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <Arduino.h>
+#include <math.h>
+#include "bme280.h"
+
+// Registers
+#define BME280_REG_CALIB_00 0x88
+#define BME280_REG_CHIP_ID 0xD0
+#define BME280_REG_RESET 0xE0
+#define BME280_REG_CALIB_26 0xE1
+#define BME280_REG_CTRL_HUM 0xF2
+#define BME280_REG_STATUS 0xF3
+#define BME280_REG_CTRL_MEAS 0xF4
+#define BME280_REG_CONFIG 0xF5
+#define BME280_REG_DATA 0xF7
+
+#define BME280_CHIP_ID 0x60
+#define BME280_RESET_COMMAND 0xB6
+#define BME280_STATUS_IM_UPDATE 0x01
+#define BME280_STATUS_MEASURING 0x08
+
+// Size of the data block (0xF7-0xFE) and of the two calibration blocks
+#define BME280_DATA_LENGTH 8
+#define BME280_CALIB_00_LENGTH 26
+#define BME280_CALIB_26_LENGTH 7
+
+// Raw value of a channel skipped by the sensor
+#define BME280_SKIPPED_20_BITS 0x80000
+#define BME280_SKIPPED_16_BITS 0x8000
+
+static const Bme280Profile profiles[] = {
+    {"weather", Bme280_Mode_Forced, Bme280_Oversampling_X1, Bme280_Oversampling_X1,
+     Bme280_Oversampling_X1, Bme280_Filter_Off, Bme280_Standby_1000_Ms},
+    {"humidity", Bme280_Mode_Forced, Bme280_Oversampling_X1, Bme280_Oversampling_Skipped,
+     Bme280_Oversampling_X1, Bme280_Filter_Off, Bme280_Standby_1000_Ms},
+    {"indoor", Bme280_Mode_Normal, Bme280_Oversampling_X2, Bme280_Oversampling_X16,
+     Bme280_Oversampling_X1, Bme280_Filter_X16, Bme280_Standby_0_5_Ms},
+    {"continuous", Bme280_Mode_Normal, Bme280_Oversampling_X16, Bme280_Oversampling_X16,
+     Bme280_Oversampling_X16, Bme280_Filter_Off, Bme280_Standby_0_5_Ms}};
+
+const Bme280Profile *bme280_profile(const char *name)
+{
+  for (size_t i = 0; i < sizeof(profiles) / sizeof(profiles[0]); i++)
+  {
+    if (strcmp(profiles[i].name, name) == 0)
+    {
+      return &profiles[i];
+    }
+  }
+
+  return NULL;
+}
+
+bool Bme280::write_register(uint8_t reg, uint8_t value)
+{
+  transactionCount++;
+
+  wire->beginTransmission(address);
+  wire->write(reg);
+  wire->write(value);
+
+  return wire->endTransmission() == 0;
+}
+
+bool Bme280::read_registers(uint8_t reg, uint8_t *buffer, size_t length)
+{
+  // Register address and read with a repeated start: one transaction
+  transactionCount++;
+
+  wire->beginTransmission(address);
+  wire->write(reg);
+
+  if (wire->endTransmission(false) != 0)
+  {
+    return false;
+  }
+
+  if (wire->requestFrom(address, (uint8_t)length) != length)
+  {
+    return false;
+  }
+
+  for (size_t i = 0; i < length; i++)
+  {
+    buffer[i] = wire->read();
+  }
+
+  return true;
+}
+
+bool Bme280::begin(const Bme280Profile &profile, uint8_t address, TwoWire &wire)
+{
+  this->address = address;
+  this->wire = &wire;
+
+  if (!reset())
+  {
+    return false;
+  }
+
+  // Wait the copy of the trimming parameters
+  bool busy = true;
+
+  for (int i = 0; i < BME280_RESET_POLLS && busy; i++)
+  {
+    delay(BME280_RESET_MS);
+
+    if (!updating(busy))
+    {
+      return false;
+    }
+  }
+
+  return !busy && load(profile);
+}
+
+bool Bme280::reset()
+{
+  uint8_t chipId;
+
+  if (!read_registers(BME280_REG_CHIP_ID, &chipId, 1) || chipId != BME280_CHIP_ID)
+  {
+    return false;
+  }
+
+  // The status tells if the reset is over
+  write_register(BME280_REG_RESET, BME280_RESET_COMMAND);
+
+  return true;
+}
+
+bool Bme280::updating(bool &busy)
+{
+  uint8_t status;
+
+  if (!read_registers(BME280_REG_STATUS, &status, 1))
+  {
+    return false;
+  }
+
+  busy = (status & BME280_STATUS_IM_UPDATE) != 0;
+
+  return true;
+}
+
+bool Bme280::load(const Bme280Profile &profile)
+{
+  uint8_t c[BME280_CALIB_00_LENGTH];
+  uint8_t h[BME280_CALIB_26_LENGTH];
+
+  if (!read_registers(BME280_REG_CALIB_00, c, sizeof(c)) ||
+      !read_registers(BME280_REG_CALIB_26, h, sizeof(h)))
+  {
+    return false;
+  }
+
+  // Little endian words (datasheet table 16)
+  calibration.t1 = (uint16_t)(c[1] << 8 | c[0]);
+  calibration.t2 = (int16_t)(c[3] << 8 | c[2]);
+  calibration.t3 = (int16_t)(c[5] << 8 | c[4]);
+  calibration.p1 = (uint16_t)(c[7] << 8 | c[6]);
+  calibration.p2 = (int16_t)(c[9] << 8 | c[8]);
+  calibration.p3 = (int16_t)(c[11] << 8 | c[10]);
+  calibration.p4 = (int16_t)(c[13] << 8 | c[12]);
+  calibration.p5 = (int16_t)(c[15] << 8 | c[14]);
+  calibration.p6 = (int16_t)(c[17] << 8 | c[16]);
+  calibration.p7 = (int16_t)(c[19] << 8 | c[18]);
+  calibration.p8 = (int16_t)(c[21] << 8 | c[20]);
+  calibration.p9 = (int16_t)(c[23] << 8 | c[22]);
+  calibration.h1 = c[25];
+  calibration.h2 = (int16_t)(h[1] << 8 | h[0]);
+  calibration.h3 = h[2];
+  calibration.h4 = (int16_t)((int8_t)h[3] * 16 | (h[4] & 0x0F));
+  calibration.h5 = (int16_t)((int8_t)h[5] * 16 | (h[4] >> 4));
+  calibration.h6 = (int8_t)h[6];
+
+  return configure(profile);
+}
+
+bool Bme280::configure(const Bme280Profile &profile)
+{
+  uint8_t ctrlHum = profile.humidity;
+  uint8_t config = profile.standby << 5 | profile.filter << 2;
+
+  currentProfile = &profile;
+  ctrlMeas = profile.temperature << 5 | profile.pressure << 2;
+
+  // Sleep, then the humidity control is applied by the write of ctrl_meas
+  return write_register(BME280_REG_CTRL_MEAS, ctrlMeas | Bme280_Mode_Sleep) &&
+         write_register(BME280_REG_CONFIG, config) &&
+         write_register(BME280_REG_CTRL_HUM, ctrlHum) &&
+         write_register(BME280_REG_CTRL_MEAS,
+                        ctrlMeas | (profile.mode == Bme280_Mode_Normal ? Bme280_Mode_Normal
+                                                                       : Bme280_Mode_Sleep));
+}
+
+bool Bme280::trigger()
+{
+  if (currentProfile == NULL || currentProfile->mode != Bme280_Mode_Forced)
+  {
+    return true;
+  }
+
+  // The sensor goes back to sleep at the end of the conversion
+  return write_register(BME280_REG_CTRL_MEAS, ctrlMeas | Bme280_Mode_Forced);
+}
+
+bool Bme280::read(Bme280Sample &sample)
+{
+  Bme280Raw raw;
+
+  if (!read_raw(raw))
+  {
+    return false;
+  }
+
+  sample = compensate(calibration, raw);
+
+  return true;
+}
+
+bool Bme280::read_raw(Bme280Raw &raw)
+{
+  uint8_t data[BME280_DATA_LENGTH];
+
+  if (!read_registers(BME280_REG_DATA, data, sizeof(data)))
+  {
+    return false;
+  }
+
+  raw.pressure = (int32_t)data[0] << 12 | (int32_t)data[1] << 4 | data[2] >> 4;
+  raw.temperature = (int32_t)data[3] << 12 | (int32_t)data[4] << 4 | data[5] >> 4;
+  raw.humidity = (int32_t)data[6] << 8 | data[7];
+
+  return true;
+}
+
+bool Bme280::measuring(bool &busy)
+{
+  uint8_t status;
+
+  if (!read_registers(BME280_REG_STATUS, &status, 1))
+  {
+    return false;
+  }
+
+  busy = (status & BME280_STATUS_MEASURING) != 0;
+
+  return true;
+}
+
+Bme280Sample Bme280::compensate(const Bme280Calibration &cal, const Bme280Raw &raw)
+{
+  Bme280Sample sample;
+
+  if (raw.temperature == BME280_SKIPPED_20_BITS)
+  {
+    // Every channel needs t_fine
+    sample.temperature = NAN;
+    sample.humidity = NAN;
+    sample.pressure = NAN;
+    return sample;
+  }
+
+  // Temperature (resolution 0.01 °C) and t_fine
+  int32_t var1 = ((((raw.temperature >> 3) - ((int32_t)cal.t1 << 1))) * ((int32_t)cal.t2)) >> 11;
+  int32_t var2 = (((((raw.temperature >> 4) - ((int32_t)cal.t1)) *
+                    ((raw.temperature >> 4) - ((int32_t)cal.t1))) >> 12) *
+                  ((int32_t)cal.t3)) >> 14;
+  int32_t tFine = var1 + var2;
+
+  sample.temperature = ((tFine * 5 + 128) >> 8) / 100.0F;
+
+  // Pressure (Q24.8 Pa)
+  if (raw.pressure == BME280_SKIPPED_20_BITS)
+  {
+    sample.pressure = NAN;
+  }
+  else
+  {
+    int64_t p1 = ((int64_t)tFine) - 128000;
+    int64_t p2 = p1 * p1 * (int64_t)cal.p6;
+
+    p2 = p2 + ((p1 * (int64_t)cal.p5) << 17);
+    p2 = p2 + (((int64_t)cal.p4) << 35);
+    p1 = ((p1 * p1 * (int64_t)cal.p3) >> 8) + ((p1 * (int64_t)cal.p2) << 12);
+    p1 = (((((int64_t)1) << 47) + p1)) * ((int64_t)cal.p1) >> 33;
+
+    if (p1 == 0)
+    {
+      // Avoid a division by zero
+      sample.pressure = NAN;
+    }
+    else
+    {
+      int64_t p = 1048576 - raw.pressure;
+
+      p = (((p << 31) - p2) * 3125) / p1;
+      p1 = (((int64_t)cal.p9) * (p >> 13) * (p >> 13)) >> 25;
+      p2 = (((int64_t)cal.p8) * p) >> 19;
+      p = ((p + p1 + p2) >> 8) + (((int64_t)cal.p7) << 4);
+
+      sample.pressure = (uint32_t)p / 256.0F;
+    }
+  }
+
+  // Humidity (Q22.10 %RH)
+  if (raw.humidity == BME280_SKIPPED_16_BITS)
+  {
+    sample.humidity = NAN;
+  }
+  else
+  {
+    int32_t h = tFine - ((int32_t)76800);
+
+    h = (((((raw.humidity << 14) - (((int32_t)cal.h4) << 20) - (((int32_t)cal.h5) * h)) +
+           ((int32_t)16384)) >> 15) *
+         (((((((h * ((int32_t)cal.h6)) >> 10) *
+              (((h * ((int32_t)cal.h3)) >> 11) + ((int32_t)32768))) >> 10) +
+            ((int32_t)2097152)) * ((int32_t)cal.h2) + 8192) >> 14));
+    h = (h - (((((h >> 15) * (h >> 15)) >> 7) * ((int32_t)cal.h1)) >> 4));
+    h = (h < 0 ? 0 : h);
+    h = (h > 419430400 ? 419430400 : h);
+
+    sample.humidity = (uint32_t)(h >> 12) / 1024.0F;
+  }
+
+  return sample;
+}
+
+/**
+ * Return the oversampling factor (1-16, 0 if skipped)
+ */
+static uint32_t oversampling_factor(Bme280Oversampling oversampling)
+{
+  return oversampling == Bme280_Oversampling_Skipped ? 0 : 1 << (oversampling - 1);
+}
+
+uint32_t Bme280::measurement_time_us(const Bme280Profile &profile)
+{
+  uint32_t temperature = oversampling_factor(profile.temperature);
+  uint32_t pressure = oversampling_factor(profile.pressure);
+  uint32_t humidity = oversampling_factor(profile.humidity);
+
+  // 1.25 + 2.3 * T + (2.3 * P + 0.575) + (2.3 * H + 0.575) ms
+  return 1250 + 2300 * temperature + (pressure != 0 ? 2300 * pressure + 575 : 0) +
+         (humidity != 0 ? 2300 * humidity + 575 : 0);
+}
+
+float Bme280::altitude(float pressure, float seaLevel)
+{
+  // International barometric formula (pressure in hPa)
+  return 44330.0F * (1.0F - powf((pressure / 100.0F) / seaLevel, 0.1903F));
+}
+
+void Bme280Altimeter::set_sea_level(float seaLevel)
+{
+  this->seaLevel = seaLevel;
+  anchorPressure = NAN;
+}
+
+float Bme280Altimeter::altitude(float pressure)
+{
+  if (isnan(pressure))
+  {
+    return NAN;
+  }
+
+  if (isnan(anchorPressure) || fabsf(pressure - anchorPressure) > BME280_ALTITUDE_SPAN)
+  {
+    anchorPressure = pressure;
+    anchorAltitude = Bme280::altitude(pressure, seaLevel);
+
+    // Derivative of the formula: (p/p0)^0.1903 = 1 - h/44330, no other powf
+    slope = -0.1903F * (44330.0F - anchorAltitude) / pressure;
+  }
+
+  return anchorAltitude + slope * (pressure - anchorPressure);
+}
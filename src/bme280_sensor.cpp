@@ -0,0 +1,122 @@
+/**
+ * This bme280_sensor.cpp implements the sensor driver of a BME280 (readings of
+ * temperature, humidity, pressure and altitude).
+ *
+ * MIT License
+ *
+ * ESP32 MQTT - Samples code
+ * Copyright (c) 2021 Antonio Musarra's Blog - https://www.dontesta.it
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in the
+ * Software without restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the
+ * Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <Arduino.h>
+#include "bme280_sensor.h"
+#include "sensor_calibration.h"
+
+bool Bme280Sensor::begin(const Bme280Profile &profile, uint8_t address, TwoWire &wire,
+                         uint8_t bus)
+{
+  this->bus = bus;
+  this->address = address;
+
+  if (!device.begin(profile, address, wire))
+  {
+    return false;
+  }
+
+  acquisition.begin(device);
+
+  return true;
+}
+
+uint32_t Bme280Sensor::trigger_lead() const
+{
+  const Bme280Profile &profile = device.profile();
+
+  if (profile.mode != Bme280_Mode_Forced)
+  {
+    return 0;
+  }
+
+  return (Bme280::measurement_time_us(profile) + 999) / 1000 + BME280_TRIGGER_MARGIN;
+}
+
+uint32_t Bme280Sensor::min_period() const
+{
+  return (Bme280::measurement_time_us(device.profile()) + 999) / 1000 + BME280_TRIGGER_MARGIN + 1;
+}
+
+void Bme280Sensor::read(SensorCallback callback, void *arg)
+{
+  pendingCallback = callback;
+  pendingArg = arg;
+
+  acquisition.request(on_sample, this);
+}
+
+void Bme280Sensor::on_sample(void *arg, bool ok, const Bme280Sample &sample)
+{
+  Bme280Sensor *sensor = (Bme280Sensor *)arg;
+
+  /**
+   * Temperature is in Centigrade, pressure in Pascals and humidity in %
+   * Relative Humidity. The altitude is derived from the pressure with the
+   * pressure at sea level of the site (QNH), and read only when it moves
+   * beyond BME280_ALTITUDE_THRESHOLD. The registry calibrates the readings
+   * after this callback, so the altitude applies the calibration of the
+   * pressure here (the pressure reading stays raw, calibrated once).
+   */
+  SensorReading readings[] = {
+      {Quantity_Temperature, ok ? sample.temperature : NAN},
+      {Quantity_Humidity, ok ? sample.humidity : NAN},
+      {Quantity_Pressure, ok ? sample.pressure : NAN},
+      {Quantity_Altitude, NAN}};
+  uint8_t count = 3;
+
+  if (ok)
+  {
+    float pressure =
+        sensor_calibration_apply(sensor->id, Quantity_Pressure, sample.pressure);
+    float altitude = sensor->altimeter.altitude(pressure);
+
+    if (isnan(sensor->reportedAltitude) ||
+        fabsf(altitude - sensor->reportedAltitude) >= BME280_ALTITUDE_THRESHOLD)
+    {
+      sensor->reportedAltitude = altitude;
+      readings[count++].value = altitude;
+    }
+  }
+
+  if (sensor->pendingCallback != NULL)
+  {
+    sensor->pendingCallback(sensor->pendingArg, ok, readings, count);
+  }
+}
+
+void Bme280Sensor::describe(JsonObject object)
+{
+  object["bus"] = bus;
+  object["address"] = address;
+}
+
+void Bme280Sensor::report(JsonObject object)
+{
+  object["profile"] = device.profile().name;
+  object["qnh"] = altimeter.sea_level();
+  object["transactions"] = device.transactions();
+  acquisition.report(object);
+}
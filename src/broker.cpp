@@ -0,0 +1,352 @@
+/**
+ * This broker.cpp implements the health scoring and the selection of the
+ * MQTT Brokers for the failover and the fail back.
+ *
+ * MIT License
+ *
+ * ESP32 MQTT - Samples code
+ * Copyright (c) 2021 Antonio Musarra's Blog - https://www.dontesta.it
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in the
+ * Software without restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the
+ * Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <Arduino.h>
+#include <errno.h>
+#include <limits.h>
+#include <lwip/sockets.h>
+#include "broker.h"
+#include "dns_cache.h"
+
+// Penalty in ms for the position of the broker in the list
+#define BROKER_PRIORITY_PENALTY_MS 250
+
+// Penalty in ms for every failed publish and every failed connect
+#define BROKER_PUBLISH_FAILURE_PENALTY_MS 1000
+#define BROKER_CONNECT_FAILURE_PENALTY_MS 2000
+
+// Backoff in ms after a failed connect (doubled at every failure)
+#define BROKER_BACKOFF_MIN_MS 1000
+#define BROKER_BACKOFF_MAX_MS 30000
+
+// Interval and timeout in ms of the TCP probe of the preferred brokers
+#ifndef BROKER_FAILBACK_PROBE_MS
+#define BROKER_FAILBACK_PROBE_MS 30000
+#endif
+#define BROKER_PROBE_TIMEOUT_MS 1000
+
+// Interval in ms of the polls of a probe in progress
+#define BROKER_PROBE_POLL_MS 10
+
+static Broker brokers[BROKER_MAX];
+static int brokersCount = 0;
+static int currentIndex = 0;
+static unsigned long lastProbeAt = 0;
+
+// Probe in progress: socket of the non-blocking connect (-1 if none),
+// broker and start time
+static int probeSocket = -1;
+static int probeIndex = 0;
+static unsigned long probeStartedAt = 0;
+
+/**
+ * Exponential moving average (the first sample initializes it)
+ */
+static uint32_t ewma(uint32_t average, uint32_t sample)
+{
+  return average == 0 ? sample : (3 * average + sample) / 4;
+}
+
+/**
+ * Return the time in ms until the end of the backoff of the broker
+ */
+static unsigned long backoff_remaining(const Broker &broker)
+{
+  if (broker.connectFailures == 0)
+  {
+    return 0;
+  }
+
+  unsigned long backoff = BROKER_BACKOFF_MIN_MS << min(broker.connectFailures - 1, 5);
+  backoff = min(backoff, (unsigned long)BROKER_BACKOFF_MAX_MS);
+
+  unsigned long elapsed = millis() - broker.lastFailureAt;
+
+  return elapsed >= backoff ? 0 : backoff - elapsed;
+}
+
+void broker_add(const char *host, uint16_t port)
+{
+  if (brokersCount == BROKER_MAX || host == NULL || *host == '\0')
+  {
+    return;
+  }
+
+  Broker &broker = brokers[brokersCount++];
+
+  memset(&broker, 0, sizeof(broker));
+  broker.host = host;
+  broker.port = port;
+}
+
+int broker_count()
+{
+  return brokersCount;
+}
+
+Broker *broker_get(int index)
+{
+  return &brokers[index];
+}
+
+int broker_current_index()
+{
+  return currentIndex;
+}
+
+uint32_t broker_score(int index)
+{
+  const Broker &broker = brokers[index];
+
+  return broker.connectMs + 2 * broker.rttMs +
+         broker.publishFailures * BROKER_PUBLISH_FAILURE_PENALTY_MS +
+         broker.connectFailures * BROKER_CONNECT_FAILURE_PENALTY_MS +
+         index * BROKER_PRIORITY_PENALTY_MS;
+}
+
+int broker_select(unsigned long *waitMs)
+{
+  int best = -1;
+  uint32_t bestScore = 0;
+  int earliest = 0;
+  unsigned long earliestWait = ULONG_MAX;
+
+  for (int i = 0; i < brokersCount; i++)
+  {
+    unsigned long wait = backoff_remaining(brokers[i]);
+
+    if (wait == 0)
+    {
+      uint32_t score = broker_score(i);
+
+      if (best < 0 || score < bestScore)
+      {
+        best = i;
+        bestScore = score;
+      }
+    }
+    else if (wait < earliestWait)
+    {
+      earliest = i;
+      earliestWait = wait;
+    }
+  }
+
+  if (best >= 0)
+  {
+    *waitMs = 0;
+    currentIndex = best;
+  }
+  else
+  {
+    // Every broker is in backoff: wait for the first one available
+    *waitMs = earliestWait;
+    currentIndex = earliest;
+  }
+
+  return currentIndex;
+}
+
+void broker_on_connect(int index, uint32_t connectMs)
+{
+  Broker &broker = brokers[index];
+
+  broker.connectMs = ewma(broker.connectMs, max(connectMs, (uint32_t)1));
+  broker.connectFailures = 0;
+  broker.publishFailures = 0;
+
+  currentIndex = index;
+  lastProbeAt = millis();
+}
+
+void broker_on_connect_failed(int index)
+{
+  Broker &broker = brokers[index];
+
+  broker.connectFailures++;
+  broker.lastFailureAt = millis();
+}
+
+void broker_on_rtt(uint32_t rttMs)
+{
+  Broker &broker = brokers[currentIndex];
+
+  broker.rttMs = ewma(broker.rttMs, max(rttMs, (uint32_t)1));
+}
+
+void broker_on_publish(bool published)
+{
+  if (!published)
+  {
+    brokers[currentIndex].publishFailures++;
+  }
+}
+
+/**
+ * Start the non-blocking TCP connect of the probe of the first broker ahead
+ * of the current one from index (none if they are all in backoff)
+ */
+static void probe_next(int index)
+{
+  for (int i = index; i < currentIndex; i++)
+  {
+    Broker &broker = brokers[i];
+    IPAddress address;
+
+    // Only the cached address: a lookup blocks (the connects resolve it)
+    if (backoff_remaining(broker) > 0 || !dns_cache_lookup(broker.host, address))
+    {
+      continue;
+    }
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+
+    if (fd < 0)
+    {
+      return;
+    }
+
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+
+    struct sockaddr_in peer;
+
+    memset(&peer, 0, sizeof(peer));
+    peer.sin_family = AF_INET;
+    peer.sin_addr.s_addr = (uint32_t)address;
+    peer.sin_port = htons(broker.port);
+
+    if (connect(fd, (struct sockaddr *)&peer, sizeof(peer)) == 0 || errno == EINPROGRESS)
+    {
+      probeSocket = fd;
+      probeIndex = i;
+      probeStartedAt = millis();
+      return;
+    }
+
+    close(fd);
+    broker_on_connect_failed(i);
+  }
+}
+
+/**
+ * Poll the connect of the probe in progress
+ *
+ * return: 1 if connected, 0 if failed (or timed out), -1 if in progress
+ */
+static int probe_poll()
+{
+  fd_set writeSet;
+  struct timeval timeout = {0, 0};
+
+  FD_ZERO(&writeSet);
+  FD_SET(probeSocket, &writeSet);
+
+  if (select(probeSocket + 1, NULL, &writeSet, NULL, &timeout) <= 0)
+  {
+    return millis() - probeStartedAt >= BROKER_PROBE_TIMEOUT_MS ? 0 : -1;
+  }
+
+  int error = 0;
+  socklen_t length = sizeof(error);
+
+  if (getsockopt(probeSocket, SOL_SOCKET, SO_ERROR, &error, &length) < 0)
+  {
+    return 0;
+  }
+
+  return error == 0 ? 1 : 0;
+}
+
+bool broker_should_fail_back()
+{
+  if (probeSocket < 0)
+  {
+    if (currentIndex == 0 || millis() - lastProbeAt < BROKER_FAILBACK_PROBE_MS)
+    {
+      return false;
+    }
+
+    lastProbeAt = millis();
+    probe_next(0);
+
+    return false;
+  }
+
+  int reachable = probeIndex < currentIndex ? probe_poll() : 0;
+
+  if (reachable < 0)
+  {
+    return false;
+  }
+
+  uint32_t connectMs = millis() - probeStartedAt;
+
+  close(probeSocket);
+  probeSocket = -1;
+
+  // Not ahead of the current broker anymore (connected to another one)
+  if (probeIndex >= currentIndex)
+  {
+    return false;
+  }
+
+  Broker &broker = brokers[probeIndex];
+
+  if (reachable)
+  {
+    broker.connectMs = ewma(broker.connectMs, max(connectMs, (uint32_t)1));
+    broker.connectFailures = 0;
+
+    if (broker_score(probeIndex) < broker_score(currentIndex))
+    {
+      return true;
+    }
+  }
+  else
+  {
+    broker_on_connect_failed(probeIndex);
+  }
+
+  probe_next(probeIndex + 1);
+
+  return false;
+}
+
+uint32_t broker_fail_back_wait_ms()
+{
+  if (probeSocket >= 0)
+  {
+    return BROKER_PROBE_POLL_MS;
+  }
+
+  if (currentIndex == 0)
+  {
+    return UINT32_MAX;
+  }
+
+  unsigned long elapsed = millis() - lastProbeAt;
+
+  return elapsed >= BROKER_FAILBACK_PROBE_MS ? 0 : BROKER_FAILBACK_PROBE_MS - elapsed;
+}
@@ -0,0 +1,151 @@
+/**
+ * This dns_cache.cpp implements the cache of the DNS resolutions with a
+ * fixed lifetime and serve-stale on error.
+ *
+ * MIT License
+ *
+ * ESP32 MQTT - Samples code
+ * Copyright (c) 2021 Antonio Musarra's Blog - https://www.dontesta.it
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in the
+ * Software without restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the
+ * Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <Arduino.h>
+#include <WiFi.h>
+#include "broker.h"
+#include "dns_cache.h"
+
+// Lifetime in ms of a resolved address, the same for every record (the
+// TTL of the record isn't returned by WiFi.hostByName)
+#ifndef DNS_CACHE_TTL_MS
+#define DNS_CACHE_TTL_MS 300000
+#endif
+
+// Time in ms before a new refresh after a failed one (serving stale), and
+// min time between two lookups of a host forced by failed connects
+#define DNS_CACHE_RETRY_MS 30000
+
+// One entry for every MQTT Broker
+#define DNS_CACHE_SIZE BROKER_MAX
+
+struct DnsCacheEntry
+{
+  const char *host;
+  IPAddress address;
+  unsigned long expiresAt;
+
+  // Time (millis) of the last lookup, successful or not
+  unsigned long lookedUpAt;
+};
+
+static DnsCacheEntry entries[DNS_CACHE_SIZE];
+static int entriesCount = 0;
+
+/**
+ * Return the entry of the host name (NULL if not cached)
+ */
+static DnsCacheEntry *find_entry(const char *host)
+{
+  for (int i = 0; i < entriesCount; i++)
+  {
+    if (strcmp(entries[i].host, host) == 0)
+    {
+      return &entries[i];
+    }
+  }
+
+  return NULL;
+}
+
+bool dns_cache_resolve(const char *host, IPAddress &address)
+{
+  // Nothing to resolve for an IP address
+  if (address.fromString(host))
+  {
+    return true;
+  }
+
+  DnsCacheEntry *entry = find_entry(host);
+
+  // The expiration is compared as a difference to be safe on millis wrap
+  if (entry != NULL && (long)(entry->expiresAt - millis()) > 0)
+  {
+    address = entry->address;
+    return true;
+  }
+
+  IPAddress resolved;
+
+  if (WiFi.hostByName(host, resolved) == 1 && (uint32_t)resolved != 0)
+  {
+    if (entry == NULL && entriesCount < DNS_CACHE_SIZE)
+    {
+      entry = &entries[entriesCount++];
+      entry->host = host;
+    }
+
+    if (entry != NULL)
+    {
+      entry->address = resolved;
+      entry->expiresAt = millis() + DNS_CACHE_TTL_MS;
+      entry->lookedUpAt = millis();
+    }
+
+    address = resolved;
+    return true;
+  }
+
+  if (entry == NULL)
+  {
+    return false;
+  }
+
+  // Serve the stale address and retry the refresh later
+  entry->expiresAt = millis() + DNS_CACHE_RETRY_MS;
+  entry->lookedUpAt = millis();
+  address = entry->address;
+
+  return true;
+}
+
+bool dns_cache_lookup(const char *host, IPAddress &address)
+{
+  if (address.fromString(host))
+  {
+    return true;
+  }
+
+  DnsCacheEntry *entry = find_entry(host);
+
+  if (entry == NULL)
+  {
+    return false;
+  }
+
+  address = entry->address;
+  return true;
+}
+
+void dns_cache_expire(const char *host)
+{
+  DnsCacheEntry *entry = find_entry(host);
+
+  // A connect storm doesn't turn into a lookup storm: one every retry time
+  if (entry != NULL && millis() - entry->lookedUpAt >= DNS_CACHE_RETRY_MS)
+  {
+    entry->expiresAt = millis();
+  }
+}
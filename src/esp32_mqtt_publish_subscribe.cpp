@@ -23,17 +23,30 @@
  * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
  */
 
-#include <Adafruit_BME280.h>
-#include <Adafruit_Sensor.h>
 #include <ArduinoJson.h>
-#include <ArduinoLog.h>
 #include <ESP32Ping.h>
-#include <NTPClient.h>
 #include <WiFi.h>
-#include <WiFiUdp.h>
 #include <Wire.h>
+#include <Preferences.h>
 #include <PubSubClient.h>
+#include <esp_pm.h>
+#include <esp_timer.h>
 #include "time.h"
+#include "async_log.h"
+#include "broker.h"
+#include "dns_cache.h"
+#include "mqtt_events.h"
+#include "bme280_sensor.h"
+#include "sensor.h"
+#include "sensor_calibration.h"
+#include "sensor_capture.h"
+#include "sensor_simulated.h"
+#include "seqlock.h"
+#include "spsc_ring.h"
+#include "task_metrics.h"
+#include "timer_wheel.h"
+#include "timestamp.h"
+#include "trace.h"
 
 // Macro to read build flags
 #define ST(A) #A
@@ -55,6 +68,26 @@ const char *mqtt_server = STR(MQTT_SERVER);
 const int mqtt_port = atoi(STR(MQTT_PORT));
 #endif
 
+/**
+ * Fallback MQTT Brokers, in order of preference after the primary
+ * (MQTT_SERVER/MQTT_PORT). The device fails over to them when the primary
+ * is down or slow and fails back when the primary recovers.
+ */
+#ifdef MQTT_SERVER_1
+const char *mqtt_server_1 = STR(MQTT_SERVER_1);
+const int mqtt_port_1 = atoi(STR(MQTT_PORT_1));
+#endif
+
+#ifdef MQTT_SERVER_2
+const char *mqtt_server_2 = STR(MQTT_SERVER_2);
+const int mqtt_port_2 = atoi(STR(MQTT_PORT_2));
+#endif
+
+#ifdef MQTT_SERVER_3
+const char *mqtt_server_3 = STR(MQTT_SERVER_3);
+const int mqtt_port_3 = atoi(STR(MQTT_PORT_3));
+#endif
+
 #ifdef MQTT_USERNAME
 const char *mqtt_username = STR(MQTT_USERNAME);
 #endif
@@ -67,6 +100,18 @@ const char *mqtt_password = STR(MQTT_PASSWORD);
 const char *device_name = STR(DEVICE_NAME);
 #endif
 
+/**
+ * MQTT clean session flag. With the clean session disabled (default) the
+ * broker keeps the subscription and queues the QoS 1 commands while the
+ * device is offline, delivering them as soon as the session is resumed.
+ * The broker must persist the sessions to survive its own restart.
+ */
+#ifdef MQTT_CLEAN_SESSION
+const bool mqtt_clean_session = MQTT_CLEAN_SESSION;
+#else
+const bool mqtt_clean_session = false;
+#endif
+
 #define ONBOARD_LED 2
 
 // Relay pre-defined command
@@ -74,6 +119,22 @@ const char *device_name = STR(DEVICE_NAME);
 #define RELAY_COMMAND_OFF "off"
 #define RELAY_COMMAND_STATUS "status"
 
+// Sensor pre-defined command
+#define SENSOR_COMMAND_TARGET "sensor"
+#define SENSOR_COMMAND_STATUS "status"
+#define SENSOR_COMMAND_PROFILE "profile"
+#define SENSOR_COMMAND_QNH "qnh"
+#define SENSOR_COMMAND_CAPTURE "capture"
+#define SENSOR_COMMAND_CALIBRATION "calibration"
+#define SENSOR_CALIBRATION_RESET "reset"
+
+// Trace pre-defined command
+#define TRACE_COMMAND_TARGET "trace"
+#define TRACE_COMMAND_START "start"
+#define TRACE_COMMAND_STOP "stop"
+#define TRACE_COMMAND_DUMP "dump"
+#define TRACE_DUMP_SERIAL "serial"
+
 // Relay Identification
 enum Relay
 {
@@ -97,6 +158,9 @@ const char *ntpServer = "pool.ntp.org";
 const long gmtOffset_sec = 3600;
 const int daylightOffset_sec = 3600;
 
+// Max time in ms to wait for the first NTP sync at boot
+const uint32_t ntp_sync_timeout = 10000;
+
 /**
  * MQTT Broker Connection details
  * 1. Defined the topic for telemetry data (temperature, humidity and pressure)
@@ -112,449 +176,2207 @@ const char *topic_relay_01_status = "esp32/relay_01_status";
 const char *topic_relay_02_status = "esp32/relay_02_status";
 const char *topic_relay_03_status = "esp32/relay_03_status";
 const char *topic_command = "esp32/command";
+const char *topic_task_metrics = "esp32/task_metrics";
+const char *topic_sensor_status = "esp32/sensor_status";
+const char *topic_sensor_metrics = "esp32/sensor_metrics";
 
-// Prefix for the MQTT Client Identification
-String clientId = "esp32-client-";
+// Topic (private to the device) used to measure the round trip time
+String topic_rtt;
 
-// Defined the value for the status of the relay (active 1, 0 otherwise)
-const int relay_status_on = 1;
-const int relay_status_off = 0;
+// Topic (private to the device) of the binary dump of the trace
+String topic_trace;
 
-// BME280
-Adafruit_BME280 bme;
+// Topic (private to the device) of the chunks of a sensor capture
+String topic_capture;
 
-// Initi variables for values from sensor BME280
-float temperature = 0;
-float humidity = 0;
-float pressure = 0;
-float altitude = 0;
+// Interval in ms of the round trip time probe
+const unsigned long rtt_probe_interval = 15000;
 
-// Interval in ms of the reads
-int counter = 0;
-long interval = 5000;
-long lastMessage = 0;
+// Prefix for the MQTT Client Identification (completed by the eFuse MAC)
+String clientId = "esp32-client-";
 
-// Declare the custom functions
-void callback(char *topic, byte *message, unsigned int length);
-void setup_wifi();
-void update_relay_status(int relayId, const int status);
+// Defined the value for the status of the relay (active 1, 0 otherwise)
+const int relay_status_on = 1;
+const int relay_status_off = 0;
 
-// Init WiFi/WiFiUDP, NTP and MQTT Client
-WiFiUDP ntpUDP;
-WiFiClient espClient;
-NTPClient timeClient(ntpUDP);
-PubSubClient client(mqtt_server, mqtt_port, callback, espClient);
+// Relay Id to Pin lookup
+const int relay_pins[] = {Relay_00_Pin, Relay_01_Pin, Relay_02_Pin, Relay_03_Pin};
 
 /**
-  * MQTT Callback
-  * 
-  * If a message is received on the topic esp32/command (es. Relay off or on).
-  * Format: {$device-name}:{relay;$relayId;$command}
-  * Es: 
-  *  esp32-zone-1:relay;3;off (switch off relay 3 of the specified device)
-  *  esp32-zone-1:relay;2;on (switch on relay 2 of the specified device)
-  *  esp32-zone-1:relay;3;status (get status of the relay 3 of the specified device) 
-  */
-void callback(char *topic, byte *message, unsigned int length)
-{
-  String messageTemp;
+ * Relay state sequence number. It's incremented at every change of a relay
+ * and monotonic across reboots, so the consumers of the (retained) status
+ * topics can order the messages. The NVS holds the end of a block of
+ * numbers reserved ahead and is written only when the block is used up:
+ * one flash write every RELAY_SEQ_BLOCK changes, a reboot skips the rest
+ * of the block.
+ */
+#define RELAY_SEQ_BLOCK 64
 
-  for (int i = 0; i < length; i++)
-  {
-    messageTemp += (char)message[i];
-  }
+Preferences relayPreferences;
+uint32_t relay_state_seq = 0;
+uint32_t relay_seq_reserved = 0;
 
-  Log.notice(F("Message arrived on topic: %s" CR), topic);
-  Log.notice(F("Message Content: %s" CR), messageTemp.c_str());
+// Sequence number of the last change of every relay
+uint32_t relay_changed_seq[4];
 
-  if ((String)topic == (String)topic_command)
-  {
+// Sequence number and time (ms) of the last acknowledged publish of every relay
+uint32_t relay_published_seq[4];
+unsigned long relay_published_at[4];
+bool relay_published[4];
 
-    /**
-     * Parsing of the received command string. This piece of code 
-     * could be written using regular expressions.
-     * ([a-zA-Z,0-9,\-]{3,12}):(\w+);([0-3]);(off|on|status) this could be the 
-     * regular expression which should be sufficient to satisfy the given format.
-     */
-    int indexOfDeviceSeparator = messageTemp.indexOf(":");
-    
-    String deviceName = messageTemp.substring(0, indexOfDeviceSeparator);
-    String statement = messageTemp.substring(indexOfDeviceSeparator + 1,
-                                             messageTemp.length());
+// Max age in ms of the retained relay status before it's published again
+const unsigned long relay_status_max_age = 3600000;
 
-    int indexOfStatementSeparator = statement.indexOf(";");
-    int relayId = statement.substring(indexOfStatementSeparator + 1,
-                                      indexOfStatementSeparator + 2)
-                      .toInt();
-    String command = statement.substring(statement.lastIndexOf(";") + 1,
-                                         statement.length());
+/**
+ * I2C buses: clock (400 kHz fast mode, 1 MHz fast mode plus where the
+ * sensors support it), pins and timeout in ms of a transaction. The second
+ * controller (Wire1) is enabled by its pins.
+ */
+#ifdef I2C_CLOCK
+const uint32_t i2c_clock = I2C_CLOCK;
+#else
+const uint32_t i2c_clock = 400000;
+#endif
 
-    if (!deviceName.isEmpty() && !statement.isEmpty() && !command.isEmpty() &&
-        (String)device_name == deviceName)
-    {
-      Log.notice(F("Try to execute this statement (command %s): %s for relay %d on the device name: %s" CR),
-                 command.c_str(), statement.c_str(), relayId, deviceName.c_str());
+#ifdef I2C_SDA
+const int i2c_sda = I2C_SDA;
+#else
+const int i2c_sda = 21;
+#endif
 
-      /**
-       * The following code block is responsible for executing the instructions 
-       * received from the command topic. This block of code is purely 
-       * educational and can be optimizing to avoid redundant code.
-       */
-      switch (relayId)
-      {
-      case Relay_00:
-        if (command == RELAY_COMMAND_ON)
-        {
-          digitalWrite(Relay_00_Pin, LOW);
-          update_relay_status(Relay_00, relay_status_on);
+#ifdef I2C_SCL
+const int i2c_scl = I2C_SCL;
+#else
+const int i2c_scl = 22;
+#endif
 
-          Log.notice(F("Switch On relay 0" CR));
-        }
-        else if (command == RELAY_COMMAND_OFF)
-        {
-          digitalWrite(Relay_00_Pin, HIGH);
-          update_relay_status(Relay_00, relay_status_off);
+#ifdef I2C_TIMEOUT
+const uint16_t i2c_timeout = I2C_TIMEOUT;
+#else
+const uint16_t i2c_timeout = 50;
+#endif
 
-          Log.notice(F("Switch Off relay 0" CR));
-        }
-        else if (command == RELAY_COMMAND_STATUS)
-        {
-          digitalRead(Relay_00_Pin) == LOW ? update_relay_status(Relay_00, relay_status_on) : update_relay_status(Relay_00, relay_status_off);
-        }
-        break;
-      case Relay_01:
-        if (command == RELAY_COMMAND_ON)
-        {
-          digitalWrite(Relay_01_Pin, LOW);
-          update_relay_status(Relay_01, relay_status_on);
+#if defined(I2C1_SDA) && defined(I2C1_SCL)
+const int i2c1_sda = I2C1_SDA;
+const int i2c1_scl = I2C1_SCL;
+const int i2c_bus_count = 2;
+#else
+const int i2c_bus_count = 1;
+#endif
 
-          Log.notice(F("Switch On relay 1" CR));
-        }
-        else if (command == RELAY_COMMAND_OFF)
-        {
-          digitalWrite(Relay_01_Pin, HIGH);
-          update_relay_status(Relay_01, relay_status_off);
+/**
+ * Sensors: every BME280 found by the scan of the buses at boot (addresses
+ * 0x76 and 0x77 on every bus) is registered as a sensor, with its own
+ * acquisition (sampler task) and its own telemetry messages; the simulated
+ * sensors are registered after them.
+ *
+ * Without a BME280 the device boots degraded (relays and MQTT work) and the
+ * buses are scanned again by the sampler on a backoff schedule, until a
+ * sensor is found. A registered sensor that fails is recovered by the
+ * registry (see include/sensor.h).
+ */
+#define BME280_SENSOR_MAX 4
 
-          Log.notice(F("Switch Off relay 1" CR));
-        }
-        else if (command == RELAY_COMMAND_STATUS)
-        {
-          digitalRead(Relay_01_Pin) == LOW ? update_relay_status(Relay_01, relay_status_on) : update_relay_status(Relay_01, relay_status_off);
-        }
-        break;
-      case Relay_02:
-        if (command == RELAY_COMMAND_ON)
-        {
-          digitalWrite(Relay_02_Pin, LOW);
-          update_relay_status(Relay_02, relay_status_on);
+Bme280Sensor bme280Sensors[BME280_SENSOR_MAX];
+int bme280SensorCount = 0;
 
-          Log.notice(F("Switch On relay 2" CR));
-        }
-        else if (command == RELAY_COMMAND_OFF)
-        {
-          digitalWrite(Relay_02_Pin, HIGH);
-          update_relay_status(Relay_02, relay_status_off);
+// Scans of the buses after the boot and backoff in ms of the next one
+uint32_t sensorScans = 0;
+uint32_t sensorScanMs = SENSOR_RETRY_MIN;
 
-          Log.notice(F("Switch Off relay 2" CR));
-        }
-        else if (command == RELAY_COMMAND_STATUS)
-        {
-          digitalRead(Relay_02_Pin) == LOW ? update_relay_status(Relay_02, relay_status_on) : update_relay_status(Relay_02, relay_status_off);
-        }
-        break;
-      case Relay_03:
-        if (command == RELAY_COMMAND_ON)
-        {
-          digitalWrite(Relay_03_Pin, LOW);
-          update_relay_status(Relay_03, relay_status_on);
+const uint8_t bme280_addresses[] = {BME280_ADDRESS, BME280_ADDRESS_ALTERNATE};
 
-          Log.notice(F("Switch On relay 3" CR));
-        }
-        else if (command == RELAY_COMMAND_OFF)
-        {
-          digitalWrite(Relay_03_Pin, HIGH);
-          update_relay_status(Relay_03, relay_status_off);
+#ifdef SENSOR_SIMULATED
+SimulatedSensor simulatedSensors[SENSOR_SIMULATED];
+#endif
 
-          Log.notice(F("Switch Off relay 3" CR));
-        }
-        else if (command == RELAY_COMMAND_STATUS)
-        {
-          digitalRead(Relay_03_Pin) == LOW ? update_relay_status(Relay_03, relay_status_on) : update_relay_status(Relay_03, relay_status_off);
-        }
-        break;
-      default:
-        Log.warning(F("No relayId recognized" CR));
-        break;
-      }
-    }
-  }
-}
+#ifdef SENSOR_SIMULATED_PERIOD
+const uint32_t simulated_sensor_period = SENSOR_SIMULATED_PERIOD;
+#else
+const uint32_t simulated_sensor_period = 1000;
+#endif
 
 /**
- * Return the relays status
+ * Acquisition profile of the BME280 at boot (see include/bme280.h), it can
+ * be changed by the command sensor;profile;$name. In forced mode the
+ * conversion is triggered before the deadline of the telemetry by its
+ * measurement time plus a margin in ms, so the read at the deadline gets a
+ * fresh sample without waiting.
  */
-int * get_relays_status()
-{
-  static int relaysStatus[4];
+#ifdef BME280_PROFILE
+const char *sensor_profile_name = STR(BME280_PROFILE);
+#else
+const char *sensor_profile_name = BME280_PROFILE_DEFAULT;
+#endif
 
-  digitalRead(Relay_00_Pin) == LOW ? relaysStatus[0] = HIGH : relaysStatus[0] = LOW;
-  digitalRead(Relay_01_Pin) == LOW ? relaysStatus[1] = HIGH : relaysStatus[1] = LOW;
-  digitalRead(Relay_02_Pin) == LOW ? relaysStatus[2] = HIGH : relaysStatus[2] = LOW;
-  digitalRead(Relay_03_Pin) == LOW ? relaysStatus[3] = HIGH : relaysStatus[3] = LOW;
+// Current profile (owned by the sampler after the boot)
+const Bme280Profile *sensorProfile = NULL;
 
-  return relaysStatus;
-}
+/**
+ * Pressure at sea level in hPa (QNH) of the site for the altitude, set by
+ * the command sensor;qnh;$hPa and persisted in NVS. The values out of the
+ * range are refused.
+ */
+Preferences sensorPreferences;
+float sensorQnh = BME280_SEA_LEVEL_HPA;
+
+const float sensor_qnh_min = 850.0F;
+const float sensor_qnh_max = 1100.0F;
 
 /**
- * Update Relay status on the topic
- * 
- * relayId: Identifiier of the relay
- * status: Status of the relay. (o or 1)
+ * High-rate capture of a channel, started by the command
+ * sensor;capture;$channel[;$hz[;$ms]] (default: max rate of the sensor for
+ * 10 s). The chunks of the capture are published one every interval in ms,
+ * to limit the bandwidth taken from the telemetry.
  */
-void update_relay_status(int relayId, const int status)
+struct CaptureRequest
 {
-  // Allocate the JSON document
-  // Inside the brackets, 200 is the RAM allocated to this document.
-  // Don't forget to change this value to match your requirement.
-  // Use arduinojson.org/v6/assistant to compute the capacity.
-  StaticJsonDocument<200> relayStatus;
+  int channel;
+  uint32_t period;
+  uint32_t duration;
+};
 
-  relayStatus["clientId"] = clientId;
-  relayStatus["deviceName"] = device_name;
-  relayStatus["time"] = timeClient.getEpochTime();
-  relayStatus["relayId"] = relayId;
-  relayStatus["status"] = status;
+// Requests of the command task to the sampler, passed by value
+QueueHandle_t captureQueue;
 
-  char relayStatusAsJson[200];
-  serializeJson(relayStatus, relayStatusAsJson);
+const uint32_t capture_default_duration = 10000;
 
-  switch (relayId)
-  {
-  case Relay_00:
-    client.publish(topic_relay_00_status, relayStatusAsJson);
-    break;
-  case Relay_01:
-    client.publish(topic_relay_01_status, relayStatusAsJson);
-    break;
-  case Relay_02:
-    client.publish(topic_relay_02_status, relayStatusAsJson);
-    break;
-  case Relay_03:
-    client.publish(topic_relay_03_status, relayStatusAsJson);
-    break;
-  }
-}
+#ifdef CAPTURE_CHUNK_INTERVAL
+const uint32_t capture_chunk_interval = CAPTURE_CHUNK_INTERVAL;
+#else
+const uint32_t capture_chunk_interval = 100;
+#endif
+
+// Next chunk of the capture to publish and time (ms) of the last one
+uint16_t captureChunk = 0;
+unsigned long lastCaptureChunk = 0;
 
 /**
- * Setup lifecycle
+ * Calibration of a quantity of a channel, set by the command
+ * sensor;calibration;$channel;$quantity;$offset[;$gain[;$raw:$value,...]]
+ * (or ;reset) and persisted in NVS by the id of the sensor of the channel
+ * (key cal{id in hex}q{quantity}), so it stays with the sensor when the
+ * channels change at the next boot, with the version of the calibrations
+ * incremented at every update. It's applied by
+ * the sampler to the readings (see include/sensor_calibration.h).
  */
-void setup()
+struct CalibrationRequest
 {
-  Serial.begin(115200);
-
-  // Setup PIN Mode for On board led
-  pinMode(ONBOARD_LED, OUTPUT);
+  SensorCalibration calibration;
+  uint8_t channel;
+  bool reset;
+  uint32_t version;
+};
 
-  // Initialize with log level and log output.
-  Log.begin(LOG_LEVEL_VERBOSE, &Serial);
+// Requests to the sampler, and the calibrations it accepted, persisted by
+// the logger (the NVS writes are off the command task)
+QueueHandle_t calibrationQueue;
+QueueHandle_t calibrationPersistQueue;
 
-  // Log ESP Chip information
-  Log.notice(F("ESP32 Chip model %s Rev %d" CR), ESP.getChipModel(),
-             ESP.getChipRevision());
-  Log.notice(F("This chip has %d cores" CR), ESP.getChipCores());
+/**
+ * Latest record of every sensor, published by the sampler with a sequence
+ * lock: every reader (telemetry, status command) gets a consistent record
+ * without locks and without delaying the sampler.
+ */
+Seqlock<SensorRecord> latestSample[SENSOR_REGISTRY_MAX];
 
-  // Start I2C communication
-  if (!bme.begin(0x76))
-  {
-    Log.notice("Could not find a BME280 sensor, check wiring!");
-    while (1)
-      ;
-  }
+/**
+ * Interval in ms of the telemetry: every sensor is read faster, on its
+ * sampling period, and publishes the aggregates (count, min, max, mean and
+ * standard deviation) of the readings of every interval
+ */
+int counter = 0;
+long interval = 5000;
 
-  clientId += String(random(0xffff), HEX);
+// Sampling period in ms of the BME280
+#ifdef SENSOR_SAMPLE_PERIOD
+const uint32_t sensor_sample_period = SENSOR_SAMPLE_PERIOD;
+#else
+const uint32_t sensor_sample_period = 1000;
+#endif
 
-  // Connect to WiFi
-  setup_wifi();
+/**
+ * FreeRTOS tasks (core, priority and stack size)
+ * 1. MQTT pump: connection, incoming messages and publish of the outgoing
+ *    messages, on the core of the WiFi/TCP stack
+ * 2. Command executor: parsing and execution of the commands (relays), with
+ *    the highest priority to minimize the actuation latency
+ * 3. Sensor sampler: owner of the timer wheel, runs the periodic and the
+ *    delayed work (the reads of the sensors for the telemetry)
+ * 4. Logger: console output and report of the task metrics
+ */
+const BaseType_t network_core = 0;
+const BaseType_t control_core = 1;
 
-  // Setup PIN Mode for Relay
-  pinMode(Relay_00_Pin, OUTPUT);
-  pinMode(Relay_01_Pin, OUTPUT);
-  pinMode(Relay_02_Pin, OUTPUT);
-  pinMode(Relay_03_Pin, OUTPUT);
+const UBaseType_t mqtt_task_priority = 3;
+const UBaseType_t command_task_priority = 4;
+const UBaseType_t sampler_task_priority = 2;
+const UBaseType_t logger_task_priority = 1;
 
-  // Init Relay
-  digitalWrite(Relay_00_Pin, HIGH);
-  digitalWrite(Relay_01_Pin, HIGH);
-  digitalWrite(Relay_02_Pin, HIGH);
-  digitalWrite(Relay_03_Pin, HIGH);
+const uint32_t mqtt_task_stack = 8192;
+const uint32_t command_task_stack = 6144;
+const uint32_t sampler_task_stack = 6144;
+const uint32_t logger_task_stack = 6144;
 
-  // Init NTP
-  timeClient.begin();
-  timeClient.setTimeOffset(0);
-}
+TaskHandle_t mqttTask;
+TaskHandle_t commandTask;
+TaskHandle_t samplerTask;
+TaskHandle_t loggerTask;
 
 /**
- * Setup the WiFi Connection
+ * Max time in ms the MQTT pump sleeps without events (data on the socket or
+ * messages to publish), to keep alive the connection and run its probes
  */
-void setup_wifi()
-{
-  // We start by connecting to a WiFi network
-  Log.notice(F("Connecting to WiFi network: %s (password: %s)" CR),
-             ssid, password);
-
-  WiFi.begin(ssid, password);
-  WiFi.config(INADDR_NONE, INADDR_NONE, INADDR_NONE, INADDR_NONE);
-  WiFi.setHostname(clientId.c_str());
+const uint32_t mqtt_max_sleep = 5000;
 
-  while (WiFi.status() != WL_CONNECTED)
-  {
-    delay(500);
-    Serial.print(".");
-  }
+/**
+ * Automatic light sleep when every task is waiting for an event. It needs
+ * power management and tickless idle in the ESP-IDF configuration,
+ * otherwise only the CPU frequency scaling is enabled.
+ */
+#ifdef POWER_SAVE_LIGHT_SLEEP
+const bool light_sleep_enabled = POWER_SAVE_LIGHT_SLEEP;
+#else
+const bool light_sleep_enabled = true;
+#endif
 
-  Serial.println("");
+// Interval in ms of the report of the task metrics
+const uint32_t task_metrics_interval = 60000;
 
-  Serial.println("WiFi connected :-)");
-  Serial.print("IP Address: ");
-  Serial.print(WiFi.localIP());
-  Serial.println("");
-  Serial.print("Mac Address: ");
-  Serial.print(WiFi.macAddress());
-  Serial.println("");
-  Serial.print("Hostname: ");
-  Serial.print(WiFi.getHostname());
-  Serial.println("");
-  Serial.print("Gateway: ");
-  Serial.print(WiFi.gatewayIP());
-  Serial.println("");
+/**
+ * Echo of the telemetry on the console: compact JSON, at most one message
+ * every interval in ms (0 to disable). The logger writes only what fits in
+ * the TX FIFO of the UART and retries the rest every few ms, so a serial
+ * monitor doesn't change the timing of the tasks.
+ */
+#ifdef CONSOLE_TELEMETRY_INTERVAL
+const uint32_t console_telemetry_interval = CONSOLE_TELEMETRY_INTERVAL;
+#else
+const uint32_t console_telemetry_interval = 60000;
+#endif
 
-  bool success = Ping.ping(mqtt_server, 3);
+const uint32_t console_retry_interval = 10;
 
-  if (!success)
-  {
-    Log.error(F("Ping failed to %s" CR), mqtt_server);
-    return;
-  }
+unsigned long lastConsoleTelemetry = 0;
 
-  Log.notice(F("Ping OK to %s" CR), mqtt_server);
+// Dump of the trace on the console, requested to the logger
+volatile bool traceDumpRequested = false;
 
-  // When setup wifi ok turn on led board
-  digitalWrite(ONBOARD_LED, HIGH);
-}
+/**
+ * Rings and queues between the tasks
+ * 1. Samples from the sampler to the MQTT pump (lock-free ring, the oldest
+ *    sample is overwritten when the MQTT pump is behind)
+ * 2. Commands received by the MQTT pump for the command executor (lock-free
+ *    ring, the newest command is dropped when the executor is behind)
+ * 3. Messages to publish by the MQTT pump
+ * 4. Lines to write on the console by the logger
+ */
+#define COMMAND_MAX_LENGTH 128
+#define PUBLISH_PAYLOAD_MAX_LENGTH 768
 
 /**
- * Reconnect to MQTT Broker
+ * Max length of a telemetry message (published by the MQTT pump, not
+ * queued): up to 4 aggregates, the altitude and the relays take about 850
+ * bytes. The console lines echo it.
  */
-void reconnect()
+#define TELEMETRY_PAYLOAD_MAX_LENGTH 1024
+#define CONSOLE_LINE_MAX_LENGTH (TELEMETRY_PAYLOAD_MAX_LENGTH + 2)
+
+struct Command
 {
-  // Loop until we're reconnected
-  while (!client.connected())
-  {
-    Log.notice(F("Attempting MQTT connection to %s" CR), mqtt_server);
+  int64_t receivedAt;
+  char text[COMMAND_MAX_LENGTH];
+};
 
-    // Attempt to connect
-    if (client.connect(clientId.c_str(), mqtt_username, mqtt_password))
-    {
-      Log.notice(F("Connected as clientId %s :-)" CR), clientId.c_str());
+enum PublishKind
+{
+  Publish_Relay_Status,
+  Publish_Task_Metrics,
+  Publish_Sensor_Status,
+  Publish_Sensor_Metrics,
+  Publish_Trace_Dump
+};
 
-      // Subscribe
-      client.subscribe(topic_command, 1);
-      Log.notice(F("Subscribe to the topic command %s " CR), topic_command);
+struct PublishRequest
+{
+  PublishKind kind;
+  int relayId;
+  int status;
+  uint32_t seq;
+  bool query;
+  int64_t queuedAt;
+  char payload[PUBLISH_PAYLOAD_MAX_LENGTH];
+};
 
-      // Init Status topic for Relay
-      update_relay_status(Relay_00, relay_status_off);
-      update_relay_status(Relay_01, relay_status_off);
-      update_relay_status(Relay_02, relay_status_off);
-      update_relay_status(Relay_03, relay_status_off);
+struct ConsoleLine
+{
+  int64_t queuedAt;
+  char text[CONSOLE_LINE_MAX_LENGTH];
+};
 
-      // Turn on led board
-      digitalWrite(ONBOARD_LED, HIGH);
-    }
-    else
-    {
-      Log.error(F("{failed, rc=%d try again in 5 seconds}" CR), client.state());
-      // Turn off led board and wait 5 seconds before retrying
-      digitalWrite(ONBOARD_LED, LOW);
-      delay(5000);
-    }
-  }
-}
+SpscRing<SensorRecord, 8, Spsc_Overwrite_Oldest> sampleRing;
+SpscRing<Command, 8, Spsc_Drop_Newest> commandRing;
+QueueHandle_t publishQueue;
+QueueHandle_t consoleQueue;
+
+// Declare the custom functions
+void callback(char *topic, byte *message, unsigned int length);
+void setup_wifi();
+void update_relay_status(int relayId, const int status, bool query = false);
+void publish_relay_status(int relayId, const int status, uint32_t seq);
+void publish_trace();
+void write_relay(int relayId, const int status);
+void execute_sensor_command(const String &statement);
+void on_sensor_profile(void *arg, uint32_t scheduledMs);
+void on_sensor_qnh(void *arg, uint32_t scheduledMs);
+void on_sensor_capture(void *arg, uint32_t scheduledMs);
+void on_sensor_calibration(void *arg, uint32_t scheduledMs);
+void load_sensor_calibrations(int channel);
+void persist_sensor_calibrations();
+void publish_capture_chunk();
+void execute_trace_command(const String &statement);
+bool queue_publish(PublishRequest &request);
+void setup_power_management();
+void setup_sensors(const Bme280Profile &profile);
+int scan_sensors(const Bme280Profile &profile);
+void on_sensor_scan(void *arg, uint32_t scheduledMs);
+void setup_tasks();
+
+// Init WiFi and MQTT Client
+WiFiClient espClient;
+PubSubClient client(mqtt_server, mqtt_port, callback, espClient);
 
 /**
- * Loop lifecycle
+ * MQTT Callback (MQTT pump task)
+ *
+ * The commands received on the topic esp32/command are queued for the
+ * command executor, so the MQTT pump is never delayed by their execution.
  */
-void loop()
+void callback(char *topic, byte *message, unsigned int length)
 {
-  while (!timeClient.update())
+  // Echo of the round trip time probe (payload: millis of the publish)
+  if (topic_rtt == topic)
   {
-    timeClient.forceUpdate();
+    char sentAt[12] = {0};
+    memcpy(sentAt, message, min(length, (unsigned int)(sizeof(sentAt) - 1)));
+    broker_on_rtt(millis() - strtoul(sentAt, NULL, 10));
+    return;
   }
 
-  long now = millis();
-  
-  if (!client.connected())
+  if (strcmp(topic, topic_command) != 0)
   {
-    reconnect();
+    return;
   }
-  
-  client.loop();
 
-  if (now - lastMessage > interval)
+  TRACE(Trace_Command_Received, length, 0);
+
+  if (length >= COMMAND_MAX_LENGTH)
   {
-    lastMessage = now;
+    LOG_WARNING(F("Command discarded, too long (%d bytes)" CR), length);
+    return;
+  }
 
-    // Allocate the JSON document
-    // Inside the brackets, 200 is the RAM allocated to this document.
-    // Don't forget to change this value to match your requirement.
-    // Use arduinojson.org/v6/assistant to compute the capacity.
-    StaticJsonDocument<256> telemetry;
+  Command command;
 
-    /**
-     * Reading humidity, temperature and pressure
-     * Temperature is always a floating point, in Centigrade. Pressure is a 
-     * 32 bit integer with the pressure in Pascals. You may need to convert 
-     * to a different value to match it with your weather report. Humidity is 
-     * in % Relative Humidity
-     */
-    temperature = bme.readTemperature();
-    humidity = bme.readHumidity();
-    pressure = bme.readPressure();
+  command.receivedAt = esp_timer_get_time();
+  memcpy(command.text, message, length);
+  command.text[length] = '\0';
 
-    /**
-     * It's also possible to turn the BME280 into an altimeter. If you know 
-     * the pressure at sea level, the library can calculate the current 
-     * barometric pressure into altitude. 
-     * 
-     * The value 1013250 hPa is the Sea level standard atmospheric pressure.
-     * The altitude value returned is to be considered approximate.
-     */
-    altitude = bme.readAltitude(1013.25);
+  if (!commandRing.push(command))
+  {
+    LOG_WARNING(F("Command discarded, the command ring is full" CR));
+    return;
+  }
 
-    telemetry["clientId"] = clientId.c_str();
-    telemetry["deviceName"] = device_name;
-    telemetry["time"] = timeClient.getEpochTime();
-    telemetry["temperature"] = temperature;
-    telemetry["humidity"] = humidity;
-    telemetry["pressure"] = pressure;
-    telemetry["altitude"] = altitude;
-    telemetry["interval"] = interval;
-    telemetry["counter"] = ++counter;
+  TRACE(Trace_Command_Queued, length, 0);
 
-    JsonArray relaysStatusJsonArray = telemetry.createNestedArray("relaysStatus");
+  xTaskNotifyGive(commandTask);
+}
 
-    int * relaysStatus = get_relays_status();
+/**
+  * Execute a command (command executor task)
+  * 
+  * If a message is received on the topic esp32/command (es. Relay off or on).
+  * Format: {$device-name}:{relay;$relayId;$command}
+  * Es: 
+  *  esp32-zone-1:relay;3;off (switch off relay 3 of the specified device)
+  *  esp32-zone-1:relay;2;on (switch on relay 2 of the specified device)
+  *  esp32-zone-1:relay;3;status (get status of the relay 3 of the specified device) 
+  */
+void execute_command(const char *text)
+{
+  String messageTemp = text;
+
+  LOG_NOTICE(F("Message arrived on topic: %s" CR), topic_command);
+  LOG_NOTICE(F("Message Content: %s" CR), text);
+
+  /**
+   * Parsing of the received command string. This piece of code 
+   * could be written using regular expressions.
+   * ([a-zA-Z,0-9,\-]{3,12}):(\w+);([0-3]);(off|on|status) this could be the 
+   * regular expression which should be sufficient to satisfy the given format.
+   */
+  int indexOfDeviceSeparator = messageTemp.indexOf(":");
+  
+  String deviceName = messageTemp.substring(0, indexOfDeviceSeparator);
+  String statement = messageTemp.substring(indexOfDeviceSeparator + 1,
+                                           messageTemp.length());
+
+  int indexOfStatementSeparator = statement.indexOf(";");
+  int relayId = statement.substring(indexOfStatementSeparator + 1,
+                                    indexOfStatementSeparator + 2)
+                    .toInt();
+  String command = statement.substring(statement.lastIndexOf(";") + 1,
+                                       statement.length());
+
+  if (!deviceName.isEmpty() && !statement.isEmpty() && !command.isEmpty() &&
+      (String)device_name == deviceName)
+  {
+    // Commands for the sensor: {$device-name}:sensor;$command[;$args]
+    if (statement.substring(0, indexOfStatementSeparator) == SENSOR_COMMAND_TARGET)
+    {
+      execute_sensor_command(statement);
+      return;
+    }
+
+    // Commands for the trace: {$device-name}:trace;$command[;$args]
+    if (statement.substring(0, indexOfStatementSeparator) == TRACE_COMMAND_TARGET)
+    {
+      execute_trace_command(statement);
+      return;
+    }
+
+    TRACE(Trace_Command_Parsed, relayId, 0);
+
+    LOG_NOTICE(F("Try to execute this statement (command %s): %s for relay %d on the device name: %s" CR),
+               command.c_str(), statement.c_str(), relayId, deviceName.c_str());
+
+    /**
+     * The following code block is responsible for executing the instructions 
+     * received from the command topic. This block of code is purely 
+     * educational and can be optimizing to avoid redundant code.
+     */
+    switch (relayId)
+    {
+    case Relay_00:
+      if (command == RELAY_COMMAND_ON)
+      {
+        write_relay(Relay_00, relay_status_on);
+        update_relay_status(Relay_00, relay_status_on);
+
+        LOG_NOTICE(F("Switch On relay 0" CR));
+      }
+      else if (command == RELAY_COMMAND_OFF)
+      {
+        write_relay(Relay_00, relay_status_off);
+        update_relay_status(Relay_00, relay_status_off);
+
+        LOG_NOTICE(F("Switch Off relay 0" CR));
+      }
+      else if (command == RELAY_COMMAND_STATUS)
+      {
+        digitalRead(Relay_00_Pin) == LOW ? update_relay_status(Relay_00, relay_status_on, true) : update_relay_status(Relay_00, relay_status_off, true);
+      }
+      break;
+    case Relay_01:
+      if (command == RELAY_COMMAND_ON)
+      {
+        write_relay(Relay_01, relay_status_on);
+        update_relay_status(Relay_01, relay_status_on);
+
+        LOG_NOTICE(F("Switch On relay 1" CR));
+      }
+      else if (command == RELAY_COMMAND_OFF)
+      {
+        write_relay(Relay_01, relay_status_off);
+        update_relay_status(Relay_01, relay_status_off);
+
+        LOG_NOTICE(F("Switch Off relay 1" CR));
+      }
+      else if (command == RELAY_COMMAND_STATUS)
+      {
+        digitalRead(Relay_01_Pin) == LOW ? update_relay_status(Relay_01, relay_status_on, true) : update_relay_status(Relay_01, relay_status_off, true);
+      }
+      break;
+    case Relay_02:
+      if (command == RELAY_COMMAND_ON)
+      {
+        write_relay(Relay_02, relay_status_on);
+        update_relay_status(Relay_02, relay_status_on);
+
+        LOG_NOTICE(F("Switch On relay 2" CR));
+      }
+      else if (command == RELAY_COMMAND_OFF)
+      {
+        write_relay(Relay_02, relay_status_off);
+        update_relay_status(Relay_02, relay_status_off);
+
+        LOG_NOTICE(F("Switch Off relay 2" CR));
+      }
+      else if (command == RELAY_COMMAND_STATUS)
+      {
+        digitalRead(Relay_02_Pin) == LOW ? update_relay_status(Relay_02, relay_status_on, true) : update_relay_status(Relay_02, relay_status_off, true);
+      }
+      break;
+    case Relay_03:
+      if (command == RELAY_COMMAND_ON)
+      {
+        write_relay(Relay_03, relay_status_on);
+        update_relay_status(Relay_03, relay_status_on);
+
+        LOG_NOTICE(F("Switch On relay 3" CR));
+      }
+      else if (command == RELAY_COMMAND_OFF)
+      {
+        write_relay(Relay_03, relay_status_off);
+        update_relay_status(Relay_03, relay_status_off);
+
+        LOG_NOTICE(F("Switch Off relay 3" CR));
+      }
+      else if (command == RELAY_COMMAND_STATUS)
+      {
+        digitalRead(Relay_03_Pin) == LOW ? update_relay_status(Relay_03, relay_status_on, true) : update_relay_status(Relay_03, relay_status_off, true);
+      }
+      break;
+    default:
+      LOG_WARNING(F("No relayId recognized" CR));
+      break;
+    }
+  }
+}
+
+/**
+ * Return a field of a statement (fields separated by ;)
+ *
+ * statement: Statement of the command (es. sensor;status)
+ * index: Index of the field (0 is the target of the command)
+ */
+String statement_field(const String &statement, int index)
+{
+  int begin = 0;
+
+  for (int i = 0; i < index; i++)
+  {
+    begin = statement.indexOf(';', begin);
+
+    if (begin < 0)
+    {
+      return String();
+    }
+
+    begin++;
+  }
+
+  int end = statement.indexOf(';', begin);
+
+  return statement.substring(begin, end < 0 ? statement.length() : end);
+}
+
+/**
+ * Parse a number of a statement (String.toFloat() returns 0 on any text)
+ *
+ * return: false if the text isn't a finite number
+ */
+bool parse_float(const String &text, float &value)
+{
+  StaticJsonDocument<16> number;
+
+  if (deserializeJson(number, text) != DeserializationError::Ok || !number.is<float>())
+  {
+    return false;
+  }
+
+  value = number.as<float>();
+
+  return isfinite(value);
+}
+
+/**
+ * Execute a command for the sensor (command executor task)
+ *
+ * Es:
+ *  esp32-zone-1:sensor;status (publish the latest record of the channel 0)
+ *  esp32-zone-1:sensor;status;1 (publish the latest record of the channel 1)
+ *  esp32-zone-1:sensor;profile;weather (set the acquisition profile)
+ *  esp32-zone-1:sensor;qnh;1018.6 (set the pressure at sea level in hPa)
+ *  esp32-zone-1:sensor;capture;0;50;5000 (capture the channel 0 at 50 Hz
+ *   for 5 s and publish it on esp32/{clientId}/capture)
+ *  esp32-zone-1:sensor;calibration;0;temperature;-1.8 (offset of the
+ *   temperature of the channel 0)
+ *  esp32-zone-1:sensor;calibration;0;humidity;0;1.02;20:21.5,80:79 (offset,
+ *   gain and linearisation table of the humidity of the channel 0)
+ *  esp32-zone-1:sensor;calibration;0;humidity;reset (remove the calibration)
+ */
+void execute_sensor_command(const String &statement)
+{
+  String command = statement_field(statement, 1);
+
+  LOG_NOTICE(F("Try to execute the sensor command %s" CR), command.c_str());
+
+  if (command == SENSOR_COMMAND_STATUS)
+  {
+    SensorRecord record;
+    int channel = statement_field(statement, 2).toInt();
+
+    if (channel < 0 || channel >= sensor_count())
+    {
+      LOG_WARNING(F("No sensor channel %d" CR), channel);
+      return;
+    }
+
+    if (latestSample[channel].read(record) == 0)
+    {
+      LOG_WARNING(F("No sample of the sensor yet" CR));
+      return;
+    }
+
+    StaticJsonDocument<1024> sensorStatus;
+    PublishRequest request;
+
+    sensorStatus["clientId"] = clientId.c_str();
+    sensorStatus["deviceName"] = device_name;
+    timestamp_stamp(sensorStatus);
+    sensorStatus["sequence"] = record.sequence;
+    sensorStatus["sampledAt"] = timestamp_from_monotonic_ms(record.sampledAt);
+    sensor_encode(record, sensorStatus);
+
+    JsonObject units = sensorStatus.createNestedObject("units");
+
+    for (uint8_t i = 0; i < record.count; i++)
+    {
+      units[sensor_quantity_name(record.aggregates[i].quantity)] =
+          sensor_quantity_unit(record.aggregates[i].quantity);
+    }
+
+    request.kind = Publish_Sensor_Status;
+    serializeJson(sensorStatus, request.payload, sizeof(request.payload));
+    queue_publish(request);
+  }
+  else if (command == SENSOR_COMMAND_PROFILE)
+  {
+    String name = statement_field(statement, 2);
+    const Bme280Profile *profile = bme280_profile(name.c_str());
+
+    if (profile == NULL)
+    {
+      LOG_WARNING(F("No sensor profile %s" CR), name.c_str());
+      return;
+    }
+
+    // The sensor is owned by the sampler: the profile is applied by a timer
+    if (timer_start(0, 0, on_sensor_profile, (void *)profile) == TIMER_INVALID)
+    {
+      LOG_WARNING(F("Sensor profile %s refused, no timer" CR), profile->name);
+    }
+  }
+  else if (command == SENSOR_COMMAND_QNH)
+  {
+    String text = statement_field(statement, 2);
+    float qnh = 0.0F;
+
+    if (!parse_float(text, qnh) || qnh < sensor_qnh_min || qnh > sensor_qnh_max)
+    {
+      LOG_WARNING(F("QNH %s hPa not a number or out of range" CR), text.c_str());
+      return;
+    }
+
+    float previous = sensorQnh;
+
+    sensorQnh = qnh;
+
+    // The sensor is owned by the sampler: the QNH is applied by a timer
+    if (timer_start(0, 0, on_sensor_qnh, NULL) == TIMER_INVALID)
+    {
+      sensorQnh = previous;
+      LOG_WARNING(F("QNH refused, no timer" CR));
+      return;
+    }
+
+    sensorPreferences.putFloat("qnh", qnh);
+  }
+  else if (command == SENSOR_COMMAND_CAPTURE)
+  {
+    int channel = statement_field(statement, 2).toInt();
+    long rate = statement_field(statement, 3).toInt();
+    long duration = statement_field(statement, 4).toInt();
+
+    if (channel < 0 || channel >= sensor_count())
+    {
+      LOG_WARNING(F("No sensor channel %d" CR), channel);
+      return;
+    }
+
+    if (sensor_capture_state() != Capture_Idle)
+    {
+      LOG_WARNING(F("Sensor capture refused, another one is in progress" CR));
+      return;
+    }
+
+    CaptureRequest request;
+
+    request.channel = channel;
+    request.period = rate > 0 ? 1000 / rate : 0;
+    request.duration = duration > 0 ? duration : capture_default_duration;
+
+    if (xQueueSend(captureQueue, &request, 0) != pdTRUE)
+    {
+      LOG_WARNING(F("Sensor capture refused, another one is starting" CR));
+      return;
+    }
+
+    // The registry is owned by the sampler: the capture is started by a timer
+    if (timer_start(0, 0, on_sensor_capture, NULL) == TIMER_INVALID)
+    {
+      xQueueReceive(captureQueue, &request, 0);
+      LOG_WARNING(F("Sensor capture refused, no timer" CR));
+    }
+  }
+  else if (command == SENSOR_COMMAND_CALIBRATION)
+  {
+    int channel = statement_field(statement, 2).toInt();
+    String quantityName = statement_field(statement, 3);
+    String offset = statement_field(statement, 4);
+    uint8_t quantity = 0;
+
+    while (quantity < Quantity_Count && quantityName != sensor_quantity_name(quantity))
+    {
+      quantity++;
+    }
+
+    if (channel < 0 || channel >= sensor_count() || quantity == Quantity_Count)
+    {
+      LOG_WARNING(F("No sensor channel %d or quantity %s" CR), channel, quantityName.c_str());
+      return;
+    }
+
+    CalibrationRequest request;
+    SensorCalibration &calibration = request.calibration;
+
+    request.channel = channel;
+    request.reset = offset == SENSOR_CALIBRATION_RESET;
+    calibration = sensor_calibration_identity(sensor_id(channel), quantity);
+
+    if (!request.reset)
+    {
+      String gain = statement_field(statement, 5);
+      String table = statement_field(statement, 6);
+
+      if (!parse_float(offset, calibration.offset) ||
+          (gain.length() > 0 && !parse_float(gain, calibration.gain)))
+      {
+        LOG_WARNING(F("Calibration refused: offset %s or gain %s not a number" CR),
+                    offset.c_str(), gain.c_str());
+        return;
+      }
+
+      // Points of the table: raw:value separated by commas
+      for (int begin = 0; begin < (int)table.length();)
+      {
+        int end = table.indexOf(',', begin);
+        String point = table.substring(begin, end < 0 ? table.length() : end);
+        int separator = point.indexOf(':');
+
+        if (calibration.points == SENSOR_CALIBRATION_POINTS)
+        {
+          LOG_WARNING(F("Calibration refused: more than %d points" CR),
+                      SENSOR_CALIBRATION_POINTS);
+          return;
+        }
+
+        if (separator < 0 ||
+            !parse_float(point.substring(0, separator), calibration.raw[calibration.points]) ||
+            !parse_float(point.substring(separator + 1),
+                         calibration.corrected[calibration.points]))
+        {
+          LOG_WARNING(F("Calibration point %s not raw:value" CR), point.c_str());
+          return;
+        }
+
+        calibration.points++;
+
+        begin = end < 0 ? table.length() : end + 1;
+      }
+
+      if (calibration.gain == 0.0F || calibration.points == 1)
+      {
+        LOG_WARNING(F("Calibration refused: gain 0 or a table of one point" CR));
+        return;
+      }
+    }
+
+    if (xQueueSend(calibrationQueue, &request, 0) != pdTRUE)
+    {
+      LOG_WARNING(F("Calibration refused, another one is pending" CR));
+      return;
+    }
+
+    // The calibrations are applied by the sampler: the update is done by a
+    // timer, the sampler hands it to the logger to persist once accepted
+    if (timer_start(0, 0, on_sensor_calibration, NULL) == TIMER_INVALID)
+    {
+      xQueueReceive(calibrationQueue, &request, 0);
+      LOG_WARNING(F("Calibration refused, no timer" CR));
+    }
+  }
+  else
+  {
+    LOG_WARNING(F("No sensor command recognized" CR));
+  }
+}
+
+/**
+ * Execute a command for the trace (command executor task)
+ *
+ * Es:
+ *  esp32-zone-1:trace;start (clear the trace and start it)
+ *  esp32-zone-1:trace;stop (stop the trace)
+ *  esp32-zone-1:trace;dump (stop the trace and publish it on esp32/{clientId}/trace)
+ *  esp32-zone-1:trace;dump;serial (stop the trace and write it on the console)
+ */
+void execute_trace_command(const String &statement)
+{
+  String command = statement_field(statement, 1);
+
+  LOG_NOTICE(F("Try to execute the trace command %s" CR), command.c_str());
+
+  if (command == TRACE_COMMAND_START)
+  {
+    trace_start();
+  }
+  else if (command == TRACE_COMMAND_STOP)
+  {
+    trace_stop();
+  }
+  else if (command == TRACE_COMMAND_DUMP)
+  {
+    trace_stop();
+
+    // The dump is long: it's written by the logger or by the MQTT pump
+    if (statement_field(statement, 2) == TRACE_DUMP_SERIAL)
+    {
+      traceDumpRequested = true;
+      xTaskNotifyGive(loggerTask);
+    }
+    else
+    {
+      PublishRequest request;
+
+      request.kind = Publish_Trace_Dump;
+      queue_publish(request);
+    }
+  }
+  else
+  {
+    LOG_WARNING(F("No trace command recognized" CR));
+  }
+}
+
+/**
+ * Return the relays status
+ *
+ * relaysStatus: Array of four elements filled with the status of the relays
+ */
+void get_relays_status(int *relaysStatus)
+{
+  digitalRead(Relay_00_Pin) == LOW ? relaysStatus[0] = HIGH : relaysStatus[0] = LOW;
+  digitalRead(Relay_01_Pin) == LOW ? relaysStatus[1] = HIGH : relaysStatus[1] = LOW;
+  digitalRead(Relay_02_Pin) == LOW ? relaysStatus[2] = HIGH : relaysStatus[2] = LOW;
+  digitalRead(Relay_03_Pin) == LOW ? relaysStatus[3] = HIGH : relaysStatus[3] = LOW;
+}
+
+/**
+ * Switch the relay and record the change in the state sequence number (a
+ * write of the current status isn't a change and keeps its number)
+ *
+ * relayId: Identifiier of the relay
+ * status: Status of the relay. (o or 1)
+ */
+void write_relay(int relayId, const int status)
+{
+  int level = status == relay_status_on ? LOW : HIGH;
+  bool changed = digitalRead(relay_pins[relayId]) != level;
+
+  digitalWrite(relay_pins[relayId], level);
+
+  TRACE(Trace_Gpio_Written, relayId, status);
+
+  if (!changed)
+  {
+    return;
+  }
+
+  relay_changed_seq[relayId] = ++relay_state_seq;
+
+  if (relay_state_seq > relay_seq_reserved)
+  {
+    relay_seq_reserved += RELAY_SEQ_BLOCK;
+    relayPreferences.putUInt("seq", relay_seq_reserved);
+  }
+}
+
+/**
+ * Publish the status of the relays changed since the last acknowledged
+ * publish or whose retained status is stale
+ */
+void publish_changed_relays_status()
+{
+  int relaysStatus[4];
+  unsigned long now = millis();
+
+  get_relays_status(relaysStatus);
+
+  for (int relayId = Relay_00; relayId <= Relay_03; relayId++)
+  {
+    if (!relay_published[relayId] ||
+        relay_published_seq[relayId] != relay_changed_seq[relayId] ||
+        now - relay_published_at[relayId] > relay_status_max_age)
+    {
+      publish_relay_status(relayId, relaysStatus[relayId], relay_changed_seq[relayId]);
+    }
+  }
+}
+
+/**
+ * Queue a message to publish for the MQTT pump
+ *
+ * return: false if the publish queue is full (the message is discarded)
+ */
+bool queue_publish(PublishRequest &request)
+{
+  request.queuedAt = esp_timer_get_time();
+
+  if (xQueueSend(publishQueue, &request, 0) != pdTRUE)
+  {
+    return false;
+  }
+
+  mqtt_events_wake();
+
+  return true;
+}
+
+/**
+ * Update Relay status on the topic (the publish is done by the MQTT pump).
+ * The request takes the sequence number of the status now: a status
+ * already published when the pump gets to it is skipped, unless it answers
+ * a status query.
+ * 
+ * relayId: Identifiier of the relay
+ * status: Status of the relay. (o or 1)
+ * query: true for the answer to a status command
+ */
+void update_relay_status(int relayId, const int status, bool query)
+{
+  PublishRequest request;
+
+  request.kind = Publish_Relay_Status;
+  request.relayId = relayId;
+  request.status = status;
+  request.seq = relay_changed_seq[relayId];
+  request.query = query;
+
+  TRACE(Trace_Relay_Status_Queued, relayId, status);
+
+  if (!queue_publish(request))
+  {
+    LOG_WARNING(F("Status of relay %d not published, the publish queue is full" CR),
+                relayId);
+  }
+}
+
+/**
+ * Publish the Relay status on the topic (retained)
+ * 
+ * relayId: Identifiier of the relay
+ * status: Status of the relay. (o or 1)
+ * seq: Sequence number of the change of the status
+ */
+void publish_relay_status(int relayId, const int status, uint32_t seq)
+{
+  // Allocate the JSON document
+  // Inside the brackets, 256 is the RAM allocated to this document.
+  // Don't forget to change this value to match your requirement.
+  // Use arduinojson.org/v6/assistant to compute the capacity.
+  StaticJsonDocument<256> relayStatus;
+
+  relayStatus["clientId"] = clientId;
+  relayStatus["deviceName"] = device_name;
+  timestamp_stamp(relayStatus);
+  relayStatus["relayId"] = relayId;
+  relayStatus["status"] = status;
+  relayStatus["seq"] = seq;
+
+  char relayStatusAsJson[256];
+  size_t length = serializeJson(relayStatus, relayStatusAsJson);
+
+  TRACE(Trace_Publish_Serialized, relayId, length);
+
+  bool published = false;
+
+  switch (relayId)
+  {
+  case Relay_00:
+    published = client.publish(topic_relay_00_status, relayStatusAsJson, true);
+    break;
+  case Relay_01:
+    published = client.publish(topic_relay_01_status, relayStatusAsJson, true);
+    break;
+  case Relay_02:
+    published = client.publish(topic_relay_02_status, relayStatusAsJson, true);
+    break;
+  case Relay_03:
+    published = client.publish(topic_relay_03_status, relayStatusAsJson, true);
+    break;
+  }
+
+  broker_on_publish(published);
+
+  if (published)
+  {
+    relay_published_seq[relayId] = seq;
+    relay_published_at[relayId] = millis();
+    relay_published[relayId] = true;
+  }
+}
+
+/**
+ * Setup lifecycle
+ */
+void setup()
+{
+  Serial.begin(115200);
+
+  // Setup PIN Mode for On board led
+  pinMode(ONBOARD_LED, OUTPUT);
+
+  // Initialize with log level and log output.
+  Logger.begin(LOG_COMPILE_LEVEL, &Serial);
+
+  // Log ESP Chip information
+  LOG_NOTICE(F("ESP32 Chip model %s Rev %d" CR), ESP.getChipModel(),
+             ESP.getChipRevision());
+  LOG_NOTICE(F("This chip has %d cores" CR), ESP.getChipCores());
+
+  // Start I2C communication
+  sensorPreferences.begin("sensor");
+  sensorQnh = sensorPreferences.getFloat("qnh", BME280_SEA_LEVEL_HPA);
+
+  sensorProfile = bme280_profile(sensor_profile_name);
+
+  if (sensorProfile == NULL)
+  {
+    LOG_WARNING(F("No sensor profile %s, using %s" CR), sensor_profile_name,
+                BME280_PROFILE_DEFAULT);
+    sensorProfile = bme280_profile(BME280_PROFILE_DEFAULT);
+  }
+
+  sensor_calibration_set_version(sensorPreferences.getUInt("calVersion", 0));
+
+  setup_sensors(*sensorProfile);
+
+  // No halt: the buses are scanned again in background by the sampler
+  if (bme280SensorCount == 0)
+  {
+    LOG_WARNING(F("Could not find a BME280 sensor, check wiring! Retrying in background" CR));
+  }
+
+  /**
+   * The Client Identification is derived from the factory MAC stored in
+   * eFuse, so the device resumes the same MQTT session after every reboot.
+   */
+  uint64_t efuseMac = ESP.getEfuseMac();
+  char macAsHex[13];
+
+  snprintf(macAsHex, sizeof(macAsHex), "%02x%02x%02x%02x%02x%02x",
+           (uint8_t)(efuseMac), (uint8_t)(efuseMac >> 8),
+           (uint8_t)(efuseMac >> 16), (uint8_t)(efuseMac >> 24),
+           (uint8_t)(efuseMac >> 32), (uint8_t)(efuseMac >> 40));
+
+  clientId += macAsHex;
+  topic_rtt = "esp32/" + clientId + "/rtt";
+  topic_trace = "esp32/" + clientId + "/trace";
+  topic_capture = "esp32/" + clientId + "/capture";
+
+  // The primary MQTT Broker and the fallbacks
+  broker_add(mqtt_server, mqtt_port);
+#ifdef MQTT_SERVER_1
+  broker_add(mqtt_server_1, mqtt_port_1);
+#endif
+#ifdef MQTT_SERVER_2
+  broker_add(mqtt_server_2, mqtt_port_2);
+#endif
+#ifdef MQTT_SERVER_3
+  broker_add(mqtt_server_3, mqtt_port_3);
+#endif
+
+  // Connect to WiFi
+  setup_wifi();
+
+  // The default MQTT packet size (256 bytes) is too small for the telemetry
+  client.setBufferSize(TELEMETRY_PAYLOAD_MAX_LENGTH + 128);
+
+  // Setup PIN Mode for Relay
+  pinMode(Relay_00_Pin, OUTPUT);
+  pinMode(Relay_01_Pin, OUTPUT);
+  pinMode(Relay_02_Pin, OUTPUT);
+  pinMode(Relay_03_Pin, OUTPUT);
+
+  // Init Relay
+  digitalWrite(Relay_00_Pin, HIGH);
+  digitalWrite(Relay_01_Pin, HIGH);
+  digitalWrite(Relay_02_Pin, HIGH);
+  digitalWrite(Relay_03_Pin, HIGH);
+
+  // The init of the relays is a change of all of them (one sequence number,
+  // the first after the block reserved by the previous boot)
+  relayPreferences.begin("relay");
+  relay_state_seq = relayPreferences.getUInt("seq", 0) + 1;
+  relay_seq_reserved = relay_state_seq + RELAY_SEQ_BLOCK - 1;
+  relayPreferences.putUInt("seq", relay_seq_reserved);
+
+  for (int relayId = Relay_00; relayId <= Relay_03; relayId++)
+  {
+    relay_changed_seq[relayId] = relay_state_seq;
+  }
+
+  // Init NTP (the sync runs in background and anchors the timestamp service)
+  timestamp_begin(ntpServer);
+
+  if (!timestamp_wait_sync(ntp_sync_timeout))
+  {
+    LOG_WARNING(F("NTP sync not completed, timestamps will be 0 until the first sync" CR));
+  }
+
+  // Start the MQTT pump, the command executor, the sampler and the logger
+  setup_power_management();
+  setup_tasks();
+}
+
+/**
+ * Setup the WiFi Connection
+ */
+void setup_wifi()
+{
+  // We start by connecting to a WiFi network
+  LOG_NOTICE(F("Connecting to WiFi network: %s (password: %s)" CR),
+             ssid, password);
+
+  WiFi.begin(ssid, password);
+  WiFi.config(INADDR_NONE, INADDR_NONE, INADDR_NONE, INADDR_NONE);
+  WiFi.setHostname(clientId.c_str());
+
+  while (WiFi.status() != WL_CONNECTED)
+  {
+    delay(500);
+    Serial.print(".");
+  }
+
+  Serial.println("");
+
+  Serial.println("WiFi connected :-)");
+  Serial.print("IP Address: ");
+  Serial.print(WiFi.localIP());
+  Serial.println("");
+  Serial.print("Mac Address: ");
+  Serial.print(WiFi.macAddress());
+  Serial.println("");
+  Serial.print("Hostname: ");
+  Serial.print(WiFi.getHostname());
+  Serial.println("");
+  Serial.print("Gateway: ");
+  Serial.print(WiFi.gatewayIP());
+  Serial.println("");
+
+  IPAddress mqttServerAddress;
+  bool success = dns_cache_resolve(mqtt_server, mqttServerAddress) &&
+                 Ping.ping(mqttServerAddress, 3);
+
+  if (!success)
+  {
+    LOG_ERROR(F("Ping failed to %s" CR), mqtt_server);
+    return;
+  }
+
+  LOG_NOTICE(F("Ping OK to %s" CR), mqtt_server);
+
+  // When setup wifi ok turn on led board
+  digitalWrite(ONBOARD_LED, HIGH);
+}
+
+/**
+ * Reconnect to MQTT Broker
+ *
+ * Every attempt goes to the broker with the best health score. After a
+ * failed attempt the broker is in backoff and the next one in the list is
+ * tried right away.
+ */
+void reconnect()
+{
+  // Loop until we're reconnected
+  while (!client.connected())
+  {
+    unsigned long waitMs;
+    int brokerIndex = broker_select(&waitMs);
+    Broker *broker = broker_get(brokerIndex);
+
+    if (waitMs > 0)
+    {
+      // Every broker is in backoff, turn off led board and wait
+      digitalWrite(ONBOARD_LED, LOW);
+      delay(waitMs);
+    }
+
+    LOG_NOTICE(F("Attempting MQTT connection to %s:%d" CR), broker->host,
+               broker->port);
+
+    // The address comes from the cache, no DNS lookup at every attempt
+    IPAddress brokerAddress;
+
+    if (!dns_cache_resolve(broker->host, brokerAddress))
+    {
+      broker_on_connect_failed(brokerIndex);
+
+      LOG_ERROR(F("DNS resolution failed for %s, try the next broker" CR),
+                broker->host);
+      continue;
+    }
+
+    client.setServer(brokerAddress, broker->port);
+
+    // Attempt to connect
+    unsigned long connectStart = millis();
+
+    if (client.connect(clientId.c_str(), mqtt_username, mqtt_password,
+                       NULL, 0, false, NULL, mqtt_clean_session))
+    {
+      broker_on_connect(brokerIndex, millis() - connectStart);
+
+      LOG_NOTICE(F("Connected as clientId %s :-)" CR), clientId.c_str());
+
+      /**
+       * Subscribe at every connect: a resumed session already delivers the
+       * queued commands, but the broker may have lost the session (restart
+       * without persistence, expiry, another broker of the list) and the
+       * device can't tell. On a session held by the broker the subscribe is
+       * only a round trip.
+       */
+      client.subscribe(topic_command, 1);
+      client.subscribe(topic_rtt.c_str(), 0);
+      LOG_NOTICE(F("Subscribe to the topic command %s " CR), topic_command);
+
+      // Publish the status of the relays changed while disconnected
+      publish_changed_relays_status();
+
+      // Turn on led board
+      digitalWrite(ONBOARD_LED, HIGH);
+    }
+    else
+    {
+      broker_on_connect_failed(brokerIndex);
+
+      // The address may be changed: refreshed at the next attempt, at most
+      // once per DNS_CACHE_RETRY_MS (the cached one is used meanwhile)
+      dns_cache_expire(broker->host);
+
+      LOG_ERROR(F("{failed, rc=%d on %s, try the next broker}" CR),
+                client.state(), broker->host);
+    }
+  }
+}
+
+/**
+ * Start the I2C buses and scan them for the BME280 sensors. The simulated
+ * sensors are registered after them.
+ */
+void setup_sensors(const Bme280Profile &profile)
+{
+  Wire.begin(i2c_sda, i2c_scl, i2c_clock);
+  Wire.setTimeOut(i2c_timeout);
+
+#if defined(I2C1_SDA) && defined(I2C1_SCL)
+  Wire1.begin(i2c1_sda, i2c1_scl, i2c_clock);
+  Wire1.setTimeOut(i2c_timeout);
+#endif
+
+  scan_sensors(profile);
+
+#ifdef SENSOR_SIMULATED
+  // CO2, illuminance, current and temperature in turn
+  const SimulatedSensor models[] = {
+      SimulatedSensor(Quantity_Co2, 600.0F, 200.0F, 600000),
+      SimulatedSensor(Quantity_Illuminance, 300.0F, 250.0F, 3600000),
+      SimulatedSensor(Quantity_Current, 1.5F, 0.5F, 60000),
+      SimulatedSensor(Quantity_Temperature, 21.0F, 2.0F, 3600000)};
+
+  for (int i = 0; i < SENSOR_SIMULATED; i++)
+  {
+    simulatedSensors[i] = models[i % (sizeof(models) / sizeof(models[0]))];
+
+    int channel = sensor_register(&simulatedSensors[i], simulated_sensor_period, interval);
+
+    LOG_NOTICE(F("Simulated sensor %d: channel %d" CR), i, channel);
+
+    if (channel >= 0)
+    {
+      load_sensor_calibrations(channel);
+    }
+  }
+#endif
+}
+
+/**
+ * Load the calibrations persisted in NVS of the sensor of a channel, by its
+ * id (at the registration: at boot, or on the sampler task for a sensor
+ * found later)
+ */
+void load_sensor_calibrations(int channel)
+{
+  uint32_t id = sensor_id(channel);
+
+  for (uint8_t quantity = 0; quantity < Quantity_Count; quantity++)
+  {
+    SensorCalibration calibration;
+    char key[16];
+
+    snprintf(key, sizeof(key), "cal%08xq%d", (unsigned int)id, quantity);
+
+    // A calibration of another layout (older firmware) is ignored
+    if (!sensorPreferences.isKey(key) ||
+        sensorPreferences.getBytesLength(key) != sizeof(calibration))
+    {
+      continue;
+    }
+
+    sensorPreferences.getBytes(key, &calibration, sizeof(calibration));
+
+    if (calibration.sensor != id)
+    {
+      continue;
+    }
+
+    if (!sensor_calibration_set(calibration))
+    {
+      LOG_ERROR(F("Calibration %s not loaded, the table is full" CR), key);
+    }
+  }
+}
+
+/**
+ * Scan the buses for the BME280 sensors not registered yet: every sensor
+ * found is configured with the profile and registered
+ *
+ * return: Number of the sensors found
+ */
+int scan_sensors(const Bme280Profile &profile)
+{
+  TwoWire *buses[] = {&Wire, &Wire1};
+  int found = 0;
+
+  for (int bus = 0; bus < i2c_bus_count; bus++)
+  {
+    for (size_t i = 0; i < sizeof(bme280_addresses); i++)
+    {
+      if (bme280SensorCount == BME280_SENSOR_MAX)
+      {
+        break;
+      }
+
+      uint8_t address = bme280_addresses[i];
+      Bme280Sensor &sensor = bme280Sensors[bme280SensorCount];
+
+      // Address probe, then check of the chip
+      buses[bus]->beginTransmission(address);
+
+      if (buses[bus]->endTransmission() != 0 ||
+          !sensor.begin(profile, address, *buses[bus], bus))
+      {
+        continue;
+      }
+
+      sensor.set_sea_level(sensorQnh);
+
+      int channel = sensor_register(&sensor, sensor_sample_period, interval);
+
+      LOG_NOTICE(F("BME280 on bus %d at 0x%x (%d Hz): channel %d" CR), bus, address,
+                 buses[bus]->getClock(), channel);
+
+      if (channel >= 0)
+      {
+        load_sensor_calibrations(channel);
+      }
+
+      bme280SensorCount++;
+      found++;
+    }
+  }
+
+  return found;
+}
+
+/**
+ * Scan of the buses of a device booted without a BME280 (timer callback,
+ * sampler task): the backoff is doubled until a sensor is found
+ */
+void on_sensor_scan(void *arg, uint32_t scheduledMs)
+{
+  sensorScans++;
+
+  if (scan_sensors(*sensorProfile) > 0)
+  {
+    LOG_NOTICE(F("BME280 found after %d scans" CR), sensorScans);
+    return;
+  }
+
+  sensorScanMs = sensorScanMs < SENSOR_RETRY_MAX / 2 ? sensorScanMs * 2 : SENSOR_RETRY_MAX;
+  timer_start(sensorScanMs, 0, on_sensor_scan, NULL);
+}
+
+/**
+ * Serialize a message in a payload buffer
+ *
+ * return: Length of the payload, 0 if the message doesn't fit in the
+ *         document or in the buffer (a message is never published truncated)
+ */
+size_t serialize_payload(const JsonDocument &message, char *payload, size_t size)
+{
+  if (message.overflowed() || measureJson(message) >= size)
+  {
+    return 0;
+  }
+
+  return serializeJson(message, payload, size);
+}
+
+/**
+ * Build the telemetry message of a window and publish it (MQTT pump task)
+ */
+void publish_telemetry(const SensorRecord &record)
+{
+  // Allocate the JSON document
+  // Inside the brackets, 1536 is the RAM allocated to this document.
+  // Don't forget to change this value to match your requirement.
+  // Use arduinojson.org/v6/assistant to compute the capacity.
+  StaticJsonDocument<1536> telemetry;
+
+  TRACE(Trace_Telemetry_Begin, record.sequence, record.channel);
+
+  telemetry["clientId"] = clientId.c_str();
+  telemetry["deviceName"] = device_name;
+  timestamp_stamp(telemetry);
+  sensor_encode(record, telemetry);
+  telemetry["counter"] = ++counter;
+  telemetry["broker"] = broker_get(broker_current_index())->host;
+
+  JsonArray relaysStatusJsonArray = telemetry.createNestedArray("relaysStatus");
+
+  int relaysStatus[4];
+
+  get_relays_status(relaysStatus);
+
+  for (int i = 0; i <= 3; i++)
+  {
+      relaysStatusJsonArray.add(relaysStatus[i]);
+  }
+
+  char telemetryAsJson[TELEMETRY_PAYLOAD_MAX_LENGTH];
+  size_t length = serialize_payload(telemetry, telemetryAsJson, sizeof(telemetryAsJson));
+
+  TRACE(Trace_Telemetry_Serialized, record.sequence, length);
+
+  if (length == 0)
+  {
+    LOG_ERROR(F("Telemetry of %s not published: %d bytes, max %d" CR),
+              sensor_driver(record.channel)->name(), (int)measureJson(telemetry),
+              TELEMETRY_PAYLOAD_MAX_LENGTH - 1);
+    return;
+  }
+
+  bool published = client.publish(topic_telemetry_data, telemetryAsJson);
+
+  TRACE(Trace_Telemetry_End, record.sequence, published);
+
+  broker_on_publish(published);
+
+  // Echo on the console (rate limited, the first message is always echoed)
+  if (console_telemetry_interval == 0 ||
+      (counter > 1 && millis() - lastConsoleTelemetry < console_telemetry_interval))
+  {
+    return;
+  }
+
+  ConsoleLine line;
+
+  line.queuedAt = esp_timer_get_time();
+  snprintf(line.text, sizeof(line.text), "%s\r\n", telemetryAsJson);
+
+  if (xQueueSend(consoleQueue, &line, 0) == pdTRUE)
+  {
+    lastConsoleTelemetry = millis();
+    xTaskNotifyGive(loggerTask);
+  }
+}
+
+/**
+ * Publish the trace in binary chunks on the topic of the trace (MQTT pump
+ * task): every chunk has a header (TraceChunkHeader) and up to 47 records
+ */
+void publish_trace()
+{
+  const uint32_t chunkRecords =
+      (PUBLISH_PAYLOAD_MAX_LENGTH - sizeof(TraceChunkHeader)) / sizeof(TraceRecord);
+
+  uint8_t chunk[PUBLISH_PAYLOAD_MAX_LENGTH];
+  TraceChunkHeader *header = (TraceChunkHeader *)chunk;
+  TraceRecord *records = (TraceRecord *)(chunk + sizeof(TraceChunkHeader));
+
+  uint32_t count = trace_count();
+  uint16_t chunks = (count + chunkRecords - 1) / chunkRecords;
+
+  memcpy(header->magic, TRACE_MAGIC, sizeof(header->magic));
+  header->cpuMhz = trace_cpu_mhz();
+  header->chunks = chunks;
+
+  for (uint16_t i = 0; i < chunks; i++)
+  {
+    header->index = i;
+    header->records = trace_read(i * chunkRecords, records, chunkRecords);
+
+    if (!client.publish(topic_trace.c_str(), chunk,
+                        sizeof(TraceChunkHeader) + header->records * sizeof(TraceRecord)))
+    {
+      LOG_ERROR(F("Trace chunk %d of %d not published" CR), i, chunks);
+      broker_on_publish(false);
+      return;
+    }
+  }
+
+  LOG_NOTICE(F("Trace published: %d records in %d chunks" CR), count, chunks);
+}
+
+/**
+ * Publish the next chunk of a ready capture (MQTT pump task): the capture
+ * is released after the last one
+ */
+void publish_capture_chunk()
+{
+  static_assert(SENSOR_CAPTURE_CHUNK_TEXT_MAX < PUBLISH_PAYLOAD_MAX_LENGTH,
+                "A capture chunk must fit in a publish payload");
+
+  StaticJsonDocument<SENSOR_CAPTURE_CHUNK_CAPACITY> chunk;
+  char payload[PUBLISH_PAYLOAD_MAX_LENGTH];
+  uint16_t chunks = sensor_capture_chunks();
+
+  lastCaptureChunk = millis();
+
+  if (captureChunk < chunks)
+  {
+    chunk["clientId"] = clientId.c_str();
+    sensor_capture_encode(captureChunk, chunk);
+
+    // A chunk that doesn't fit is skipped (the consumers see the gap in
+    // the chunk indexes), it would never fit at a retry
+    if (serialize_payload(chunk, payload, sizeof(payload)) == 0)
+    {
+      LOG_ERROR(F("Sensor capture chunk %d of %d doesn't fit in the payload, skipped" CR),
+                captureChunk, chunks);
+      captureChunk++;
+      return;
+    }
+
+    // A chunk not published is retried at the next interval
+    bool published = client.publish(topic_capture.c_str(), payload);
+
+    broker_on_publish(published);
+
+    if (!published)
+    {
+      return;
+    }
+
+    captureChunk++;
+  }
+
+  if (captureChunk >= chunks)
+  {
+    LOG_NOTICE(F("Sensor capture published: %d samples in %d chunks" CR),
+               sensor_capture_count(), chunks);
+
+    captureChunk = 0;
+    sensor_capture_release();
+  }
+}
+
+/**
+ * Publish a queued message (MQTT pump task)
+ */
+void publish_request(const PublishRequest &request)
+{
+  TRACE(Trace_Publish_Begin, request.kind, 0);
+
+  switch (request.kind)
+  {
+  case Publish_Relay_Status:
+    // Superseded by a later change, or already published (e.g. by
+    // publish_changed_relays_status after a reconnect) and not a query
+    if (relay_published[request.relayId] &&
+        (request.seq < relay_published_seq[request.relayId] ||
+         (request.seq == relay_published_seq[request.relayId] && !request.query)))
+    {
+      break;
+    }
+
+    publish_relay_status(request.relayId, request.status, request.seq);
+    break;
+  case Publish_Task_Metrics:
+    broker_on_publish(client.publish(topic_task_metrics, request.payload));
+    break;
+  case Publish_Sensor_Status:
+    broker_on_publish(client.publish(topic_sensor_status, request.payload));
+    break;
+  case Publish_Sensor_Metrics:
+    broker_on_publish(client.publish(topic_sensor_metrics, request.payload));
+    break;
+  case Publish_Trace_Dump:
+    publish_trace();
+    break;
+  }
+
+  TRACE(Trace_Publish_End, request.kind, 0);
+}
+
+/**
+ * MQTT pump task (network core)
+ */
+void mqtt_task(void *parameter)
+{
+  unsigned long lastRttProbe = 0;
+
+  for (;;)
+  {
+    if (!client.connected())
+    {
+      reconnect();
+    }
+
+    task_metrics_work_begin(Task_Mqtt);
+
+    client.loop();
+
+    unsigned long now = millis();
+
+    // Probe the round trip time to the broker
+    if (now - lastRttProbe > rtt_probe_interval)
+    {
+      lastRttProbe = now;
+      client.publish(topic_rtt.c_str(), String(now).c_str());
+    }
+
+    // Publish the queued messages and the telemetry of the new samples
+    PublishRequest request;
+    SensorRecord record;
+
+    while (client.connected() && xQueueReceive(publishQueue, &request, 0) == pdTRUE)
+    {
+      publish_request(request);
+      task_metrics_latency(Task_Mqtt, esp_timer_get_time() - request.queuedAt);
+    }
+
+    while (client.connected() && sampleRing.pop(record))
+    {
+      publish_telemetry(record);
+      task_metrics_latency(Task_Mqtt, esp_timer_get_time() - record.sampledAt);
+    }
+
+    // One chunk of a ready capture every interval, after the telemetry
+    bool captureReady = sensor_capture_state() == Capture_Ready;
+
+    if (client.connected() && captureReady &&
+        millis() - lastCaptureChunk >= capture_chunk_interval)
+    {
+      publish_capture_chunk();
+    }
+
+    task_metrics_work_end(Task_Mqtt);
+
+    // Fail back to a preferred broker when it's back and healthier
+    if (broker_should_fail_back())
+    {
+      LOG_NOTICE(F("Fail back to a preferred MQTT Broker" CR));
+      client.disconnect();
+    }
+
+    // Sleep until data on the socket, a message to publish or the next probe
+    if (client.connected() && espClient.available() == 0)
+    {
+      unsigned long sinceRttProbe = millis() - lastRttProbe;
+      uint32_t sleepMs = sinceRttProbe > rtt_probe_interval
+                             ? 0
+                             : min((uint32_t)(rtt_probe_interval - sinceRttProbe + 1),
+                                   mqtt_max_sleep);
+
+      if (captureReady)
+      {
+        unsigned long sinceCaptureChunk = millis() - lastCaptureChunk;
+
+        sleepMs = sinceCaptureChunk >= capture_chunk_interval
+                      ? 0
+                      : min(sleepMs, (uint32_t)(capture_chunk_interval - sinceCaptureChunk));
+      }
+
+      // Poll the probe of a preferred broker
+      sleepMs = min(sleepMs, broker_fail_back_wait_ms());
+
+      mqtt_events_wait(espClient.fd(), sleepMs);
+    }
+  }
+}
+
+/**
+ * Command executor task (control core)
+ */
+void command_task(void *parameter)
+{
+  Command command;
+
+  for (;;)
+  {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+    task_metrics_work_begin(Task_Command);
+
+    while (commandRing.pop(command))
+    {
+      TRACE(Trace_Command_Begin, esp_timer_get_time() - command.receivedAt, 0);
+
+      execute_command(command.text);
+      task_metrics_latency(Task_Command, esp_timer_get_time() - command.receivedAt);
+
+      TRACE(Trace_Command_End, 0, 0);
+    }
+
+    task_metrics_work_end(Task_Command);
+  }
+}
+
+/**
+ * Apply an acquisition profile to every BME280 (timer callback, sampler
+ * task)
+ */
+void on_sensor_profile(void *arg, uint32_t scheduledMs)
+{
+  const Bme280Profile *profile = (const Bme280Profile *)arg;
+
+  sensorProfile = profile;
+
+  for (int i = 0; i < bme280SensorCount; i++)
+  {
+    if (!bme280Sensors[i].configure(*profile))
+    {
+      LOG_ERROR(F("Sensor profile %s not configured on BME280 %d" CR), profile->name, i);
+    }
+  }
+
+  LOG_NOTICE(F("Sensor profile %s (conversion %d us)" CR), profile->name,
+             Bme280::measurement_time_us(*profile));
+
+  // The lead times of the triggers are changed
+  sensors_schedule();
+}
+
+/**
+ * Apply the QNH to every BME280 (timer callback, sampler task)
+ */
+void on_sensor_qnh(void *arg, uint32_t scheduledMs)
+{
+  for (int i = 0; i < bme280SensorCount; i++)
+  {
+    bme280Sensors[i].set_sea_level(sensorQnh);
+  }
+
+  LOG_NOTICE(F("Sensor QNH %F hPa" CR), sensorQnh);
+}
+
+/**
+ * Update the calibrations and the version (timer callback, sampler task):
+ * an accepted calibration is handed to the logger, that persists it
+ */
+void on_sensor_calibration(void *arg, uint32_t scheduledMs)
+{
+  CalibrationRequest request;
+
+  while (xQueueReceive(calibrationQueue, &request, 0) == pdTRUE)
+  {
+    if (!sensor_calibration_set(request.calibration))
+    {
+      LOG_ERROR(F("Calibration of the channel %d not set, the table is full" CR),
+                request.channel);
+      continue;
+    }
+
+    request.version = sensor_calibration_version() + 1;
+    sensor_calibration_set_version(request.version);
+
+    LOG_NOTICE(F("Calibration version %d: channel %d, %s" CR), request.version,
+               request.channel, sensor_quantity_name(request.calibration.quantity));
+
+    if (xQueueSend(calibrationPersistQueue, &request, 0) != pdTRUE)
+    {
+      LOG_ERROR(F("Calibration version %d not persisted, the logger is behind" CR),
+                request.version);
+      continue;
+    }
+
+    xTaskNotifyGive(loggerTask);
+  }
+}
+
+/**
+ * Persist the calibrations accepted by the sampler and their version
+ * (logger task)
+ */
+void persist_sensor_calibrations()
+{
+  CalibrationRequest request;
+
+  while (xQueueReceive(calibrationPersistQueue, &request, 0) == pdTRUE)
+  {
+    char key[16];
+
+    snprintf(key, sizeof(key), "cal%08xq%d", (unsigned int)request.calibration.sensor,
+             request.calibration.quantity);
+
+    if (request.reset)
+    {
+      sensorPreferences.remove(key);
+    }
+    else
+    {
+      sensorPreferences.putBytes(key, &request.calibration, sizeof(request.calibration));
+    }
+
+    sensorPreferences.putUInt("calVersion", request.version);
+  }
+}
+
+/**
+ * Start a capture (timer callback, sampler task): the MQTT pump is woken up
+ * when it's ready
+ */
+void on_sensor_capture(void *arg, uint32_t scheduledMs)
+{
+  CaptureRequest request;
+
+  if (xQueueReceive(captureQueue, &request, 0) != pdTRUE)
+  {
+    return;
+  }
+
+  if (!sensor_capture_start(request.channel, request.period, request.duration,
+                            mqtt_events_wake))
+  {
+    LOG_WARNING(F("Sensor capture of the channel %d not started" CR), request.channel);
+    return;
+  }
+
+  LOG_NOTICE(F("Sensor capture of the channel %d for %d ms" CR), request.channel,
+             request.duration);
+}
+
+/**
+ * Sink of the records of the sensors (sampler task): latest record of the
+ * sensor and ring of the telemetry
+ */
+void on_sensor_record(const SensorRecord &record)
+{
+  latestSample[record.channel].write(record);
+  sampleRing.push(record);
+  mqtt_events_wake();
+}
+
+/**
+ * Sensor sampler task (control core): it advances the timer wheel and
+ * sleeps until the next expiry or until a timer is started by another task
+ */
+void sampler_task(void *parameter)
+{
+  timer_wheel_begin(millis(), xTaskGetCurrentTaskHandle());
+
+  sensors_start(on_sensor_record);
+
+  if (bme280SensorCount == 0)
+  {
+    timer_start(sensorScanMs, 0, on_sensor_scan, NULL);
+  }
+
+  uint32_t retryMs = UINT32_MAX;
+
+  for (;;)
+  {
+    // The timers of the sensors not started (pool empty) are retried too
+    uint32_t sleepMs = min(timer_wheel_sleep_ms(millis()), retryMs);
+
+    ulTaskNotifyTake(pdTRUE, sleepMs == UINT32_MAX ? portMAX_DELAY
+                                                   : pdMS_TO_TICKS(sleepMs));
+
+    // Every callback (triggers, polls, reads) is work of the sampler
+    task_metrics_work_begin(Task_Sampler);
+    timer_wheel_advance(millis());
+    retryMs = sensors_retry_timers();
+    task_metrics_work_end(Task_Sampler);
+  }
+}
+
+/**
+ * Add the statistics of a ring to the JSON message
+ */
+void report_ring_stats(JsonDocument &message, const char *name,
+                       const SpscRingStats &ringStats)
+{
+  JsonObject ring = message.createNestedObject(name);
+
+  ring["pushed"] = ringStats.pushed;
+  ring["dropped"] = ringStats.dropped;
+  ring["overwritten"] = ringStats.overwritten;
+}
+
+/**
+ * Add the health of the sensors to the JSON message: degraded without a
+ * BME280 or with a failed sensor, channels, failed channels and scans of
+ * the buses after the boot
+ */
+void report_sensor_health(JsonDocument &message)
+{
+  JsonObject sensors = message.createNestedObject("sensors");
+  int failed = sensors_failed();
+
+  sensors["health"] = bme280SensorCount == 0 || failed > 0 ? "degraded" : "ok";
+  sensors["channels"] = sensor_count();
+  sensors["failed"] = failed;
+  sensors["scans"] = sensorScans;
+}
+
+/**
+ * Queue a metrics message for the MQTT pump and echo it on the log
+ *
+ * name: Name of the message in the log
+ * return: false if the message doesn't fit the payload (not published)
+ */
+bool queue_metrics(const JsonDocument &message, PublishKind kind, const char *name)
+{
+  PublishRequest request;
+
+  request.kind = kind;
+
+  if (serialize_payload(message, request.payload, sizeof(request.payload)) == 0)
+  {
+    LOG_ERROR(F("%s not published: %d bytes, max %d" CR), name,
+              (int)measureJson(message), PUBLISH_PAYLOAD_MAX_LENGTH - 1);
+    return false;
+  }
+
+  LOG_NOTICE(F("%s: %s" CR), name, request.payload);
+
+  return queue_publish(request);
+}
+
+/**
+ * Publish the metrics of the tasks, of the log, of the rings and the health
+ * of the sensors (logger task), in two messages on the topic of the task
+ * metrics: the tasks and the cores, then the log, the rings and the sensors
+ * (together over the payload of a queued message)
+ */
+void report_task_metrics()
+{
+  StaticJsonDocument<PUBLISH_PAYLOAD_MAX_LENGTH * 2> taskMetrics;
+
+  taskMetrics["clientId"] = clientId.c_str();
+  timestamp_stamp(taskMetrics);
+  task_metrics_report(taskMetrics);
+
+  queue_metrics(taskMetrics, Publish_Task_Metrics, "Task metrics");
+
+  taskMetrics.clear();
+  taskMetrics["clientId"] = clientId.c_str();
+  timestamp_stamp(taskMetrics);
+  Logger.report(taskMetrics);
+  report_ring_stats(taskMetrics, "samples", sampleRing.stats());
+  report_ring_stats(taskMetrics, "commands", commandRing.stats());
+  report_sensor_health(taskMetrics);
+
+  queue_metrics(taskMetrics, Publish_Task_Metrics, "Task metrics");
+}
 
-    for (int i = 0; i <= 3; i++)
+/**
+ * Publish the metrics of the driver of every sensor channel, one message
+ * per channel (logger task)
+ */
+void report_sensor_metrics()
+{
+  for (int i = 0; i < sensor_count(); i++)
+  {
+    StaticJsonDocument<PUBLISH_PAYLOAD_MAX_LENGTH> sensorMetrics;
+    SensorDriver *driver = sensor_driver(i);
+
+    sensorMetrics["clientId"] = clientId.c_str();
+    timestamp_stamp(sensorMetrics);
+    sensorMetrics["sensor"] = driver->name();
+    sensorMetrics["channel"] = i;
+    driver->describe(sensorMetrics.as<JsonObject>());
+    sensor_report_health(i, sensorMetrics.as<JsonObject>());
+    sensor_calibration_report(sensor_id(i), sensorMetrics.createNestedObject("calibration"));
+    driver->report(sensorMetrics.as<JsonObject>());
+
+    queue_metrics(sensorMetrics, Publish_Sensor_Metrics, "Sensor metrics");
+  }
+}
+
+/**
+ * Logger task (network core, lowest priority)
+ */
+void logger_task(void *parameter)
+{
+  ConsoleLine line;
+  size_t lineLength = 0;
+  size_t lineWritten = 0;
+  TickType_t lastReport = xTaskGetTickCount();
+
+  for (;;)
+  {
+    // Notified by the log records and by the console lines
+    ulTaskNotifyTake(pdTRUE, lineWritten < lineLength
+                                 ? pdMS_TO_TICKS(console_retry_interval)
+                                 : pdMS_TO_TICKS(task_metrics_interval));
+
+    task_metrics_work_begin(Task_Logger);
+
+    for (;;)
+    {
+      if (lineWritten == lineLength)
+      {
+        if (xQueueReceive(consoleQueue, &line, 0) != pdTRUE)
+        {
+          break;
+        }
+
+        lineLength = strlen(line.text);
+        lineWritten = 0;
+      }
+
+      // Only what fits in the TX FIFO, the rest at the next retry
+      size_t chunk = min(lineLength - lineWritten, (size_t)Serial.availableForWrite());
+
+      Serial.write((const uint8_t *)line.text + lineWritten, chunk);
+      lineWritten += chunk;
+
+      if (lineWritten < lineLength)
+      {
+        break;
+      }
+
+      task_metrics_latency(Task_Logger, esp_timer_get_time() - line.queuedAt);
+    }
+
+    persist_sensor_calibrations();
+
+    // The log records are not written in the middle of a console line
+    if (lineWritten == lineLength)
+    {
+      Logger.drain();
+
+      if (traceDumpRequested)
+      {
+        traceDumpRequested = false;
+        trace_dump_serial(Serial);
+      }
+    }
+
+    task_metrics_work_end(Task_Logger);
+
+    if (xTaskGetTickCount() - lastReport < pdMS_TO_TICKS(task_metrics_interval))
     {
-        relaysStatusJsonArray.add(relaysStatus[i]);
+      continue;
     }
-    
-    char telemetryAsJson[256];
-    serializeJson(telemetry, telemetryAsJson);
 
-    client.publish(topic_telemetry_data, telemetryAsJson);
+    lastReport = xTaskGetTickCount();
+
+    report_task_metrics();
+    report_sensor_metrics();
+  }
+}
+
+/**
+ * Setup the power management: frequency scaling and automatic light sleep
+ * while the tasks are waiting
+ */
+void setup_power_management()
+{
+#if CONFIG_PM_ENABLE
+  esp_pm_config_esp32_t pmConfig;
+
+  pmConfig.max_freq_mhz = ESP.getCpuFreqMHz();
+  pmConfig.min_freq_mhz = 80;
+#if CONFIG_FREERTOS_USE_TICKLESS_IDLE
+  pmConfig.light_sleep_enable = light_sleep_enabled;
+#else
+  pmConfig.light_sleep_enable = false;
+#endif
+
+  if (esp_pm_configure(&pmConfig) != ESP_OK)
+  {
+    LOG_WARNING(F("Power management not configured" CR));
+  }
+#endif
+
+  // The WiFi modem sleeps between the beacons (needed by the light sleep)
+  WiFi.setSleep(true);
+}
+
+/**
+ * Create the tasks and the queues between them
+ */
+void setup_tasks()
+{
+  task_metrics_begin();
 
-    serializeJsonPretty(telemetry, Serial);
-    Serial.println();
+  if (!mqtt_events_begin())
+  {
+    LOG_WARNING(F("MQTT wake socket not created, the MQTT pump polls" CR));
   }
+
+  publishQueue = xQueueCreate(8, sizeof(PublishRequest));
+  consoleQueue = xQueueCreate(2, sizeof(ConsoleLine));
+  captureQueue = xQueueCreate(1, sizeof(CaptureRequest));
+  calibrationQueue = xQueueCreate(2, sizeof(CalibrationRequest));
+  calibrationPersistQueue = xQueueCreate(2, sizeof(CalibrationRequest));
+
+  xTaskCreatePinnedToCore(mqtt_task, "mqtt", mqtt_task_stack, NULL,
+                          mqtt_task_priority, &mqttTask, network_core);
+  xTaskCreatePinnedToCore(command_task, "command", command_task_stack, NULL,
+                          command_task_priority, &commandTask, control_core);
+  xTaskCreatePinnedToCore(sampler_task, "sampler", sampler_task_stack, NULL,
+                          sampler_task_priority, &samplerTask, control_core);
+  xTaskCreatePinnedToCore(logger_task, "logger", logger_task_stack, NULL,
+                          logger_task_priority, &loggerTask, network_core);
+
+  task_metrics_register(Task_Mqtt, mqttTask);
+  task_metrics_register(Task_Command, commandTask);
+  task_metrics_register(Task_Sampler, samplerTask);
+  task_metrics_register(Task_Logger, loggerTask);
+
+  // From now the log records are formatted by the logger task
+  Logger.registerTask(Task_Mqtt, mqttTask);
+  Logger.registerTask(Task_Command, commandTask);
+  Logger.registerTask(Task_Sampler, samplerTask);
+  Logger.start(loggerTask);
+}
+
+/**
+ * Loop lifecycle
+ *
+ * The work is done by the tasks created in setup(), the Arduino loop task
+ * is no longer needed.
+ */
+void loop()
+{
+  vTaskDelete(NULL);
 }
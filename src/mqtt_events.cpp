@@ -0,0 +1,123 @@
+/**
+ * This mqtt_events.cpp implements the wait of the MQTT pump on the MQTT
+ * socket and on a loopback wake socket.
+ *
+ * MIT License
+ *
+ * ESP32 MQTT - Samples code
+ * Copyright (c) 2021 Antonio Musarra's Blog - https://www.dontesta.it
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in the
+ * Software without restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the
+ * Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <Arduino.h>
+#include <atomic>
+#include <lwip/sockets.h>
+#include "mqtt_events.h"
+
+static int wakeSocket = -1;
+static struct sockaddr_in wakeAddress;
+
+// Set while a wake is pending, so a burst of messages sends a single wake
+static std::atomic<bool> wakePending(false);
+
+bool mqtt_events_begin()
+{
+  wakeSocket = socket(AF_INET, SOCK_DGRAM, 0);
+
+  if (wakeSocket < 0)
+  {
+    return false;
+  }
+
+  memset(&wakeAddress, 0, sizeof(wakeAddress));
+  wakeAddress.sin_family = AF_INET;
+  wakeAddress.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  wakeAddress.sin_port = 0;
+
+  socklen_t addressLength = sizeof(wakeAddress);
+
+  // Bind to an ephemeral port and read it back to send the wakes to itself
+  if (bind(wakeSocket, (struct sockaddr *)&wakeAddress, sizeof(wakeAddress)) < 0 ||
+      getsockname(wakeSocket, (struct sockaddr *)&wakeAddress, &addressLength) < 0)
+  {
+    close(wakeSocket);
+    wakeSocket = -1;
+    return false;
+  }
+
+  fcntl(wakeSocket, F_SETFL, fcntl(wakeSocket, F_GETFL, 0) | O_NONBLOCK);
+
+  return true;
+}
+
+void mqtt_events_wake()
+{
+  if (wakeSocket < 0 || wakePending.exchange(true))
+  {
+    return;
+  }
+
+  char wake = 1;
+
+  if (sendto(wakeSocket, &wake, sizeof(wake), 0, (struct sockaddr *)&wakeAddress,
+             sizeof(wakeAddress)) < 0)
+  {
+    // The wake is lost, let the next message try again
+    wakePending.store(false);
+  }
+}
+
+void mqtt_events_wait(int socketFd, uint32_t timeoutMs)
+{
+  if (wakeSocket < 0 && socketFd < 0)
+  {
+    delay(timeoutMs);
+    return;
+  }
+
+  fd_set readSet;
+  struct timeval timeout;
+
+  FD_ZERO(&readSet);
+
+  if (wakeSocket >= 0)
+  {
+    FD_SET(wakeSocket, &readSet);
+  }
+
+  if (socketFd >= 0)
+  {
+    FD_SET(socketFd, &readSet);
+  }
+
+  timeout.tv_sec = timeoutMs / 1000;
+  timeout.tv_usec = (timeoutMs % 1000) * 1000;
+
+  select(max(wakeSocket, socketFd) + 1, &readSet, NULL, NULL, &timeout);
+
+  if (wakeSocket >= 0 && FD_ISSET(wakeSocket, &readSet))
+  {
+    // Clear the pending flag before the drain: a later wake is never lost
+    wakePending.store(false);
+
+    char wake[8];
+
+    while (recv(wakeSocket, wake, sizeof(wake), 0) > 0)
+    {
+    }
+  }
+}
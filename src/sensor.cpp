@@ -0,0 +1,656 @@
+/**
+ * This sensor.cpp implements the static registry of the sensors, their
+ * sampling on the timer wheel and the telemetry encoder.
+ *
+ * MIT License
+ *
+ * ESP32 MQTT - Samples code
+ * Copyright (c) 2021 Antonio Musarra's Blog - https://www.dontesta.it
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in the
+ * Software without restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the
+ * Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <Arduino.h>
+#include <esp_timer.h>
+#include "sensor.h"
+#include "sensor_calibration.h"
+#include "task_metrics.h"
+#include "timer_wheel.h"
+#include "timestamp.h"
+#include "trace.h"
+
+struct SensorEntry
+{
+  SensorDriver *driver;
+  uint32_t id;
+  uint32_t period;
+  uint32_t window;
+  TimerId readTimer;
+  TimerId triggerTimer;
+  uint32_t scheduledMs;
+  uint32_t missed;
+
+  // Health: read errors (total and consecutive), failures, recoveries and
+  // backoff of the next retry of a failed sensor
+  uint8_t health;
+  uint8_t consecutiveErrors;
+  uint32_t errors;
+  uint32_t failures;
+  uint32_t recoveries;
+  uint32_t retryMs;
+  TimerId retryTimer;
+
+  // Timers that couldn't be started (Pending_*), and the count of them
+  uint8_t pendingTimers;
+  uint32_t timerFailures;
+
+  // Hook of the readings (e.g. a capture)
+  SensorHook hook;
+  void *hookArg;
+
+  // Window in progress: end (millis), reads and statistics of the quantities
+  uint32_t windowEndMs;
+  uint16_t reads;
+  uint8_t quantityCount;
+  uint8_t quantities[SENSOR_READINGS_MAX];
+  WindowStats stats[SENSOR_READINGS_MAX];
+};
+
+// Timers of a sensor to start again by sensors_retry_timers
+enum SensorPendingTimer
+{
+  Pending_Schedule = 0x01,
+  Pending_Retry = 0x02
+};
+
+static SensorEntry entries[SENSOR_REGISTRY_MAX];
+static volatile int entryCount = 0;
+
+// Time (millis) of the last attempt to start the pending timers
+static uint32_t timerRetryAt = 0;
+
+static bool started = false;
+static SensorSink recordSink = NULL;
+static uint32_t recordSequence = 0;
+
+static const char *quantity_names[Quantity_Count] = {
+    "temperature", "humidity", "pressure", "altitude", "co2", "illuminance", "current"};
+
+static const char *quantity_units[Quantity_Count] = {"C", "%RH", "Pa", "m", "ppm", "lx", "A"};
+
+static void schedule(SensorEntry &entry);
+
+/**
+ * Add a byte to a FNV-1a hash
+ */
+static inline uint32_t fnv1a(uint32_t hash, uint8_t value)
+{
+  return (hash ^ value) * 16777619UL;
+}
+
+/**
+ * Return the id of a driver registered after the ones of the registry
+ */
+static uint32_t driver_id(SensorDriver *driver)
+{
+  uint32_t hash = 2166136261UL;
+  uint16_t location = driver->location();
+  uint8_t order = 0;
+
+  for (const char *c = driver->name(); *c != '\0'; c++)
+  {
+    hash = fnv1a(hash, *c);
+  }
+
+  for (int i = 0; i < entryCount; i++)
+  {
+    if (entries[i].driver->location() == location &&
+        strcmp(entries[i].driver->name(), driver->name()) == 0)
+    {
+      order++;
+    }
+  }
+
+  hash = fnv1a(hash, location & 0xFF);
+  hash = fnv1a(hash, location >> 8);
+
+  return fnv1a(hash, order);
+}
+
+int sensor_register(SensorDriver *driver, uint32_t periodMs, uint32_t windowMs)
+{
+  if (entryCount == SENSOR_REGISTRY_MAX || periodMs == 0)
+  {
+    return -1;
+  }
+
+  SensorEntry &entry = entries[entryCount];
+
+  entry.driver = driver;
+  entry.id = driver_id(driver);
+  entry.period = periodMs;
+  entry.window = windowMs > periodMs ? windowMs - windowMs % periodMs : periodMs;
+  entry.reads = 0;
+  entry.quantityCount = 0;
+  entry.readTimer = TIMER_INVALID;
+  entry.triggerTimer = TIMER_INVALID;
+  entry.missed = 0;
+  entry.health = Sensor_Healthy;
+  entry.consecutiveErrors = 0;
+  entry.errors = 0;
+  entry.failures = 0;
+  entry.recoveries = 0;
+  entry.retryMs = SENSOR_RETRY_MIN;
+  entry.retryTimer = TIMER_INVALID;
+  entry.pendingTimers = 0;
+  entry.timerFailures = 0;
+  entry.hook = NULL;
+  entry.hookArg = NULL;
+
+  driver->attach(entryCount, entry.id);
+
+  // The entry is complete before it is visible to the other tasks
+  __sync_synchronize();
+  int index = entryCount++;
+
+  // A sensor found after the start (on the sampler task) is sampled at once
+  if (started)
+  {
+    schedule(entry);
+  }
+
+  return index;
+}
+
+int sensor_count()
+{
+  return entryCount;
+}
+
+SensorDriver *sensor_driver(int index)
+{
+  return entries[index].driver;
+}
+
+uint32_t sensor_id(int index)
+{
+  return entries[index].id;
+}
+
+uint32_t sensor_period(int index)
+{
+  return entries[index].period;
+}
+
+uint32_t sensor_window(int index)
+{
+  return entries[index].window;
+}
+
+void sensor_set_period(int index, uint32_t periodMs)
+{
+  SensorEntry &entry = entries[index];
+
+  entry.period = periodMs;
+
+  // A failed sensor is scheduled by its recovery
+  if (started && entry.health == Sensor_Healthy)
+  {
+    schedule(entry);
+  }
+}
+
+void sensor_set_hook(int index, SensorHook hook, void *arg)
+{
+  entries[index].hook = hook;
+  entries[index].hookArg = arg;
+}
+
+void sensor_report_health(int index, JsonObject object)
+{
+  const SensorEntry &entry = entries[index];
+
+  object["health"] = entry.health == Sensor_Healthy ? "ok" : "failed";
+  object["errors"] = entry.errors;
+  object["failures"] = entry.failures;
+  object["recoveries"] = entry.recoveries;
+  object["timerFailures"] = entry.timerFailures;
+}
+
+int sensors_failed()
+{
+  int failed = 0;
+
+  for (int i = 0; i < entryCount; i++)
+  {
+    failed += entries[i].health != Sensor_Healthy;
+  }
+
+  return failed;
+}
+
+const char *sensor_quantity_name(uint8_t quantity)
+{
+  return quantity < Quantity_Count ? quantity_names[quantity] : "unknown";
+}
+
+const char *sensor_quantity_unit(uint8_t quantity)
+{
+  return quantity < Quantity_Count ? quantity_units[quantity] : "";
+}
+
+/**
+ * Return the next deadline (millis) of a period, aligned to a multiple of
+ * the period on the wall clock (one period from now if not synced)
+ */
+static uint32_t next_deadline(uint32_t period)
+{
+  uint32_t now = millis();
+  int64_t epochMs = timestamp_now_ms();
+
+  if (epochMs == 0)
+  {
+    return now + period;
+  }
+
+  return now + (period - (uint32_t)(epochMs % period));
+}
+
+static void on_read_timer(void *arg, uint32_t scheduledMs);
+static void on_trigger_timer(void *arg, uint32_t scheduledMs);
+
+/**
+ * Count a timer of a sensor not started: it's started again by
+ * sensors_retry_timers
+ */
+static void timer_failed(SensorEntry &entry, SensorPendingTimer pending)
+{
+  entry.timerFailures++;
+  entry.pendingTimers |= pending;
+}
+
+/**
+ * Start the timers of a sensor on its next deadline and the timer of the
+ * trigger one lead time before (neither of them if one can't be started)
+ */
+static void schedule(SensorEntry &entry)
+{
+  uint32_t deadline = next_deadline(entry.period);
+  uint32_t lead = entry.driver->trigger_lead();
+
+  entry.windowEndMs = next_deadline(entry.window);
+  entry.pendingTimers &= ~Pending_Schedule;
+
+  timer_cancel(entry.readTimer);
+  timer_cancel(entry.triggerTimer);
+  entry.triggerTimer = TIMER_INVALID;
+
+  if (lead > 0)
+  {
+    entry.triggerTimer = timer_start_at(deadline - lead, entry.period, on_trigger_timer, &entry);
+  }
+
+  entry.readTimer = timer_start_at(deadline, entry.period, on_read_timer, &entry);
+
+  if (entry.readTimer == TIMER_INVALID || (lead > 0 && entry.triggerTimer == TIMER_INVALID))
+  {
+    timer_cancel(entry.readTimer);
+    timer_cancel(entry.triggerTimer);
+    entry.readTimer = TIMER_INVALID;
+    entry.triggerTimer = TIMER_INVALID;
+
+    timer_failed(entry, Pending_Schedule);
+  }
+}
+
+static void on_trigger_timer(void *arg, uint32_t scheduledMs)
+{
+  SensorEntry *entry = (SensorEntry *)arg;
+
+  TRACE(Trace_Sensor_Trigger, millis() - scheduledMs, entry - entries);
+
+  if (entry->health == Sensor_Healthy)
+  {
+    entry->driver->trigger();
+  }
+}
+
+static void on_retry_timer(void *arg, uint32_t scheduledMs);
+
+/**
+ * Start the timer of the next recovery of a failed sensor, on its backoff
+ */
+static void start_retry(SensorEntry &entry)
+{
+  entry.pendingTimers &= ~Pending_Retry;
+  entry.retryTimer = timer_start(entry.retryMs, 0, on_retry_timer, &entry);
+
+  if (entry.retryTimer == TIMER_INVALID)
+  {
+    timer_failed(entry, Pending_Retry);
+  }
+}
+
+/**
+ * Completion of the recovery of a failed sensor: on success the sensor is
+ * scheduled again, otherwise the backoff is doubled
+ */
+static void on_recovered(void *arg, bool ok)
+{
+  SensorEntry *entry = (SensorEntry *)arg;
+
+  if (ok)
+  {
+    entry->health = Sensor_Healthy;
+    entry->consecutiveErrors = 0;
+    entry->recoveries++;
+    entry->retryMs = SENSOR_RETRY_MIN;
+
+    schedule(*entry);
+    return;
+  }
+
+  entry->retryMs = entry->retryMs < SENSOR_RETRY_MAX / 2 ? entry->retryMs * 2 : SENSOR_RETRY_MAX;
+  start_retry(*entry);
+}
+
+/**
+ * Retry of a failed sensor
+ */
+static void on_retry_timer(void *arg, uint32_t scheduledMs)
+{
+  SensorEntry *entry = (SensorEntry *)arg;
+
+  entry->retryTimer = TIMER_INVALID;
+  entry->driver->recover(on_recovered, entry);
+}
+
+/**
+ * Count a read error: the sensor fails after SENSOR_ERROR_THRESHOLD
+ * consecutive errors and its recovery is retried on the backoff
+ */
+static void count_error(SensorEntry &entry)
+{
+  entry.errors++;
+
+  if (entry.consecutiveErrors < UINT8_MAX)
+  {
+    entry.consecutiveErrors++;
+  }
+
+  if (entry.health == Sensor_Healthy && entry.consecutiveErrors >= SENSOR_ERROR_THRESHOLD)
+  {
+    entry.health = Sensor_Failed;
+    entry.failures++;
+    entry.retryMs = SENSOR_RETRY_MIN;
+    start_retry(entry);
+  }
+}
+
+/**
+ * At the end of the window build the record and deliver it to the sink
+ * (the window of a failed sensor is delivered empty, with its health)
+ */
+static void close_window(SensorEntry *entry)
+{
+  uint8_t channel = entry - entries;
+
+  // The window is closed by the read at (or after) its end
+  if ((int32_t)(entry->scheduledMs - entry->windowEndMs) < 0)
+  {
+    return;
+  }
+
+  uint32_t lateness = millis() - entry->scheduledMs;
+  int64_t epochMs = timestamp_now_ms();
+  SensorRecord record;
+
+  record.channel = channel;
+  record.health = entry->health;
+  record.count = entry->quantityCount;
+  record.reads = entry->reads;
+  record.errors = entry->errors;
+  record.calibration = sensor_calibration_version();
+  record.sequence = ++recordSequence;
+  record.sampledAt = esp_timer_get_time();
+  record.deadline = epochMs != 0 ? epochMs - lateness : 0;
+  record.lateness = lateness;
+  record.missed = entry->missed;
+
+  for (uint8_t i = 0; i < record.count; i++)
+  {
+    SensorAggregate &aggregate = record.aggregates[i];
+    WindowStats &stats = entry->stats[i];
+
+    aggregate.quantity = entry->quantities[i];
+    aggregate.count = stats.count();
+    aggregate.min = stats.min();
+    aggregate.max = stats.max();
+    aggregate.mean = stats.mean();
+    aggregate.stddev = stats.stddev();
+
+    stats.reset();
+  }
+
+  entry->reads = 0;
+
+  // Next window (the windows without reads are skipped)
+  while ((int32_t)(entry->scheduledMs - entry->windowEndMs) >= 0)
+  {
+    entry->windowEndMs += entry->window;
+  }
+
+  if (recordSink != NULL)
+  {
+    recordSink(record);
+  }
+}
+
+/**
+ * Completion of a read: calibrate and accumulate the readings (or count the
+ * error) and close the window at its end
+ */
+static void on_read_done(void *arg, bool ok, const SensorReading *readings, uint8_t count)
+{
+  SensorEntry *entry = (SensorEntry *)arg;
+  uint8_t channel = entry - entries;
+
+  if (ok)
+  {
+    SensorReading calibrated[SENSOR_READINGS_MAX];
+
+    count = count < SENSOR_READINGS_MAX ? count : SENSOR_READINGS_MAX;
+
+    for (uint8_t i = 0; i < count; i++)
+    {
+      calibrated[i].quantity = readings[i].quantity;
+      calibrated[i].value =
+          sensor_calibration_apply(entry->id, readings[i].quantity, readings[i].value);
+
+      entry->quantities[i] = calibrated[i].quantity;
+      entry->stats[i].add(calibrated[i].value);
+    }
+
+    if (count > entry->quantityCount)
+    {
+      entry->quantityCount = count;
+    }
+
+    entry->reads++;
+    entry->consecutiveErrors = 0;
+
+    if (entry->hook != NULL)
+    {
+      entry->hook(entry->hookArg, channel, entry->scheduledMs, calibrated, count);
+    }
+  }
+  else
+  {
+    count_error(*entry);
+  }
+
+  TRACE(Trace_Sample_End, entry->reads, channel);
+
+  close_window(entry);
+}
+
+static void on_read_timer(void *arg, uint32_t scheduledMs)
+{
+  SensorEntry *entry = (SensorEntry *)arg;
+  uint32_t lateness = millis() - scheduledMs;
+
+  // Latency of the wake up from the deadline of the sample
+  task_metrics_latency(Task_Sampler, lateness * 1000);
+
+  // The timer skips the deadlines already expired
+  entry->missed += lateness / entry->period;
+
+  TRACE(Trace_Sample_Begin, lateness, entry - entries);
+
+  entry->scheduledMs = scheduledMs;
+
+  // No reads on a failed sensor until its recovery
+  if (entry->health == Sensor_Healthy)
+  {
+    entry->driver->read(on_read_done, entry);
+  }
+  else
+  {
+    close_window(entry);
+  }
+
+  // Realign the deadlines to the wall clock
+  int64_t epochMs = timestamp_now_ms();
+
+  if (epochMs != 0)
+  {
+    uint32_t phase = (uint32_t)((epochMs - (millis() - scheduledMs)) % entry->period);
+
+    if (phase > SENSOR_ALIGN_TOLERANCE && phase < entry->period - SENSOR_ALIGN_TOLERANCE)
+    {
+      schedule(*entry);
+    }
+  }
+}
+
+void sensors_start(SensorSink sink)
+{
+  recordSink = sink;
+  started = true;
+
+  sensors_schedule();
+}
+
+void sensors_schedule()
+{
+  for (int i = 0; i < entryCount; i++)
+  {
+    // A failed sensor is scheduled again by its recovery
+    if (entries[i].health == Sensor_Healthy)
+    {
+      schedule(entries[i]);
+    }
+  }
+}
+
+uint32_t sensors_retry_timers()
+{
+  bool pending = false;
+
+  for (int i = 0; i < entryCount && !pending; i++)
+  {
+    pending = entries[i].pendingTimers != 0;
+  }
+
+  if (!pending)
+  {
+    return UINT32_MAX;
+  }
+
+  uint32_t elapsed = millis() - timerRetryAt;
+
+  if (elapsed < SENSOR_TIMER_RETRY_MS)
+  {
+    return SENSOR_TIMER_RETRY_MS - elapsed;
+  }
+
+  timerRetryAt = millis();
+  pending = false;
+
+  for (int i = 0; i < entryCount; i++)
+  {
+    SensorEntry &entry = entries[i];
+
+    // A sensor failed meanwhile is scheduled again by its recovery
+    if ((entry.pendingTimers & Pending_Schedule) != 0)
+    {
+      if (entry.health == Sensor_Healthy)
+      {
+        schedule(entry);
+      }
+      else
+      {
+        entry.pendingTimers &= ~Pending_Schedule;
+      }
+    }
+
+    if ((entry.pendingTimers & Pending_Retry) != 0)
+    {
+      start_retry(entry);
+    }
+
+    pending = pending || entry.pendingTimers != 0;
+  }
+
+  return pending ? SENSOR_TIMER_RETRY_MS : UINT32_MAX;
+}
+
+void sensor_encode(const SensorRecord &record, JsonDocument &message)
+{
+  SensorDriver *driver = entries[record.channel].driver;
+
+  message["sensor"] = driver->name();
+  message["channel"] = record.channel;
+  driver->describe(message.as<JsonObject>());
+  message["health"] = record.health == Sensor_Healthy ? "ok" : "failed";
+  message["errors"] = record.errors;
+  message["calVersion"] = record.calibration;
+
+  for (uint8_t i = 0; i < record.count; i++)
+  {
+    const SensorAggregate &aggregate = record.aggregates[i];
+
+    // A quantity without readings in the window is not published
+    if (aggregate.count == 0)
+    {
+      continue;
+    }
+
+    JsonObject value = message.createNestedObject(sensor_quantity_name(aggregate.quantity));
+
+    value["count"] = aggregate.count;
+    value["min"] = aggregate.min;
+    value["max"] = aggregate.max;
+    value["mean"] = aggregate.mean;
+    value["stddev"] = aggregate.stddev;
+  }
+
+  message["interval"] = entries[record.channel].window;
+  message["period"] = entries[record.channel].period;
+  message["deadline"] = record.deadline;
+  message["lateness"] = record.lateness;
+  message["missed"] = record.missed;
+}
@@ -0,0 +1,313 @@
+/**
+ * This sensor_acquisition.cpp implements the non-blocking acquisition of the
+ * BME280 as a state machine on the timer wheel of the sampler.
+ *
+ * MIT License
+ *
+ * ESP32 MQTT - Samples code
+ * Copyright (c) 2021 Antonio Musarra's Blog - https://www.dontesta.it
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in the
+ * Software without restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the
+ * Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <Arduino.h>
+#include <esp_timer.h>
+#include "sensor_acquisition.h"
+#include "timer_wheel.h"
+
+static const char *phase_names[Sensor_Phase_Count] = {"trigger", "conversion", "read",
+                                                      "compensate"};
+
+void SensorAcquisition::begin(Bme280 &sensor)
+{
+  this->sensor = &sensor;
+  currentState = Sensor_Idle;
+}
+
+void SensorAcquisition::trigger()
+{
+  // In normal mode the sensor converts continuously
+  if (sensor->profile().mode != Bme280_Mode_Forced || currentState == Sensor_Converting ||
+      currentState == Sensor_Recovering)
+  {
+    return;
+  }
+
+  int64_t begin = esp_timer_get_time();
+  bool ok = sensor->trigger();
+  int64_t end = esp_timer_get_time();
+
+  record(Sensor_Phase_Trigger, end - begin);
+
+  if (!ok)
+  {
+    return;
+  }
+
+  triggeredAt = begin;
+  polls = 0;
+  currentState = Sensor_Converting;
+
+  uint32_t conversionMs = (Bme280::measurement_time_us(sensor->profile()) + 999) / 1000;
+
+  pollTimer = timer_start(conversionMs, 0, on_poll, this);
+
+  if (pollTimer == TIMER_INVALID)
+  {
+    // No timer: the conversion is polled by the read
+    timer_failed();
+  }
+}
+
+void SensorAcquisition::request(SensorReadCallback callback, void *arg)
+{
+  if (currentState == Sensor_Recovering)
+  {
+    Bme280Sample sample = {NAN, NAN, NAN};
+
+    callback(arg, false, sample);
+    return;
+  }
+
+  pendingCallback = callback;
+  pendingArg = arg;
+
+  if (currentState != Sensor_Converting)
+  {
+    complete();
+  }
+  else if (pollTimer == TIMER_INVALID)
+  {
+    poll();
+  }
+}
+
+void SensorAcquisition::recover(const Bme280Profile &profile, SensorRecoverCallback callback,
+                                void *arg)
+{
+  // A conversion in progress is abandoned
+  timer_cancel(pollTimer);
+
+  recoverProfile = &profile;
+  recoverCallback = callback;
+  recoverArg = arg;
+  pendingCallback = NULL;
+  pendingArg = NULL;
+  polls = 0;
+  currentState = Sensor_Recovering;
+
+  if (!sensor->reset())
+  {
+    recovered(false);
+    return;
+  }
+
+  pollTimer = timer_start(BME280_RESET_MS, 0, on_reset_poll, this);
+
+  if (pollTimer == TIMER_INVALID)
+  {
+    // Retried by the backoff of the registry
+    timer_failed();
+    recovered(false);
+  }
+}
+
+void SensorAcquisition::on_reset_poll(void *arg, uint32_t scheduledMs)
+{
+  SensorAcquisition *acquisition = (SensorAcquisition *)arg;
+
+  acquisition->pollTimer = TIMER_INVALID;
+  acquisition->reset_poll();
+}
+
+void SensorAcquisition::reset_poll()
+{
+  bool busy = true;
+  bool ok = sensor->updating(busy);
+
+  polls++;
+
+  if (ok && busy && polls < BME280_RESET_POLLS)
+  {
+    pollTimer = timer_start(BME280_RESET_MS, 0, on_reset_poll, this);
+
+    if (pollTimer != TIMER_INVALID)
+    {
+      return;
+    }
+
+    timer_failed();
+    ok = false;
+  }
+
+  recovered(ok && !busy && sensor->load(*recoverProfile));
+}
+
+void SensorAcquisition::recovered(bool ok)
+{
+  SensorRecoverCallback callback = recoverCallback;
+  void *arg = recoverArg;
+
+  recoverCallback = NULL;
+  recoverArg = NULL;
+  pollTimer = TIMER_INVALID;
+  currentState = Sensor_Idle;
+
+  if (callback != NULL)
+  {
+    callback(arg, ok);
+  }
+}
+
+void SensorAcquisition::on_poll(void *arg, uint32_t scheduledMs)
+{
+  SensorAcquisition *acquisition = (SensorAcquisition *)arg;
+
+  acquisition->pollTimer = TIMER_INVALID;
+  acquisition->poll();
+}
+
+void SensorAcquisition::poll()
+{
+  bool busy = false;
+  bool ok = sensor->measuring(busy);
+
+  polls++;
+
+  portENTER_CRITICAL(&statsMux);
+  pollCount++;
+  portEXIT_CRITICAL(&statsMux);
+
+  if (ok && busy && polls < SENSOR_POLL_MAX)
+  {
+    pollTimer = timer_start(1, 0, on_poll, this);
+
+    if (pollTimer != TIMER_INVALID)
+    {
+      return;
+    }
+
+    // No timer: polled again by the read, if one is pending
+    timer_failed();
+
+    if (pendingCallback == NULL)
+    {
+      return;
+    }
+  }
+
+  record(Sensor_Phase_Conversion, esp_timer_get_time() - triggeredAt);
+  currentState = Sensor_Ready;
+
+  if (pendingCallback != NULL)
+  {
+    complete();
+  }
+}
+
+void SensorAcquisition::complete()
+{
+  SensorReadCallback callback = pendingCallback;
+  void *arg = pendingArg;
+
+  pendingCallback = NULL;
+  pendingArg = NULL;
+
+  Bme280Raw raw;
+  Bme280Sample sample = {NAN, NAN, NAN};
+
+  int64_t begin = esp_timer_get_time();
+  bool ok = sensor->read_raw(raw);
+  int64_t read = esp_timer_get_time();
+
+  record(Sensor_Phase_Read, read - begin);
+
+  if (ok)
+  {
+    sample = sensor->compensate(raw);
+    record(Sensor_Phase_Compensate, esp_timer_get_time() - read);
+  }
+
+  currentState = Sensor_Idle;
+
+  if (callback != NULL)
+  {
+    callback(arg, ok, sample);
+  }
+}
+
+void SensorAcquisition::timer_failed()
+{
+  portENTER_CRITICAL(&statsMux);
+  timerFailures++;
+  portEXIT_CRITICAL(&statsMux);
+}
+
+void SensorAcquisition::record(SensorPhase phase, uint32_t elapsedUs)
+{
+  portENTER_CRITICAL(&statsMux);
+
+  phaseCount[phase]++;
+  phaseTotalUs[phase] += elapsedUs;
+
+  if (elapsedUs > phaseMaxUs[phase])
+  {
+    phaseMaxUs[phase] = elapsedUs;
+  }
+
+  portEXIT_CRITICAL(&statsMux);
+}
+
+void SensorAcquisition::report(JsonObject report)
+{
+  uint32_t count[Sensor_Phase_Count];
+  uint64_t totalUs[Sensor_Phase_Count];
+  uint32_t maxUs[Sensor_Phase_Count];
+  uint32_t pollsInWindow;
+  uint32_t failuresInWindow;
+
+  portENTER_CRITICAL(&statsMux);
+
+  for (int i = 0; i < Sensor_Phase_Count; i++)
+  {
+    count[i] = phaseCount[i];
+    totalUs[i] = phaseTotalUs[i];
+    maxUs[i] = phaseMaxUs[i];
+
+    phaseCount[i] = 0;
+    phaseTotalUs[i] = 0;
+    phaseMaxUs[i] = 0;
+  }
+
+  pollsInWindow = pollCount;
+  pollCount = 0;
+  failuresInWindow = timerFailures;
+  timerFailures = 0;
+
+  portEXIT_CRITICAL(&statsMux);
+
+  for (int i = 0; i < Sensor_Phase_Count; i++)
+  {
+    JsonArray phase = report.createNestedArray(phase_names[i]);
+
+    phase.add(count[i]);
+    phase.add(count[i] > 0 ? (uint32_t)(totalUs[i] / count[i]) : 0);
+    phase.add(maxUs[i]);
+  }
+
+  report["polls"] = pollsInWindow;
+  report["timerFailures"] = failuresInWindow;
+}
@@ -0,0 +1,205 @@
+/**
+ * This sensor_calibration.cpp implements the calibration of the readings of
+ * the sensors.
+ *
+ * MIT License
+ *
+ * ESP32 MQTT - Samples code
+ * Copyright (c) 2021 Antonio Musarra's Blog - https://www.dontesta.it
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in the
+ * Software without restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the
+ * Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <Arduino.h>
+#include <math.h>
+#include "sensor.h"
+#include "sensor_calibration.h"
+
+static SensorCalibration calibrations[SENSOR_CALIBRATION_MAX];
+static int calibrationCount = 0;
+static uint32_t calibrationVersion = 0;
+
+// The table is changed and applied by the sampler, reported by the logger
+static portMUX_TYPE calibrationLock = portMUX_INITIALIZER_UNLOCKED;
+
+/**
+ * Return the index of the calibration of a quantity of a sensor (-1 if not
+ * found)
+ */
+static int find(uint32_t sensor, uint8_t quantity)
+{
+  for (int i = 0; i < calibrationCount; i++)
+  {
+    if (calibrations[i].sensor == sensor && calibrations[i].quantity == quantity)
+    {
+      return i;
+    }
+  }
+
+  return -1;
+}
+
+SensorCalibration sensor_calibration_identity(uint32_t sensor, uint8_t quantity)
+{
+  SensorCalibration calibration;
+
+  memset(&calibration, 0, sizeof(calibration));
+  calibration.sensor = sensor;
+  calibration.quantity = quantity;
+  calibration.gain = 1.0F;
+
+  return calibration;
+}
+
+bool sensor_calibration_set(const SensorCalibration &calibration)
+{
+  if (calibration.points > SENSOR_CALIBRATION_POINTS)
+  {
+    return false;
+  }
+
+  SensorCalibration sorted = calibration;
+  bool identity = sorted.gain == 1.0F && sorted.offset == 0.0F && sorted.points < 2;
+
+  // Insertion sort of the points by the raw value
+  for (uint8_t i = 1; i < sorted.points; i++)
+  {
+    float raw = sorted.raw[i];
+    float corrected = sorted.corrected[i];
+    int j = i - 1;
+
+    for (; j >= 0 && sorted.raw[j] > raw; j--)
+    {
+      sorted.raw[j + 1] = sorted.raw[j];
+      sorted.corrected[j + 1] = sorted.corrected[j];
+    }
+
+    sorted.raw[j + 1] = raw;
+    sorted.corrected[j + 1] = corrected;
+  }
+
+  int index = find(sorted.sensor, sorted.quantity);
+  bool done = true;
+
+  portENTER_CRITICAL(&calibrationLock);
+
+  if (identity)
+  {
+    // The last calibration takes the place of the removed one
+    if (index >= 0)
+    {
+      calibrations[index] = calibrations[--calibrationCount];
+    }
+  }
+  else if (index >= 0)
+  {
+    calibrations[index] = sorted;
+  }
+  else if (calibrationCount < SENSOR_CALIBRATION_MAX)
+  {
+    calibrations[calibrationCount++] = sorted;
+  }
+  else
+  {
+    done = false;
+  }
+
+  portEXIT_CRITICAL(&calibrationLock);
+
+  return done;
+}
+
+/**
+ * Map a value by the linearisation table (at least two points)
+ */
+static float interpolate(const SensorCalibration &calibration, float value)
+{
+  // Segment of the value (the end segments out of the range)
+  uint8_t i = 1;
+
+  while (i < calibration.points - 1 && value > calibration.raw[i])
+  {
+    i++;
+  }
+
+  float span = calibration.raw[i] - calibration.raw[i - 1];
+
+  if (span == 0.0F)
+  {
+    return calibration.corrected[i];
+  }
+
+  return calibration.corrected[i - 1] + (value - calibration.raw[i - 1]) *
+                                            (calibration.corrected[i] - calibration.corrected[i - 1]) /
+                                            span;
+}
+
+float sensor_calibration_apply(uint32_t sensor, uint8_t quantity, float value)
+{
+  // Only the sampler changes the table: no lock to read it
+  int index = calibrationCount > 0 ? find(sensor, quantity) : -1;
+
+  if (index < 0 || isnan(value))
+  {
+    return value;
+  }
+
+  const SensorCalibration &calibration = calibrations[index];
+
+  if (calibration.points >= 2)
+  {
+    value = interpolate(calibration, value);
+  }
+
+  return calibration.gain * value + calibration.offset;
+}
+
+void sensor_calibration_set_version(uint32_t version)
+{
+  calibrationVersion = version;
+}
+
+uint32_t sensor_calibration_version()
+{
+  return calibrationVersion;
+}
+
+void sensor_calibration_report(uint32_t sensor, JsonObject object)
+{
+  SensorCalibration copies[SENSOR_CALIBRATION_MAX];
+  int count = 0;
+
+  portENTER_CRITICAL(&calibrationLock);
+
+  for (int i = 0; i < calibrationCount; i++)
+  {
+    if (calibrations[i].sensor == sensor)
+    {
+      copies[count++] = calibrations[i];
+    }
+  }
+
+  portEXIT_CRITICAL(&calibrationLock);
+
+  for (int i = 0; i < count; i++)
+  {
+    JsonObject calibration = object.createNestedObject(sensor_quantity_name(copies[i].quantity));
+
+    calibration["offset"] = copies[i].offset;
+    calibration["gain"] = copies[i].gain;
+    calibration["points"] = copies[i].points;
+  }
+}
@@ -0,0 +1,208 @@
+/**
+ * This sensor_capture.cpp implements the high-rate capture of a sensor in a
+ * RAM buffer and its encoder in chunks.
+ *
+ * MIT License
+ *
+ * ESP32 MQTT - Samples code
+ * Copyright (c) 2021 Antonio Musarra's Blog - https://www.dontesta.it
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in the
+ * Software without restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the
+ * Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <Arduino.h>
+#include <math.h>
+#include "sensor_capture.h"
+#include "timer_wheel.h"
+#include "timestamp.h"
+
+static SensorCaptureSample samples[SENSOR_CAPTURE_SAMPLES];
+
+/**
+ * The buffer is written by the sampler while the capture is running and
+ * read by the publisher when it's ready: the state is the handover
+ */
+static volatile SensorCaptureState state = Capture_Idle;
+static uint32_t count = 0;
+
+static int captureChannel = 0;
+static uint32_t capturePeriod = 0;
+static uint32_t savedPeriod = 0;
+static uint32_t startMs = 0;
+static int64_t startEpochMs = 0;
+static uint8_t valueCount = 0;
+static uint8_t quantities[SENSOR_CAPTURE_VALUES];
+static TimerId endTimer = TIMER_INVALID;
+static void (*readyCallback)() = NULL;
+
+/**
+ * End of the capture: the period of the channel is restored and the
+ * capture is handed over to the publisher
+ */
+static void finish()
+{
+  timer_cancel(endTimer);
+  endTimer = TIMER_INVALID;
+
+  sensor_set_hook(captureChannel, NULL, NULL);
+  sensor_set_period(captureChannel, savedPeriod);
+
+  __sync_synchronize();
+  state = Capture_Ready;
+
+  if (readyCallback != NULL)
+  {
+    readyCallback();
+  }
+}
+
+static void on_end_timer(void *arg, uint32_t scheduledMs)
+{
+  endTimer = TIMER_INVALID;
+
+  if (state == Capture_Running)
+  {
+    finish();
+  }
+}
+
+static void on_sample(void *arg, uint8_t channel, uint32_t scheduledMs,
+                      const SensorReading *readings, uint8_t readingCount)
+{
+  if (state != Capture_Running || count == SENSOR_CAPTURE_SAMPLES)
+  {
+    return;
+  }
+
+  // The quantities are the ones of the first sample
+  if (count == 0)
+  {
+    valueCount = readingCount < SENSOR_CAPTURE_VALUES ? readingCount : SENSOR_CAPTURE_VALUES;
+
+    for (uint8_t i = 0; i < valueCount; i++)
+    {
+      quantities[i] = readings[i].quantity;
+    }
+  }
+
+  SensorCaptureSample &sample = samples[count];
+
+  sample.offset = scheduledMs - startMs;
+
+  for (uint8_t i = 0; i < valueCount; i++)
+  {
+    sample.values[i] = i < readingCount ? readings[i].value : NAN;
+  }
+
+  if (++count == SENSOR_CAPTURE_SAMPLES)
+  {
+    finish();
+  }
+}
+
+bool sensor_capture_start(int channel, uint32_t periodMs, uint32_t durationMs,
+                          void (*ready)())
+{
+  if (state != Capture_Idle || channel < 0 || channel >= sensor_count())
+  {
+    return false;
+  }
+
+  uint32_t minPeriod = sensor_driver(channel)->min_period();
+
+  if (minPeriod < SENSOR_CAPTURE_PERIOD_MIN)
+  {
+    minPeriod = SENSOR_CAPTURE_PERIOD_MIN;
+  }
+
+  captureChannel = channel;
+  capturePeriod = periodMs > minPeriod ? periodMs : minPeriod;
+  savedPeriod = sensor_period(channel);
+  startMs = millis();
+  startEpochMs = timestamp_now_ms();
+  valueCount = 0;
+  count = 0;
+  readyCallback = ready;
+  state = Capture_Running;
+
+  if (durationMs > SENSOR_CAPTURE_DURATION_MAX)
+  {
+    durationMs = SENSOR_CAPTURE_DURATION_MAX;
+  }
+
+  sensor_set_hook(channel, on_sample, NULL);
+  sensor_set_period(channel, capturePeriod);
+  endTimer = timer_start(durationMs, 0, on_end_timer, NULL);
+
+  return true;
+}
+
+SensorCaptureState sensor_capture_state()
+{
+  return state;
+}
+
+uint32_t sensor_capture_count()
+{
+  return count;
+}
+
+uint16_t sensor_capture_chunks()
+{
+  return (count + SENSOR_CAPTURE_CHUNK_SAMPLES - 1) / SENSOR_CAPTURE_CHUNK_SAMPLES;
+}
+
+void sensor_capture_encode(uint16_t index, JsonDocument &message)
+{
+  uint32_t first = (uint32_t)index * SENSOR_CAPTURE_CHUNK_SAMPLES;
+  uint32_t last = first + SENSOR_CAPTURE_CHUNK_SAMPLES < count
+                      ? first + SENSOR_CAPTURE_CHUNK_SAMPLES
+                      : count;
+
+  message["sensor"] = sensor_driver(captureChannel)->name();
+  message["channel"] = captureChannel;
+  message["start"] = startEpochMs;
+  message["period"] = capturePeriod;
+  message["chunk"] = index;
+  message["chunks"] = sensor_capture_chunks();
+
+  JsonArray names = message.createNestedArray("quantities");
+
+  for (uint8_t i = 0; i < valueCount; i++)
+  {
+    names.add(sensor_quantity_name(quantities[i]));
+  }
+
+  JsonArray rows = message.createNestedArray("samples");
+
+  for (uint32_t i = first; i < last; i++)
+  {
+    JsonArray row = rows.createNestedArray();
+
+    row.add(samples[i].offset);
+
+    // Two decimals (the float digits beyond them are noise of the sensor)
+    for (uint8_t j = 0; j < valueCount; j++)
+    {
+      row.add(round(samples[i].values[j] * 100.0) / 100.0);
+    }
+  }
+}
+
+void sensor_capture_release()
+{
+  state = Capture_Idle;
+}
@@ -0,0 +1,53 @@
+/**
+ * This sensor_simulated.cpp implements the simulated sensor driver, for the tests
+ * of the sampling and encode pipeline without hardware.
+ *
+ * MIT License
+ *
+ * ESP32 MQTT - Samples code
+ * Copyright (c) 2021 Antonio Musarra's Blog - https://www.dontesta.it
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in the
+ * Software without restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the
+ * Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <Arduino.h>
+#include <esp_timer.h>
+#include <math.h>
+#include "sensor_simulated.h"
+
+void SimulatedSensor::read(SensorCallback callback, void *arg)
+{
+  // Xorshift32 noise in [-1, 1]
+  noiseState ^= noiseState << 13;
+  noiseState ^= noiseState >> 17;
+  noiseState ^= noiseState << 5;
+
+  float noise = (float)noiseState / (float)UINT32_MAX * 2.0F - 1.0F;
+  float phase = (float)((esp_timer_get_time() / 1000) % wavePeriodMs) / wavePeriodMs;
+
+  SensorReading reading = {
+      (uint8_t)quantity,
+      base + amplitude * sinf(2.0F * (float)M_PI * phase) + amplitude * 0.01F * noise};
+
+  reads++;
+
+  callback(arg, true, &reading, 1);
+}
+
+void SimulatedSensor::report(JsonObject object)
+{
+  object["reads"] = reads;
+}
@@ -0,0 +1,235 @@
+/**
+ * This task_metrics.cpp implements the instrumentation of the FreeRTOS tasks
+ * of the firmware.
+ *
+ * MIT License
+ *
+ * ESP32 MQTT - Samples code
+ * Copyright (c) 2021 Antonio Musarra's Blog - https://www.dontesta.it
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in the
+ * Software without restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the
+ * Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <Arduino.h>
+#include <esp_freertos_hooks.h>
+#include <esp_timer.h>
+#include "task_metrics.h"
+
+struct TaskMetrics
+{
+  TaskHandle_t handle;
+
+  // Begin of the current work (µs) and total busy time (µs)
+  int64_t workBegin;
+  uint64_t busyUs;
+
+  // Events and worst-case latency (µs) in the report window
+  uint32_t events;
+  uint32_t maxLatencyUs;
+
+  // Busy time (µs) at the begin of the report window
+  uint64_t reportedBusyUs;
+};
+
+static const char *taskNames[Task_Count] = {"mqtt", "sampler", "command", "logger"};
+
+static TaskMetrics metrics[Task_Count];
+static int64_t reportedAt = 0;
+
+// The metrics are written by every task and read by the reporter
+static portMUX_TYPE metricsMux = portMUX_INITIALIZER_UNLOCKED;
+
+/**
+ * Idle time of the cores. The idle hook runs at every loop of the idle
+ * task, that waits for the next interrupt (at least the tick) between two
+ * loops: a gap up to two ticks between two calls is idle time, a longer gap
+ * means that a task has run, or that the core has slept with the tick
+ * suppressed (tickless idle and automatic light sleep).
+ *
+ * The time slept is measured by the ticks: the tick hook runs at every tick
+ * interrupt of the core, none while the tick is suppressed, and the tick
+ * count is stepped at the wake up. In a long gap, the ticks counted but not
+ * seen by the tick hook of the core have been slept, and are idle time (at
+ * most the gap, so the time a task runs after the wake up is not counted).
+ */
+#define IDLE_GAP_MAX_US (2 * portTICK_PERIOD_MS * 1000)
+
+// Idle time in µs (32 bits, read without locks; the deltas survive the wrap)
+static int64_t idleHookAt[2];
+static volatile uint32_t idleUs[2];
+static uint32_t reportedIdleUs[2];
+
+// Tick interrupts of the cores, tick count and tick interrupts at the last
+// idle hook
+static volatile uint32_t tickHooks[2];
+static TickType_t idleTickCount[2];
+static uint32_t idleTickHooks[2];
+
+static inline void idle_hook_account(int core)
+{
+  int64_t now = esp_timer_get_time();
+  int64_t gap = now - idleHookAt[core];
+  TickType_t ticks = xTaskGetTickCount();
+  uint32_t hooks = tickHooks[core];
+
+  if (gap < IDLE_GAP_MAX_US)
+  {
+    idleUs[core] += gap;
+  }
+  else
+  {
+    uint32_t elapsed = ticks - idleTickCount[core];
+    uint32_t seen = hooks - idleTickHooks[core];
+
+    if (elapsed > seen)
+    {
+      int64_t sleptUs = (int64_t)(elapsed - seen) * portTICK_PERIOD_MS * 1000;
+
+      idleUs[core] += sleptUs < gap ? sleptUs : gap;
+    }
+  }
+
+  idleHookAt[core] = now;
+  idleTickCount[core] = ticks;
+  idleTickHooks[core] = hooks;
+}
+
+static bool idle_hook_core_0()
+{
+  idle_hook_account(0);
+  return true;
+}
+
+static bool idle_hook_core_1()
+{
+  idle_hook_account(1);
+  return true;
+}
+
+static void IRAM_ATTR tick_hook_core_0()
+{
+  tickHooks[0]++;
+}
+
+static void IRAM_ATTR tick_hook_core_1()
+{
+  tickHooks[1]++;
+}
+
+void task_metrics_begin()
+{
+  esp_register_freertos_tick_hook_for_cpu(tick_hook_core_0, 0);
+  esp_register_freertos_tick_hook_for_cpu(tick_hook_core_1, 1);
+  esp_register_freertos_idle_hook_for_cpu(idle_hook_core_0, 0);
+  esp_register_freertos_idle_hook_for_cpu(idle_hook_core_1, 1);
+}
+
+void task_metrics_register(TaskId taskId, TaskHandle_t handle)
+{
+  metrics[taskId].handle = handle;
+}
+
+TaskId task_metrics_current()
+{
+  TaskHandle_t current = xTaskGetCurrentTaskHandle();
+
+  for (int i = 0; i < Task_Count; i++)
+  {
+    if (metrics[i].handle == current)
+    {
+      return (TaskId)i;
+    }
+  }
+
+  return Task_Count;
+}
+
+void task_metrics_work_begin(TaskId taskId)
+{
+  metrics[taskId].workBegin = esp_timer_get_time();
+}
+
+void task_metrics_work_end(TaskId taskId)
+{
+  int64_t busyUs = esp_timer_get_time() - metrics[taskId].workBegin;
+
+  portENTER_CRITICAL(&metricsMux);
+  metrics[taskId].busyUs += busyUs;
+  portEXIT_CRITICAL(&metricsMux);
+}
+
+void task_metrics_latency(TaskId taskId, uint32_t latencyUs)
+{
+  portENTER_CRITICAL(&metricsMux);
+
+  metrics[taskId].events++;
+
+  if (latencyUs > metrics[taskId].maxLatencyUs)
+  {
+    metrics[taskId].maxLatencyUs = latencyUs;
+  }
+
+  portEXIT_CRITICAL(&metricsMux);
+}
+
+void task_metrics_report(JsonDocument &message)
+{
+  int64_t now = esp_timer_get_time();
+  int64_t windowUs = max(now - reportedAt, (int64_t)1);
+
+  JsonArray tasks = message.createNestedArray("tasks");
+
+  for (int i = 0; i < Task_Count; i++)
+  {
+    TaskMetrics &task = metrics[i];
+
+    portENTER_CRITICAL(&metricsMux);
+
+    uint64_t busyUs = task.busyUs - task.reportedBusyUs;
+    uint32_t events = task.events;
+    uint32_t maxLatencyUs = task.maxLatencyUs;
+
+    task.reportedBusyUs = task.busyUs;
+    task.events = 0;
+    task.maxLatencyUs = 0;
+
+    portEXIT_CRITICAL(&metricsMux);
+
+    JsonObject taskMetrics = tasks.createNestedObject();
+
+    taskMetrics["name"] = taskNames[i];
+    taskMetrics["cpu"] = (float)busyUs * 100.0f / windowUs;
+    taskMetrics["events"] = events;
+    taskMetrics["maxLatency"] = maxLatencyUs;
+
+    if (task.handle != NULL)
+    {
+      taskMetrics["stackFree"] = uxTaskGetStackHighWaterMark(task.handle);
+    }
+  }
+
+  JsonArray idle = message.createNestedArray("idle");
+
+  for (int core = 0; core < 2; core++)
+  {
+    uint32_t coreIdleUs = idleUs[core];
+
+    idle.add((float)(uint32_t)(coreIdleUs - reportedIdleUs[core]) * 100.0f / windowUs);
+    reportedIdleUs[core] = coreIdleUs;
+  }
+
+  reportedAt = now;
+}
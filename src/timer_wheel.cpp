@@ -0,0 +1,473 @@
+/**
+ * This timer_wheel.cpp implements the hierarchical timer wheel with a fixed
+ * pool of timers.
+ *
+ * MIT License
+ *
+ * ESP32 MQTT - Samples code
+ * Copyright (c) 2021 Antonio Musarra's Blog - https://www.dontesta.it
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in the
+ * Software without restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the
+ * Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <Arduino.h>
+#include "timer_wheel.h"
+
+// Bits of the slots of the first level and of the other levels
+#define WHEEL_L0_BITS 8
+#define WHEEL_LN_BITS 6
+#define WHEEL_LEVELS 4
+
+#define WHEEL_L0_SIZE (1 << WHEEL_L0_BITS)
+#define WHEEL_LN_SIZE (1 << WHEEL_LN_BITS)
+#define WHEEL_SLOTS (WHEEL_L0_SIZE + (WHEEL_LEVELS - 1) * WHEEL_LN_SIZE)
+
+// Max delay the levels can hold (longer delays are cascaded again)
+#define WHEEL_MAX_DELAY ((1UL << (WHEEL_L0_BITS + (WHEEL_LEVELS - 1) * WHEEL_LN_BITS)) - 1)
+
+// Index of a timer in the pool (the links of the lists)
+typedef int16_t TimerIndex;
+
+#define INDEX_NONE ((TimerIndex)-1)
+
+// Bits of the generation in the id (the id stays positive)
+#define GENERATION_MASK 0x7FFF
+
+#if TIMER_WHEEL_POOL_SIZE > 32767
+#error "TIMER_WHEEL_POOL_SIZE doesn't fit the index of a TimerId"
+#endif
+
+struct Timer
+{
+  uint32_t expires;
+  uint32_t period;
+  TimerCallback callback;
+  void *arg;
+
+  // Links of the list of the slot (or of the free list)
+  TimerIndex next;
+  TimerIndex prev;
+  int16_t slot;
+  bool active;
+
+  // Incremented at every return to the pool (the high bits of the id)
+  uint16_t generation;
+};
+
+static Timer timers[TIMER_WHEEL_POOL_SIZE];
+static TimerIndex slots[WHEEL_SLOTS];
+static TimerIndex freeList;
+
+// Occupancy of the slots of the first level (to skip the empty ones)
+static uint32_t level0Bitmap[WHEEL_L0_SIZE / 32];
+
+static uint32_t wheelNow;
+static TaskHandle_t ownerTask;
+
+// The wheel is advanced by the owner and the timers started by any task
+static portMUX_TYPE wheelMux = portMUX_INITIALIZER_UNLOCKED;
+
+/**
+ * Return the slot of an expiry time (the caller holds the lock)
+ */
+static int slot_of(uint32_t expires)
+{
+  uint32_t delay = expires - wheelNow;
+
+  if ((int32_t)delay < 0)
+  {
+    // Already expired: run it at the next tick
+    return wheelNow & (WHEEL_L0_SIZE - 1);
+  }
+
+  if (delay < WHEEL_L0_SIZE)
+  {
+    return expires & (WHEEL_L0_SIZE - 1);
+  }
+
+  if (delay > WHEEL_MAX_DELAY)
+  {
+    // Parked in the last level, it's cascaded again until it fits
+    expires = wheelNow + WHEEL_MAX_DELAY;
+  }
+
+  for (int level = 1; level < WHEEL_LEVELS; level++)
+  {
+    int shift = WHEEL_L0_BITS + level * WHEEL_LN_BITS;
+
+    if (delay < (1UL << shift) || level == WHEEL_LEVELS - 1)
+    {
+      int index = (expires >> (shift - WHEEL_LN_BITS)) & (WHEEL_LN_SIZE - 1);
+
+      return WHEEL_L0_SIZE + (level - 1) * WHEEL_LN_SIZE + index;
+    }
+  }
+
+  return 0;
+}
+
+/**
+ * Link the timer to the slot of its expiry (the caller holds the lock)
+ */
+static void link_timer(TimerIndex timerIndex)
+{
+  Timer &timer = timers[timerIndex];
+  int slot = slot_of(timer.expires);
+
+  timer.slot = slot;
+  timer.prev = INDEX_NONE;
+  timer.next = slots[slot];
+
+  if (slots[slot] != INDEX_NONE)
+  {
+    timers[slots[slot]].prev = timerIndex;
+  }
+
+  slots[slot] = timerIndex;
+
+  if (slot < WHEEL_L0_SIZE)
+  {
+    level0Bitmap[slot >> 5] |= 1UL << (slot & 31);
+  }
+}
+
+/**
+ * Unlink the timer from its slot (the caller holds the lock)
+ */
+static void unlink_timer(TimerIndex timerIndex)
+{
+  Timer &timer = timers[timerIndex];
+
+  if (timer.prev != INDEX_NONE)
+  {
+    timers[timer.prev].next = timer.next;
+  }
+  else
+  {
+    slots[timer.slot] = timer.next;
+  }
+
+  if (timer.next != INDEX_NONE)
+  {
+    timers[timer.next].prev = timer.prev;
+  }
+
+  if (timer.slot < WHEEL_L0_SIZE && slots[timer.slot] == INDEX_NONE)
+  {
+    level0Bitmap[timer.slot >> 5] &= ~(1UL << (timer.slot & 31));
+  }
+}
+
+/**
+ * Return the timer to the pool, invalidating its id (the caller holds the
+ * lock)
+ */
+static void release_timer(TimerIndex timerIndex)
+{
+  Timer &timer = timers[timerIndex];
+
+  timer.active = false;
+  timer.generation = (timer.generation + 1) & GENERATION_MASK;
+  timer.next = freeList;
+  freeList = timerIndex;
+}
+
+/**
+ * Move the timers of a slot of an upper level to the lower levels
+ * (the caller holds the lock)
+ */
+static void cascade(int level, int index)
+{
+  int slot = WHEEL_L0_SIZE + (level - 1) * WHEEL_LN_SIZE + index;
+  TimerIndex timerIndex = slots[slot];
+
+  slots[slot] = INDEX_NONE;
+
+  while (timerIndex != INDEX_NONE)
+  {
+    TimerIndex next = timers[timerIndex].next;
+
+    link_timer(timerIndex);
+    timerIndex = next;
+  }
+}
+
+/**
+ * Return the first occupied slot of the first level from index (or
+ * WHEEL_L0_SIZE if none)
+ */
+static int next_level0_slot(int index)
+{
+  while (index < WHEEL_L0_SIZE)
+  {
+    uint32_t word = level0Bitmap[index >> 5] >> (index & 31);
+
+    if (word != 0)
+    {
+      return index + __builtin_ctz(word);
+    }
+
+    index = (index | 31) + 1;
+  }
+
+  return WHEEL_L0_SIZE;
+}
+
+void timer_wheel_begin(uint32_t nowMs, TaskHandle_t owner)
+{
+  portENTER_CRITICAL(&wheelMux);
+
+  for (int i = 0; i < WHEEL_SLOTS; i++)
+  {
+    slots[i] = INDEX_NONE;
+  }
+
+  for (int i = 0; i < TIMER_WHEEL_POOL_SIZE; i++)
+  {
+    timers[i].active = false;
+    timers[i].next = i + 1 < TIMER_WHEEL_POOL_SIZE ? i + 1 : INDEX_NONE;
+  }
+
+  memset(level0Bitmap, 0, sizeof(level0Bitmap));
+
+  freeList = 0;
+  wheelNow = nowMs;
+  ownerTask = owner;
+
+  portEXIT_CRITICAL(&wheelMux);
+}
+
+TimerId timer_start_at(uint32_t atMs, uint32_t periodMs, TimerCallback callback,
+                       void *arg)
+{
+  TimerId timerId = TIMER_INVALID;
+
+  portENTER_CRITICAL(&wheelMux);
+
+  TimerIndex timerIndex = freeList;
+
+  if (timerIndex != INDEX_NONE)
+  {
+    Timer &timer = timers[timerIndex];
+
+    freeList = timer.next;
+
+    timer.expires = atMs;
+    timer.period = periodMs;
+    timer.callback = callback;
+    timer.arg = arg;
+    timer.active = true;
+
+    link_timer(timerIndex);
+    timerId = ((TimerId)timer.generation << 16) | timerIndex;
+  }
+
+  portEXIT_CRITICAL(&wheelMux);
+
+  // Let the owner recompute its sleep
+  if (timerId != TIMER_INVALID && ownerTask != NULL &&
+      xTaskGetCurrentTaskHandle() != ownerTask)
+  {
+    xTaskNotifyGive(ownerTask);
+  }
+
+  return timerId;
+}
+
+TimerId timer_start(uint32_t delayMs, uint32_t periodMs, TimerCallback callback,
+                    void *arg)
+{
+  return timer_start_at(millis() + delayMs, periodMs, callback, arg);
+}
+
+bool timer_cancel(TimerId timerId)
+{
+  if (timerId < 0 || (timerId & 0xFFFF) >= TIMER_WHEEL_POOL_SIZE)
+  {
+    return false;
+  }
+
+  TimerIndex timerIndex = timerId & 0xFFFF;
+  uint16_t generation = timerId >> 16;
+
+  bool cancelled = false;
+
+  portENTER_CRITICAL(&wheelMux);
+
+  Timer &timer = timers[timerIndex];
+
+  // A stale id (the timer expired or was cancelled and its entry reused)
+  // doesn't match the generation of the entry
+  if (timer.active && timer.generation == generation)
+  {
+    // A timer running its callback is not linked to any slot
+    if (timer.slot >= 0)
+    {
+      unlink_timer(timerIndex);
+    }
+
+    release_timer(timerIndex);
+    cancelled = true;
+  }
+
+  portEXIT_CRITICAL(&wheelMux);
+
+  return cancelled;
+}
+
+void timer_wheel_advance(uint32_t nowMs)
+{
+  portENTER_CRITICAL(&wheelMux);
+
+  while ((int32_t)(nowMs - wheelNow) >= 0)
+  {
+    int index = wheelNow & (WHEEL_L0_SIZE - 1);
+
+    // At the begin of a lap of a level, cascade the next slot of the upper
+    // one: from the top, so the cascaded timers reach the lower slots in time
+    if (index == 0)
+    {
+      int top = 1;
+
+      while (top < WHEEL_LEVELS - 1 &&
+             ((wheelNow >> (WHEEL_L0_BITS + (top - 1) * WHEEL_LN_BITS)) &
+              (WHEEL_LN_SIZE - 1)) == 0)
+      {
+        top++;
+      }
+
+      for (int level = top; level >= 1; level--)
+      {
+        int shift = WHEEL_L0_BITS + (level - 1) * WHEEL_LN_BITS;
+
+        cascade(level, (wheelNow >> shift) & (WHEEL_LN_SIZE - 1));
+      }
+    }
+
+    // Run the timers of the slot, the lock is released during the callbacks
+    TimerIndex timerIndex;
+
+    while ((timerIndex = slots[index]) != INDEX_NONE)
+    {
+      Timer &timer = timers[timerIndex];
+
+      unlink_timer(timerIndex);
+      timer.slot = -1;
+
+      // Still parked for a later lap (delay longer than the wheel)
+      if ((int32_t)(timer.expires - wheelNow) > 0)
+      {
+        link_timer(timerIndex);
+        continue;
+      }
+
+      uint32_t scheduled = timer.expires;
+      uint16_t generation = timer.generation;
+      TimerCallback callback = timer.callback;
+      void *arg = timer.arg;
+
+      portEXIT_CRITICAL(&wheelMux);
+      callback(arg, scheduled);
+      portENTER_CRITICAL(&wheelMux);
+
+      // Cancelled (or cancelled and reused) by the callback
+      if (!timer.active || timer.generation != generation)
+      {
+        continue;
+      }
+
+      if (timer.period > 0)
+      {
+        // Next multiple of the period, skipping the missed expiries
+        do
+        {
+          timer.expires += timer.period;
+        } while ((int32_t)(timer.expires - wheelNow) <= 0);
+
+        link_timer(timerIndex);
+      }
+      else
+      {
+        release_timer(timerIndex);
+      }
+    }
+
+    // Jump to the next occupied slot of the lap (or to the end of the lap)
+    int next = next_level0_slot(index + 1);
+    uint32_t target = wheelNow - index + next;
+
+    wheelNow = (int32_t)(target - (nowMs + 1)) > 0 ? nowMs + 1 : target;
+  }
+
+  portEXIT_CRITICAL(&wheelMux);
+}
+
+uint32_t timer_wheel_sleep_ms(uint32_t nowMs)
+{
+  bool pending = false;
+  uint32_t wakeAt = 0;
+
+  portENTER_CRITICAL(&wheelMux);
+
+  int index = wheelNow & (WHEEL_L0_SIZE - 1);
+  uint32_t lapStart = wheelNow - index;
+
+  // First occupied slot of the first level, in this lap or in the next one
+  int next = next_level0_slot(index);
+
+  if (next < WHEEL_L0_SIZE)
+  {
+    pending = true;
+    wakeAt = lapStart + next;
+  }
+  else if ((next = next_level0_slot(0)) < index)
+  {
+    pending = true;
+    wakeAt = lapStart + WHEEL_L0_SIZE + next;
+  }
+
+  // The upper levels are cascaded at the begin of a lap (the current one,
+  // if the wheel is still at its first slot)
+  uint32_t cascadeAt = index == 0 ? wheelNow : lapStart + WHEEL_L0_SIZE;
+
+  if (!pending || (int32_t)(cascadeAt - wakeAt) < 0)
+  {
+    for (int slot = WHEEL_L0_SIZE; slot < WHEEL_SLOTS; slot++)
+    {
+      if (slots[slot] != INDEX_NONE)
+      {
+        pending = true;
+        wakeAt = cascadeAt;
+        break;
+      }
+    }
+  }
+
+  portEXIT_CRITICAL(&wheelMux);
+
+  if (!pending)
+  {
+    return UINT32_MAX;
+  }
+
+  // Already expired
+  if ((int32_t)(wakeAt - nowMs) < 0)
+  {
+    return 0;
+  }
+
+  return wakeAt - nowMs;
+}
@@ -0,0 +1,191 @@
+/**
+ * This timestamp.cpp implements the timestamp service that combines the last
+ * NTP sync with the microsecond monotonic counter.
+ *
+ * MIT License
+ *
+ * ESP32 MQTT - Samples code
+ * Copyright (c) 2021 Antonio Musarra's Blog - https://www.dontesta.it
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in the
+ * Software without restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the
+ * Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <Arduino.h>
+#include <esp_sntp.h>
+#include <esp_timer.h>
+#include "timestamp.h"
+
+// Interval in ms between two NTP syncs
+#ifndef TIMESTAMP_SYNC_INTERVAL_MS
+#define TIMESTAMP_SYNC_INTERVAL_MS 900000
+#endif
+
+// Min interval in µs between two syncs to estimate the drift
+#define TIMESTAMP_DRIFT_MIN_INTERVAL_US 60000000LL
+
+// Max drift in ppb accepted (a crystal out of this range means a time step)
+#define TIMESTAMP_DRIFT_MAX_PPB 500000LL
+
+// The anchor is written by the SNTP task and read by every publisher
+static portMUX_TYPE timestampMux = portMUX_INITIALIZER_UNLOCKED;
+
+static bool synced = false;
+static bool driftEstimated = false;
+static int64_t anchorEpochUs = 0;
+static int64_t anchorMonotonicUs = 0;
+static int32_t driftPpb = 0;
+
+/**
+ * Extrapolate the epoch time from the anchor (the caller holds the lock)
+ */
+static int64_t extrapolate_us(int64_t monotonicUs)
+{
+  int64_t elapsedUs = monotonicUs - anchorMonotonicUs;
+
+  return anchorEpochUs + elapsedUs + elapsedUs * driftPpb / 1000000000LL;
+}
+
+/**
+ * SNTP sync notification
+ */
+static void on_sntp_sync(struct timeval *tv)
+{
+  timestamp_on_sync((int64_t)tv->tv_sec * 1000000LL + tv->tv_usec);
+}
+
+void timestamp_begin(const char *ntpServer)
+{
+  sntp_set_time_sync_notification_cb(on_sntp_sync);
+  sntp_set_sync_interval(TIMESTAMP_SYNC_INTERVAL_MS);
+
+  // The time is always in UTC
+  configTime(0, 0, ntpServer);
+}
+
+bool timestamp_wait_sync(uint32_t timeoutMs)
+{
+  unsigned long start = millis();
+
+  while (timestamp_sync_age_ms() < 0)
+  {
+    if (millis() - start >= timeoutMs)
+    {
+      return false;
+    }
+
+    delay(100);
+  }
+
+  return true;
+}
+
+void timestamp_on_sync(int64_t epochUs)
+{
+  int64_t monotonicUs = esp_timer_get_time();
+
+  portENTER_CRITICAL(&timestampMux);
+
+  int64_t intervalUs = monotonicUs - anchorMonotonicUs;
+
+  if (synced && intervalUs >= TIMESTAMP_DRIFT_MIN_INTERVAL_US)
+  {
+    // Drift of the monotonic counter against NTP over the last interval
+    int64_t sample = (epochUs - anchorEpochUs - intervalUs) * 1000000000LL / intervalUs;
+
+    if (sample > -TIMESTAMP_DRIFT_MAX_PPB && sample < TIMESTAMP_DRIFT_MAX_PPB)
+    {
+      driftPpb = driftEstimated ? (int32_t)((3 * (int64_t)driftPpb + sample) / 4)
+                                : (int32_t)sample;
+      driftEstimated = true;
+    }
+  }
+
+  anchorEpochUs = epochUs;
+  anchorMonotonicUs = monotonicUs;
+  synced = true;
+
+  portEXIT_CRITICAL(&timestampMux);
+}
+
+int64_t timestamp_now_us()
+{
+  int64_t monotonicUs = esp_timer_get_time();
+  int64_t nowUs = 0;
+
+  portENTER_CRITICAL(&timestampMux);
+
+  if (synced)
+  {
+    nowUs = extrapolate_us(monotonicUs);
+  }
+
+  portEXIT_CRITICAL(&timestampMux);
+
+  return nowUs;
+}
+
+int64_t timestamp_now_ms()
+{
+  return timestamp_now_us() / 1000;
+}
+
+int64_t timestamp_from_monotonic_ms(int64_t monotonicUs)
+{
+  int64_t epochUs = 0;
+
+  portENTER_CRITICAL(&timestampMux);
+
+  if (synced)
+  {
+    epochUs = extrapolate_us(monotonicUs);
+  }
+
+  portEXIT_CRITICAL(&timestampMux);
+
+  return epochUs / 1000;
+}
+
+int32_t timestamp_sync_age_ms()
+{
+  int64_t monotonicUs = esp_timer_get_time();
+  int32_t ageMs = -1;
+
+  portENTER_CRITICAL(&timestampMux);
+
+  if (synced)
+  {
+    ageMs = (int32_t)((monotonicUs - anchorMonotonicUs) / 1000);
+  }
+
+  portEXIT_CRITICAL(&timestampMux);
+
+  return ageMs;
+}
+
+int32_t timestamp_drift_ppb()
+{
+  return driftPpb;
+}
+
+void timestamp_stamp(JsonDocument &message)
+{
+  int64_t nowMs = timestamp_now_ms();
+
+  message["time"] = (unsigned long)(nowMs / 1000);
+  message["timeMs"] = nowMs;
+  message["timeSyncAge"] = timestamp_sync_age_ms();
+  message["timeDrift"] = driftPpb / 1000.0f;
+}
@@ -0,0 +1,235 @@
+/**
+ * This trace.cpp implements the binary trace of the hot-path events in a
+ * RAM ring.
+ *
+ * MIT License
+ *
+ * ESP32 MQTT - Samples code
+ * Copyright (c) 2021 Antonio Musarra's Blog - https://www.dontesta.it
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in the
+ * Software without restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the
+ * Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <Arduino.h>
+#include <atomic>
+#include <esp_ipc.h>
+#include <esp_pm.h>
+#include <esp_timer.h>
+#include <xtensa/hal.h>
+#include "task_metrics.h"
+#include "trace.h"
+
+static_assert((TRACE_RING_SIZE & (TRACE_RING_SIZE - 1)) == 0,
+              "TRACE_RING_SIZE must be a power of two");
+static_assert(sizeof(TraceRecord) == 16, "TraceRecord must be 16 bytes");
+
+volatile bool traceRunning = false;
+
+static TraceRecord records[TRACE_RING_SIZE];
+static std::atomic<uint32_t> head(0);
+
+// Sync records of the two cores (kept out of the ring, never overwritten)
+static TraceRecord syncRecords[2];
+static uint32_t syncCount = 0;
+
+static uint16_t cpuMhz = 0;
+
+/**
+ * A sync record is written in the ring before an event when the last sync
+ * of the core is older than one second: the decoder anchors every record to
+ * a near sync, so the wrap of the cycle counter (17.9 s at 240 MHz) and the
+ * overwrite of the oldest records don't matter.
+ *
+ * The age is checked on the cycle counter and on the esp_timer time: after
+ * an idle gap close to a multiple of the wrap of the counter, the cycles
+ * alone would look recent.
+ */
+#define TRACE_SYNC_PERIOD_US 1000000
+
+static uint32_t syncPeriodCycles = 0;
+static uint32_t syncCycles[2];
+static int64_t syncTimes[2];
+
+#if CONFIG_PM_ENABLE
+// No frequency scaling and no light sleep while tracing
+static esp_pm_lock_handle_t frequencyLock = NULL;
+static esp_pm_lock_handle_t sleepLock = NULL;
+#endif
+
+/**
+ * Fill a record with the cycle counter of the core and the running task
+ */
+static inline void trace_fill(TraceRecord &record, uint16_t event, uint32_t arg0,
+                              uint32_t arg1)
+{
+  record.cycles = xthal_get_ccount();
+  record.event = event;
+  record.core = xPortGetCoreID();
+  record.task = task_metrics_current();
+  record.arg0 = arg0;
+  record.arg1 = arg1;
+}
+
+/**
+ * Fill the sync record of the core running it: cycle counter and esp_timer
+ * time (µs) read together, kept as the last sync of the core
+ */
+static inline void trace_fill_sync(TraceRecord &record, int64_t now)
+{
+  trace_fill(record, Trace_Sync, (uint32_t)now, (uint32_t)(now >> 32));
+
+  syncCycles[record.core] = record.cycles;
+  syncTimes[record.core] = now;
+}
+
+void trace_write(uint16_t event, uint32_t arg0, uint32_t arg1)
+{
+  int core = xPortGetCoreID();
+  int64_t now = esp_timer_get_time();
+
+  if (xthal_get_ccount() - syncCycles[core] > syncPeriodCycles ||
+      now - syncTimes[core] > TRACE_SYNC_PERIOD_US)
+  {
+    uint32_t index = head.fetch_add(1, std::memory_order_relaxed);
+
+    trace_fill_sync(records[index & (TRACE_RING_SIZE - 1)], now);
+  }
+
+  uint32_t index = head.fetch_add(1, std::memory_order_relaxed);
+
+  trace_fill(records[index & (TRACE_RING_SIZE - 1)], event, arg0, arg1);
+}
+
+/**
+ * Write the first sync record of the core running it
+ */
+static void trace_sync(void *arg)
+{
+  trace_fill_sync(syncRecords[xPortGetCoreID()], esp_timer_get_time());
+}
+
+void trace_start()
+{
+  // A restart releases the locks of the running trace
+  trace_stop();
+
+#if CONFIG_PM_ENABLE
+  if (frequencyLock == NULL)
+  {
+    esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, "trace", &frequencyLock);
+    esp_pm_lock_create(ESP_PM_NO_LIGHT_SLEEP, 0, "trace", &sleepLock);
+  }
+
+  if (frequencyLock != NULL)
+  {
+    esp_pm_lock_acquire(frequencyLock);
+    esp_pm_lock_acquire(sleepLock);
+  }
+#endif
+
+  cpuMhz = ESP.getCpuFreqMHz();
+  syncPeriodCycles = cpuMhz * TRACE_SYNC_PERIOD_US;
+
+  head.store(0, std::memory_order_relaxed);
+
+  trace_sync(NULL);
+  esp_ipc_call_blocking(xPortGetCoreID() == 0 ? 1 : 0, trace_sync, NULL);
+  syncCount = 2;
+
+  traceRunning = true;
+}
+
+void trace_stop()
+{
+  if (!traceRunning)
+  {
+    return;
+  }
+
+  traceRunning = false;
+
+  // Let the writers in progress complete their record
+  vTaskDelay(1);
+
+#if CONFIG_PM_ENABLE
+  if (frequencyLock != NULL)
+  {
+    esp_pm_lock_release(frequencyLock);
+    esp_pm_lock_release(sleepLock);
+  }
+#endif
+}
+
+uint32_t trace_count()
+{
+  uint32_t written = head.load(std::memory_order_relaxed);
+
+  return syncCount + (written < TRACE_RING_SIZE ? written : TRACE_RING_SIZE);
+}
+
+uint32_t trace_read(uint32_t first, TraceRecord *copies, uint32_t max)
+{
+  uint32_t written = head.load(std::memory_order_relaxed);
+  uint32_t oldest = written < TRACE_RING_SIZE ? 0 : written - TRACE_RING_SIZE;
+  uint32_t count = trace_count();
+  uint32_t copied = 0;
+
+  // The sync records come first, then the ring from the oldest record
+  for (uint32_t i = first; i < count && copied < max; i++)
+  {
+    if (i < syncCount)
+    {
+      copies[copied++] = syncRecords[i];
+    }
+    else
+    {
+      copies[copied++] = records[(oldest + i - syncCount) & (TRACE_RING_SIZE - 1)];
+    }
+  }
+
+  return copied;
+}
+
+uint16_t trace_cpu_mhz()
+{
+  return cpuMhz;
+}
+
+void trace_dump_serial(Print &output)
+{
+  uint32_t count = trace_count();
+  char line[40];
+
+  snprintf(line, sizeof(line), "trace %u %u", cpuMhz, count);
+  output.println(line);
+
+  for (uint32_t i = 0; i < count; i++)
+  {
+    TraceRecord record;
+    const uint8_t *bytes = (const uint8_t *)&record;
+
+    trace_read(i, &record, 1);
+
+    for (size_t j = 0; j < sizeof(record); j++)
+    {
+      snprintf(line + j * 2, 3, "%02x", bytes[j]);
+    }
+
+    output.println(line);
+  }
+
+  output.println("trace end");
+}
@@ -0,0 +1,289 @@
+/**
+ * This Arduino.h declares the host stubs of the Arduino core used by the
+ * native tests and by the host check of the sources (tools/host_check.sh).
+ * The clock is the simulated one of host_clock.h.
+ *
+ * MIT License
+ *
+ * ESP32 MQTT - Samples code
+ * Copyright (c) 2021 Antonio Musarra's Blog - https://www.dontesta.it
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in the
+ * Software without restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the
+ * Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef HOST_STUBS_ARDUINO_H
+#define HOST_STUBS_ARDUINO_H
+
+#include <algorithm>
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+
+#include "host_clock.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+
+using std::max;
+using std::min;
+
+typedef uint8_t byte;
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+
+#define BIN 2
+#define OCT 8
+#define DEC 10
+#define HEX 16
+
+#define CR "\n"
+#define IRAM_ATTR
+
+class __FlashStringHelper;
+#define F(string) (reinterpret_cast<const __FlashStringHelper *>(string))
+#define PSTR(string) (string)
+#define pgm_read_byte(address) (*(const uint8_t *)(address))
+
+inline unsigned long millis()
+{
+  return (unsigned long)(host_clock_us / 1000);
+}
+
+inline unsigned long micros()
+{
+  return (unsigned long)host_clock_us;
+}
+
+inline void delay(unsigned long ms)
+{
+  host_clock_advance((int64_t)ms * 1000);
+}
+
+inline void delayMicroseconds(unsigned int us)
+{
+  host_clock_advance(us);
+}
+
+inline void pinMode(int pin, int mode) {}
+inline void digitalWrite(int pin, int value) {}
+inline int digitalRead(int pin) { return LOW; }
+inline long random(long max) { return max > 0 ? rand() % max : 0; }
+
+class String
+{
+public:
+  String() {}
+  String(const char *text) : text(text != NULL ? text : "") {}
+  String(char c) : text(1, c) {}
+  String(int value, int base = DEC) : text(format(value, base)) {}
+  String(unsigned int value, int base = DEC) : text(format(value, base)) {}
+  String(long value, int base = DEC) : text(format(value, base)) {}
+  String(unsigned long value, int base = DEC) : text(format(value, base)) {}
+  String(unsigned long long value, int base = DEC) : text(format(value, base)) {}
+  String(float value, unsigned int decimals = 2) : String((double)value, decimals) {}
+  String(double value, unsigned int decimals = 2)
+  {
+    char buffer[32];
+
+    snprintf(buffer, sizeof(buffer), "%.*f", decimals, value);
+    text = buffer;
+  }
+
+  const char *c_str() const { return text.c_str(); }
+  unsigned int length() const { return text.size(); }
+  bool isEmpty() const { return text.empty(); }
+  void reserve(unsigned int size) { text.reserve(size); }
+  char operator[](unsigned int index) const { return text[index]; }
+
+  String &operator+=(const String &other)
+  {
+    text += other.text;
+    return *this;
+  }
+
+  String &operator+=(const char *other)
+  {
+    text += other;
+    return *this;
+  }
+
+  String &operator+=(char c)
+  {
+    text += c;
+    return *this;
+  }
+
+  friend String operator+(const String &left, const String &right)
+  {
+    String result(left);
+
+    result += right;
+    return result;
+  }
+
+  bool operator==(const String &other) const { return text == other.text; }
+  bool operator==(const char *other) const { return text == other; }
+  bool operator!=(const String &other) const { return text != other.text; }
+  bool equalsIgnoreCase(const char *other) const { return strcasecmp(text.c_str(), other) == 0; }
+  bool startsWith(const char *prefix) const { return text.rfind(prefix, 0) == 0; }
+
+  int indexOf(char c, unsigned int from = 0) const { return position(text.find(c, from)); }
+  int indexOf(const char *other, unsigned int from = 0) const { return position(text.find(other, from)); }
+  int lastIndexOf(char c) const { return position(text.rfind(c)); }
+  int lastIndexOf(const char *other) const { return position(text.rfind(other)); }
+
+  String substring(unsigned int from) const { return String(text.substr(from).c_str()); }
+  String substring(unsigned int from, unsigned int to) const
+  {
+    return String(text.substr(from, to - from).c_str());
+  }
+
+  long toInt() const { return atol(text.c_str()); }
+  float toFloat() const { return atof(text.c_str()); }
+
+  void trim()
+  {
+    size_t first = text.find_first_not_of(" \t\r\n");
+    size_t last = text.find_last_not_of(" \t\r\n");
+
+    text = first == std::string::npos ? "" : text.substr(first, last - first + 1);
+  }
+
+private:
+  std::string text;
+
+  template <typename T>
+  static std::string format(T value, int base)
+  {
+    char buffer[72];
+
+    if (base == HEX)
+    {
+      snprintf(buffer, sizeof(buffer), "%llx", (unsigned long long)value);
+    }
+    else
+    {
+      snprintf(buffer, sizeof(buffer), "%lld", (long long)value);
+    }
+
+    return buffer;
+  }
+
+  static int position(size_t index)
+  {
+    return index == std::string::npos ? -1 : (int)index;
+  }
+};
+
+class IPAddress
+{
+public:
+  IPAddress() : address(0) {}
+  IPAddress(uint32_t address) : address(address) {}
+  IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d)
+      : address(a | (b << 8) | (c << 16) | ((uint32_t)d << 24)) {}
+
+  bool fromString(const char *text)
+  {
+    unsigned int a, b, c, d;
+    char extra;
+
+    if (sscanf(text, "%u.%u.%u.%u%c", &a, &b, &c, &d, &extra) != 4 ||
+        a > 255 || b > 255 || c > 255 || d > 255)
+    {
+      return false;
+    }
+
+    *this = IPAddress(a, b, c, d);
+    return true;
+  }
+
+  String toString() const
+  {
+    char buffer[16];
+
+    snprintf(buffer, sizeof(buffer), "%u.%u.%u.%u", address & 0xFF,
+             (address >> 8) & 0xFF, (address >> 16) & 0xFF, address >> 24);
+    return String(buffer);
+  }
+
+  operator uint32_t() const { return address; }
+
+private:
+  uint32_t address;
+};
+
+inline IPAddress INADDR_NONE;
+
+/**
+ * Output of the console and of the logger: the host stubs discard it
+ */
+class Print
+{
+public:
+  virtual ~Print() {}
+
+  virtual size_t write(uint8_t c) { return 1; }
+  virtual size_t write(const uint8_t *buffer, size_t size) { return size; }
+
+  size_t print(const char *text) { return strlen(text); }
+  size_t print(const String &text) { return text.length(); }
+  size_t print(const __FlashStringHelper *text) { return 0; }
+  size_t print(const IPAddress &address) { return 0; }
+  size_t print(char c) { return 1; }
+  size_t print(int value, int base = DEC) { return 0; }
+  size_t print(unsigned int value, int base = DEC) { return 0; }
+  size_t print(long value, int base = DEC) { return 0; }
+  size_t print(unsigned long value, int base = DEC) { return 0; }
+  size_t print(double value, int decimals = 2) { return 0; }
+  size_t println(const char *text = "") { return strlen(text) + 2; }
+  size_t println(const String &text) { return text.length() + 2; }
+  size_t printf(const char *format, ...) { return 0; }
+};
+
+class HardwareSerial : public Print
+{
+public:
+  void begin(unsigned long baud) {}
+  int available() { return 0; }
+  int availableForWrite() { return 128; }
+  void flush() {}
+};
+
+inline HardwareSerial Serial;
+
+struct EspClass
+{
+  const char *getChipModel() { return "host"; }
+  uint8_t getChipRevision() { return 0; }
+  uint8_t getChipCores() { return 2; }
+  uint64_t getEfuseMac() { return 0; }
+  uint32_t getCpuFreqMHz() { return 240; }
+  uint32_t getCycleCount() { return (uint32_t)(host_clock_us * 240); }
+  uint32_t getFreeHeap() { return 0; }
+  void restart() {}
+};
+
+inline EspClass ESP;
+
+#endif
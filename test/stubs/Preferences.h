@@ -0,0 +1,109 @@
+/**
+ * This Preferences.h declares the host stub of the NVS preferences (kept in
+ * memory).
+ *
+ * MIT License
+ *
+ * ESP32 MQTT - Samples code
+ * Copyright (c) 2021 Antonio Musarra's Blog - https://www.dontesta.it
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in the
+ * Software without restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the
+ * Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef HOST_STUBS_PREFERENCES_H
+#define HOST_STUBS_PREFERENCES_H
+
+#include <map>
+#include <string>
+#include <vector>
+#include "Arduino.h"
+
+class Preferences
+{
+public:
+  // Writes of every namespace (the tests count the NVS writes)
+  static inline uint32_t writes = 0;
+
+  bool begin(const char *name, bool readOnly = false)
+  {
+    space = name;
+    return true;
+  }
+
+  void end() {}
+
+  bool isKey(const char *key) { return store()[space].count(key) > 0; }
+
+  bool remove(const char *key)
+  {
+    writes++;
+    return store()[space].erase(key) > 0;
+  }
+
+  size_t putBytes(const char *key, const void *value, size_t size)
+  {
+    const uint8_t *bytes = (const uint8_t *)value;
+
+    writes++;
+    store()[space][key].assign(bytes, bytes + size);
+    return size;
+  }
+
+  size_t getBytesLength(const char *key)
+  {
+    return isKey(key) ? store()[space][key].size() : 0;
+  }
+
+  size_t getBytes(const char *key, void *value, size_t size)
+  {
+    size_t length = getBytesLength(key);
+
+    if (length == 0 || length > size)
+    {
+      return 0;
+    }
+
+    memcpy(value, store()[space][key].data(), length);
+    return length;
+  }
+
+  size_t putUInt(const char *key, uint32_t value) { return putBytes(key, &value, sizeof(value)); }
+  size_t putFloat(const char *key, float value) { return putBytes(key, &value, sizeof(value)); }
+
+  uint32_t getUInt(const char *key, uint32_t value = 0)
+  {
+    getBytes(key, &value, sizeof(value));
+    return value;
+  }
+
+  float getFloat(const char *key, float value = 0.0F)
+  {
+    getBytes(key, &value, sizeof(value));
+    return value;
+  }
+
+private:
+  std::string space;
+
+  static std::map<std::string, std::map<std::string, std::vector<uint8_t>>> &store()
+  {
+    static std::map<std::string, std::map<std::string, std::vector<uint8_t>>> namespaces;
+
+    return namespaces;
+  }
+};
+
+#endif
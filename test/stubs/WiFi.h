@@ -0,0 +1,82 @@
+/**
+ * This WiFi.h declares the host stubs of the WiFi station and of its TCP
+ * client (never connected: the tests use the host sockets).
+ *
+ * MIT License
+ *
+ * ESP32 MQTT - Samples code
+ * Copyright (c) 2021 Antonio Musarra's Blog - https://www.dontesta.it
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in the
+ * Software without restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the
+ * Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef HOST_STUBS_WIFI_H
+#define HOST_STUBS_WIFI_H
+
+#include "Arduino.h"
+
+#define WL_CONNECTED 3
+
+class Client : public Print
+{
+public:
+  virtual int connect(IPAddress address, uint16_t port) { return 0; }
+  virtual int connect(const char *host, uint16_t port) { return 0; }
+  int connect(IPAddress address, uint16_t port, int32_t timeoutMs) { return 0; }
+  int connect(const char *host, uint16_t port, int32_t timeoutMs) { return 0; }
+  virtual uint8_t connected() { return 0; }
+  virtual void stop() {}
+  virtual int available() { return 0; }
+
+  int fd() const { return -1; }
+  void setNoDelay(bool noDelay) {}
+  int setTimeout(uint32_t seconds) { return 0; }
+};
+
+class WiFiClient : public Client
+{
+};
+
+struct WiFiClass
+{
+  void begin(const char *ssid, const char *password) {}
+  bool config(IPAddress ip, IPAddress gateway, IPAddress subnet, IPAddress dns) { return true; }
+  bool setHostname(const char *hostname) { return true; }
+  const char *getHostname() { return "host"; }
+  bool setSleep(bool sleep) { return true; }
+  void setAutoReconnect(bool reconnect) {}
+  int status() { return WL_CONNECTED; }
+  bool isConnected() { return true; }
+  IPAddress localIP() { return IPAddress(127, 0, 0, 1); }
+  IPAddress gatewayIP() { return IPAddress(127, 0, 0, 1); }
+  String macAddress() { return String("00:00:00:00:00:00"); }
+
+  // Only the IP addresses and localhost are resolved
+  int hostByName(const char *host, IPAddress &address)
+  {
+    if (strcmp(host, "localhost") == 0)
+    {
+      address = IPAddress(127, 0, 0, 1);
+      return 1;
+    }
+
+    return address.fromString(host) ? 1 : 0;
+  }
+};
+
+inline WiFiClass WiFi;
+
+#endif
@@ -0,0 +1,64 @@
+/**
+ * This Wire.h declares the host stub of the I2C bus (no device answers).
+ *
+ * MIT License
+ *
+ * ESP32 MQTT - Samples code
+ * Copyright (c) 2021 Antonio Musarra's Blog - https://www.dontesta.it
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in the
+ * Software without restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the
+ * Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef HOST_STUBS_WIRE_H
+#define HOST_STUBS_WIRE_H
+
+#include "Arduino.h"
+
+/**
+ * Bus without devices (every transaction is a NACK): a test simulates a
+ * device by overriding the transactions
+ */
+class TwoWire
+{
+public:
+  virtual ~TwoWire() {}
+
+  bool begin(int sda = -1, int scl = -1, uint32_t frequency = 0) { return true; }
+  bool setClock(uint32_t frequency) { return true; }
+  uint32_t getClock() { return 100000; }
+  void setTimeOut(uint16_t timeoutMs) {}
+
+  virtual void beginTransmission(uint8_t address) {}
+  virtual uint8_t endTransmission(bool stop = true) { return 2; }
+  virtual size_t write(uint8_t data) { return 1; }
+  size_t write(const uint8_t *data, size_t size)
+  {
+    for (size_t i = 0; i < size; i++)
+    {
+      write(data[i]);
+    }
+
+    return size;
+  }
+  virtual uint8_t requestFrom(uint8_t address, uint8_t size, uint8_t stop = 1) { return 0; }
+  virtual int available() { return 0; }
+  virtual int read() { return -1; }
+};
+
+inline TwoWire Wire;
+inline TwoWire Wire1;
+
+#endif
@@ -0,0 +1,60 @@
+/**
+ * This esp_pm.h declares the host stubs of the power management.
+ *
+ * MIT License
+ *
+ * ESP32 MQTT - Samples code
+ * Copyright (c) 2021 Antonio Musarra's Blog - https://www.dontesta.it
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in the
+ * Software without restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the
+ * Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef HOST_STUBS_ESP_PM_H
+#define HOST_STUBS_ESP_PM_H
+
+#define CONFIG_PM_ENABLE 1
+#define ESP_OK 0
+
+typedef int esp_err_t;
+typedef void *esp_pm_lock_handle_t;
+
+typedef struct
+{
+  int max_freq_mhz;
+  int min_freq_mhz;
+  bool light_sleep_enable;
+} esp_pm_config_esp32_t;
+
+typedef enum
+{
+  ESP_PM_CPU_FREQ_MAX,
+  ESP_PM_APB_FREQ_MAX,
+  ESP_PM_NO_LIGHT_SLEEP
+} esp_pm_lock_type_t;
+
+inline esp_err_t esp_pm_configure(const void *config) { return ESP_OK; }
+
+inline esp_err_t esp_pm_lock_create(esp_pm_lock_type_t type, int arg, const char *name,
+                                    esp_pm_lock_handle_t *handle)
+{
+  *handle = NULL;
+  return ESP_OK;
+}
+
+inline esp_err_t esp_pm_lock_acquire(esp_pm_lock_handle_t handle) { return ESP_OK; }
+inline esp_err_t esp_pm_lock_release(esp_pm_lock_handle_t handle) { return ESP_OK; }
+
+#endif
@@ -0,0 +1,74 @@
+/**
+ * This FreeRTOS.h declares the host stubs of the FreeRTOS types and of the
+ * critical sections (a spinlock on the host).
+ *
+ * MIT License
+ *
+ * ESP32 MQTT - Samples code
+ * Copyright (c) 2021 Antonio Musarra's Blog - https://www.dontesta.it
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in the
+ * Software without restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the
+ * Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef HOST_STUBS_FREERTOS_H
+#define HOST_STUBS_FREERTOS_H
+
+#include <atomic>
+#include <stdint.h>
+
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t TickType_t;
+typedef void *TaskHandle_t;
+typedef struct HostQueue *QueueHandle_t;
+
+#define pdFALSE 0
+#define pdTRUE 1
+#define pdFAIL 0
+#define pdPASS 1
+
+#define portMAX_DELAY 0xFFFFFFFFU
+#define portTICK_PERIOD_MS 1
+#define pdMS_TO_TICKS(ms) (ms)
+#define configMAX_PRIORITIES 25
+#define tskNO_AFFINITY 0x7FFFFFFF
+
+struct portMUX_TYPE
+{
+  std::atomic<bool> locked;
+};
+
+#define portMUX_INITIALIZER_UNLOCKED {}
+
+inline void host_mux_enter(portMUX_TYPE *mux)
+{
+  while (mux->locked.exchange(true, std::memory_order_acquire))
+  {
+  }
+}
+
+inline void host_mux_exit(portMUX_TYPE *mux)
+{
+  mux->locked.store(false, std::memory_order_release);
+}
+
+#define portENTER_CRITICAL(mux) host_mux_enter(mux)
+#define portEXIT_CRITICAL(mux) host_mux_exit(mux)
+#define portENTER_CRITICAL_ISR(mux) host_mux_enter(mux)
+#define portEXIT_CRITICAL_ISR(mux) host_mux_exit(mux)
+#define portYIELD_FROM_ISR(woken) (void)(woken)
+
+#endif
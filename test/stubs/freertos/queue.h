@@ -0,0 +1,93 @@
+/**
+ * This queue.h declares the host stubs of the FreeRTOS queues (copies of the
+ * items in a locked deque, without blocking).
+ *
+ * MIT License
+ *
+ * ESP32 MQTT - Samples code
+ * Copyright (c) 2021 Antonio Musarra's Blog - https://www.dontesta.it
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in the
+ * Software without restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the
+ * Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef HOST_STUBS_QUEUE_H
+#define HOST_STUBS_QUEUE_H
+
+#include <deque>
+#include <mutex>
+#include <string.h>
+#include <vector>
+#include "FreeRTOS.h"
+
+struct HostQueue
+{
+  std::mutex lock;
+  std::deque<std::vector<uint8_t>> items;
+  UBaseType_t length;
+  UBaseType_t itemSize;
+};
+
+inline QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t itemSize)
+{
+  QueueHandle_t queue = new HostQueue();
+
+  queue->length = length;
+  queue->itemSize = itemSize;
+  return queue;
+}
+
+inline BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticks)
+{
+  std::lock_guard<std::mutex> guard(queue->lock);
+
+  if (queue->items.size() == queue->length)
+  {
+    return pdFALSE;
+  }
+
+  const uint8_t *bytes = (const uint8_t *)item;
+
+  queue->items.emplace_back(bytes, bytes + queue->itemSize);
+  return pdPASS;
+}
+
+inline BaseType_t xQueueSendFromISR(QueueHandle_t queue, const void *item, BaseType_t *woken)
+{
+  return xQueueSend(queue, item, 0);
+}
+
+inline BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t ticks)
+{
+  std::lock_guard<std::mutex> guard(queue->lock);
+
+  if (queue->items.empty())
+  {
+    return pdFALSE;
+  }
+
+  memcpy(item, queue->items.front().data(), queue->itemSize);
+  queue->items.pop_front();
+  return pdPASS;
+}
+
+inline UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue)
+{
+  std::lock_guard<std::mutex> guard(queue->lock);
+
+  return queue->items.size();
+}
+
+#endif
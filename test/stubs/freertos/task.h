@@ -0,0 +1,85 @@
+/**
+ * This task.h declares the host stubs of the FreeRTOS tasks: the tests run
+ * the code of a task on their own threads, so the task functions only keep
+ * the handles and the notification counts.
+ *
+ * MIT License
+ *
+ * ESP32 MQTT - Samples code
+ * Copyright (c) 2021 Antonio Musarra's Blog - https://www.dontesta.it
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in the
+ * Software without restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the
+ * Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef HOST_STUBS_TASK_H
+#define HOST_STUBS_TASK_H
+
+#include "FreeRTOS.h"
+#include "../host_clock.h"
+
+typedef void (*TaskFunction_t)(void *);
+
+typedef enum
+{
+  eNoAction,
+  eSetBits,
+  eIncrement,
+  eSetValueWithOverwrite
+} eNotifyAction;
+
+// Handle of the task of the calling thread (the tests set it)
+inline thread_local TaskHandle_t host_current_task = NULL;
+
+inline TaskHandle_t xTaskGetCurrentTaskHandle() { return host_current_task; }
+inline BaseType_t xPortGetCoreID() { return 0; }
+inline const char *pcTaskGetName(TaskHandle_t task) { return "host"; }
+inline UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task) { return 0; }
+
+inline TickType_t xTaskGetTickCount()
+{
+  return (TickType_t)(host_clock_us / 1000);
+}
+
+inline BaseType_t xTaskCreatePinnedToCore(TaskFunction_t code, const char *name,
+                                          uint32_t stack, void *arg, UBaseType_t priority,
+                                          TaskHandle_t *task, BaseType_t core)
+{
+  return pdFAIL;
+}
+
+inline void vTaskDelay(TickType_t ticks) {}
+inline void vTaskDelayUntil(TickType_t *previous, TickType_t ticks) { *previous += ticks; }
+inline void vTaskDelete(TaskHandle_t task) {}
+
+inline BaseType_t xTaskNotifyGive(TaskHandle_t task) { return pdPASS; }
+inline void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t *woken) {}
+inline uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t ticks) { return 0; }
+inline BaseType_t xTaskNotify(TaskHandle_t task, uint32_t value, eNotifyAction action) { return pdPASS; }
+inline BaseType_t xTaskNotifyFromISR(TaskHandle_t task, uint32_t value, eNotifyAction action,
+                                     BaseType_t *woken)
+{
+  return pdPASS;
+}
+inline BaseType_t xTaskNotifyWait(uint32_t clearOnEntry, uint32_t clearOnExit, uint32_t *value,
+                                  TickType_t ticks)
+{
+  return pdFALSE;
+}
+
+inline void *pvTaskGetThreadLocalStoragePointer(TaskHandle_t task, BaseType_t index) { return NULL; }
+inline void vTaskSetThreadLocalStoragePointer(TaskHandle_t task, BaseType_t index, void *value) {}
+
+#endif
@@ -0,0 +1,166 @@
+/**
+ * This test_bme280.cpp implements the host tests of the compensation of the
+ * BME280 (datasheet vectors), of the measurement time and of the altitude.
+ *
+ * MIT License
+ *
+ * ESP32 MQTT - Samples code
+ * Copyright (c) 2021 Antonio Musarra's Blog - https://www.dontesta.it
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in the
+ * Software without restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the
+ * Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <unity.h>
+#include "bme280.h"
+
+// Raw value of a channel skipped by the oversampling
+#define SKIPPED_20_BITS 0x80000
+
+/**
+ * Trimming parameters and raw values of the example of the datasheet
+ * (Bosch BMP280/BME280 compensation example, section 8)
+ */
+static Bme280Calibration datasheet_calibration()
+{
+  Bme280Calibration calibration;
+
+  memset(&calibration, 0, sizeof(calibration));
+  calibration.t1 = 27504;
+  calibration.t2 = 26435;
+  calibration.t3 = -1000;
+  calibration.p1 = 36477;
+  calibration.p2 = -10685;
+  calibration.p3 = 3024;
+  calibration.p4 = 2855;
+  calibration.p5 = 140;
+  calibration.p6 = -7;
+  calibration.p7 = 15500;
+  calibration.p8 = -14600;
+  calibration.p9 = 6000;
+
+  return calibration;
+}
+
+static Bme280Raw datasheet_raw()
+{
+  Bme280Raw raw;
+
+  raw.temperature = 519888;
+  raw.pressure = 415148;
+  raw.humidity = 0x8000;
+
+  return raw;
+}
+
+void setUp()
+{
+}
+
+void tearDown()
+{
+}
+
+void test_compensate_datasheet_vector()
+{
+  Bme280Sample sample = Bme280::compensate(datasheet_calibration(), datasheet_raw());
+
+  // 25.08 °C and 100653.27 Pa (the integer formulas round to 1/256 Pa)
+  TEST_ASSERT_FLOAT_WITHIN(0.005F, 25.08F, sample.temperature);
+  TEST_ASSERT_FLOAT_WITHIN(0.05F, 100653.27F, sample.pressure);
+}
+
+void test_compensate_skipped_channels()
+{
+  Bme280Raw raw = datasheet_raw();
+
+  raw.pressure = SKIPPED_20_BITS;
+
+  Bme280Sample sample = Bme280::compensate(datasheet_calibration(), raw);
+
+  TEST_ASSERT_FLOAT_WITHIN(0.005F, 25.08F, sample.temperature);
+  TEST_ASSERT_FLOAT_IS_NAN(sample.pressure);
+
+  // Without the temperature there is no t_fine for the other channels
+  raw = datasheet_raw();
+  raw.temperature = SKIPPED_20_BITS;
+  sample = Bme280::compensate(datasheet_calibration(), raw);
+
+  TEST_ASSERT_FLOAT_IS_NAN(sample.temperature);
+  TEST_ASSERT_FLOAT_IS_NAN(sample.pressure);
+  TEST_ASSERT_FLOAT_IS_NAN(sample.humidity);
+}
+
+void test_compensate_without_pressure_trimming()
+{
+  Bme280Calibration calibration = datasheet_calibration();
+
+  // p1 0 is the division by zero of the formula
+  calibration.p1 = 0;
+
+  Bme280Sample sample = Bme280::compensate(calibration, datasheet_raw());
+
+  TEST_ASSERT_FLOAT_IS_NAN(sample.pressure);
+}
+
+void test_measurement_time_of_the_profiles()
+{
+  // 1.25 + 2.3 + (2.3 + 0.575) + (2.3 + 0.575) ms at x1
+  TEST_ASSERT_EQUAL_UINT32(9300, Bme280::measurement_time_us(*bme280_profile("weather")));
+
+  // Pressure skipped: 1.25 + 2.3 + (2.3 + 0.575) ms
+  TEST_ASSERT_EQUAL_UINT32(6425, Bme280::measurement_time_us(*bme280_profile("humidity")));
+  TEST_ASSERT_NULL(bme280_profile("unknown"));
+}
+
+void test_altitude_of_the_standard_atmosphere()
+{
+  TEST_ASSERT_FLOAT_WITHIN(0.01F, 0.0F, Bme280::altitude(101325.0F));
+
+  // 898.76 hPa at 1000 m
+  TEST_ASSERT_FLOAT_WITHIN(1.0F, 1000.0F, Bme280::altitude(89876.0F));
+
+  // QNH 1023.25 hPa: the same pressure is about 83 m higher
+  TEST_ASSERT_FLOAT_WITHIN(1.0F, 83.0F, Bme280::altitude(101325.0F, 1023.25F));
+}
+
+void test_altimeter_tangent_within_the_span()
+{
+  Bme280Altimeter altimeter;
+
+  altimeter.set_sea_level(1013.25F);
+
+  // Anchor at 95000 Pa, then across the span of the cache
+  for (float pressure = 95000.0F; pressure <= 95000.0F + BME280_ALTITUDE_SPAN; pressure += 5.0F)
+  {
+    TEST_ASSERT_FLOAT_WITHIN(0.01F, Bme280::altitude(pressure), altimeter.altitude(pressure));
+  }
+
+  TEST_ASSERT_FLOAT_IS_NAN(altimeter.altitude(NAN));
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+
+  RUN_TEST(test_compensate_datasheet_vector);
+  RUN_TEST(test_compensate_skipped_channels);
+  RUN_TEST(test_compensate_without_pressure_trimming);
+  RUN_TEST(test_measurement_time_of_the_profiles);
+  RUN_TEST(test_altitude_of_the_standard_atmosphere);
+  RUN_TEST(test_altimeter_tangent_within_the_span);
+
+  return UNITY_END();
+}
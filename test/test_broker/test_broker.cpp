@@ -0,0 +1,293 @@
+/**
+ * This test_broker.cpp implements the host tests of the failover and of the
+ * failback between two MQTT Brokers, on listening sockets of the loopback,
+ * and measures the time from the loss of a broker to the connect on the
+ * other one.
+ *
+ * MIT License
+ *
+ * ESP32 MQTT - Samples code
+ * Copyright (c) 2021 Antonio Musarra's Blog - https://www.dontesta.it
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in the
+ * Software without restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the
+ * Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <Arduino.h>
+#include <chrono>
+#include <host_clock.h>
+#include <lwip/sockets.h>
+#include <unity.h>
+#include "broker.h"
+#include "dns_cache.h"
+
+// Max real time in ms of a call of broker_should_fail_back
+#define TEST_MAX_CALL_MS 5
+
+// Max polls of a probe on the loopback
+#define TEST_MAX_POLLS 1000
+
+// Max time in ms from the loss of the primary to the connect on the fallback
+#define TEST_MAX_FAILOVER_MS 100
+
+// Max connect attempts of a reconnect
+#define TEST_MAX_ATTEMPTS 8
+
+/**
+ * Open a listening socket of the loopback: the broker stand-in
+ *
+ * port: Port of the socket (0 for an ephemeral one, set to the one bound)
+ * return: Socket (-1 on error)
+ */
+static int listen_loopback(uint16_t &port)
+{
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  int reuse = 1;
+  struct sockaddr_in address;
+  socklen_t length = sizeof(address);
+
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  address.sin_port = htons(port);
+
+  if (fd < 0 || setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) < 0 ||
+      bind(fd, (struct sockaddr *)&address, sizeof(address)) < 0 || listen(fd, 4) < 0 ||
+      getsockname(fd, (struct sockaddr *)&address, &length) < 0)
+  {
+    return -1;
+  }
+
+  port = ntohs(address.sin_port);
+  return fd;
+}
+
+/**
+ * Time in ms since a start: the real time of the sockets plus the waits of
+ * the backoff, spent on the host clock
+ */
+struct FailoverClock
+{
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  unsigned long waitedMs = 0;
+
+  double elapsed_ms() const
+  {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start)
+               .count() +
+           waitedMs;
+  }
+};
+
+/**
+ * Reconnect as reconnect() of the firmware does: select the broker, wait
+ * its backoff, resolve it by the DNS cache and connect, until connected
+ *
+ * clock: Clock of the waits
+ * index: Broker connected
+ * return: Socket of the connection (-1 if every attempt failed)
+ */
+static int reconnect(FailoverClock &clock, int &index)
+{
+  for (int attempt = 0; attempt < TEST_MAX_ATTEMPTS; attempt++)
+  {
+    unsigned long waitMs;
+
+    index = broker_select(&waitMs);
+
+    if (waitMs > 0)
+    {
+      host_clock_advance((uint64_t)waitMs * 1000);
+      clock.waitedMs += waitMs;
+    }
+
+    Broker *broker = broker_get(index);
+    IPAddress address;
+
+    if (!dns_cache_resolve(broker->host, address))
+    {
+      broker_on_connect_failed(index);
+      continue;
+    }
+
+    struct sockaddr_in peer;
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    auto connectStart = std::chrono::steady_clock::now();
+
+    memset(&peer, 0, sizeof(peer));
+    peer.sin_family = AF_INET;
+    peer.sin_addr.s_addr = (uint32_t)address;
+    peer.sin_port = htons(broker->port);
+
+    if (fd >= 0 && connect(fd, (struct sockaddr *)&peer, sizeof(peer)) == 0)
+    {
+      broker_on_connect(index, std::chrono::duration_cast<std::chrono::milliseconds>(
+                                   std::chrono::steady_clock::now() - connectStart)
+                                   .count());
+      return fd;
+    }
+
+    if (fd >= 0)
+    {
+      close(fd);
+    }
+
+    broker_on_connect_failed(index);
+    dns_cache_expire(broker->host);
+  }
+
+  return -1;
+}
+
+/**
+ * Call broker_should_fail_back until the probe in progress completes,
+ * checking that no call blocks
+ */
+static bool poll_fail_back()
+{
+  for (int i = 0; i < TEST_MAX_POLLS; i++)
+  {
+    auto begin = std::chrono::steady_clock::now();
+    bool failBack = broker_should_fail_back();
+    auto elapsed = std::chrono::steady_clock::now() - begin;
+
+    TEST_ASSERT_LESS_THAN(TEST_MAX_CALL_MS,
+                          std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count());
+
+    if (failBack)
+    {
+      return true;
+    }
+
+    // A probe in progress is polled within ms, the next one is seconds away
+    if (broker_fail_back_wait_ms() >= 1000)
+    {
+      return false;
+    }
+
+    usleep(1000);
+  }
+
+  TEST_FAIL_MESSAGE("The probe never completed");
+  return false;
+}
+
+void setUp(void) {}
+
+void tearDown(void) {}
+
+void test_failover_and_failback_between_two_brokers(void)
+{
+  uint16_t primaryPort = 0;
+  uint16_t fallbackPort = 0;
+  int primary = listen_loopback(primaryPort);
+  int fallback = listen_loopback(fallbackPort);
+  int index;
+  char message[96];
+
+  TEST_ASSERT_TRUE(primary >= 0 && fallback >= 0);
+
+  broker_add("localhost", primaryPort);
+  broker_add("localhost", fallbackPort);
+
+  host_clock_advance(1000000);
+
+  // Connected to the primary, the session accepted by the stand-in
+  FailoverClock boot;
+  int client = reconnect(boot, index);
+
+  TEST_ASSERT_TRUE(client >= 0);
+  TEST_ASSERT_EQUAL_INT(0, index);
+
+  int session = accept(primary, NULL, NULL);
+
+  TEST_ASSERT_TRUE(session >= 0);
+  TEST_ASSERT_FALSE(broker_should_fail_back());
+  TEST_ASSERT_EQUAL_UINT32(UINT32_MAX, broker_fail_back_wait_ms());
+
+  // The primary goes down: the client sees the end of the connection and
+  // reconnects, the connect to the primary is refused and the fallback
+  // is tried right away
+  FailoverClock failover;
+  char byte;
+
+  close(session);
+  close(primary);
+
+  TEST_ASSERT_EQUAL_INT(0, recv(client, &byte, 1, 0));
+  close(client);
+
+  client = reconnect(failover, index);
+
+  double failoverMs = failover.elapsed_ms();
+
+  TEST_ASSERT_TRUE(client >= 0);
+  TEST_ASSERT_EQUAL_INT(1, index);
+  TEST_ASSERT_EQUAL_UINT16(1, broker_get(0)->connectFailures);
+
+  snprintf(message, sizeof(message), "failover: %.3f ms (%lu ms of backoff)", failoverMs,
+           failover.waitedMs);
+  TEST_MESSAGE(message);
+  TEST_ASSERT_TRUE(failoverMs < TEST_MAX_FAILOVER_MS);
+
+  // No probe before the interval
+  TEST_ASSERT_FALSE(broker_should_fail_back());
+  TEST_ASSERT_GREATER_THAN(0, broker_fail_back_wait_ms());
+
+  // The probe of the primary still down fails and stays on the fallback
+  host_clock_advance(31000000);
+  TEST_ASSERT_FALSE(broker_should_fail_back());
+  TEST_ASSERT_FALSE(poll_fail_back());
+  TEST_ASSERT_EQUAL_UINT16(2, broker_get(0)->connectFailures);
+  TEST_ASSERT_EQUAL_INT(1, broker_current_index());
+
+  // The primary is back on its port: the next probe after its backoff
+  // fails back, the client disconnects and connects to the primary again
+  primary = listen_loopback(primaryPort);
+  TEST_ASSERT_TRUE(primary >= 0);
+  TEST_ASSERT_EQUAL_UINT16(primaryPort, broker_get(0)->port);
+
+  FailoverClock failback;
+
+  host_clock_advance(31000000);
+  failback.waitedMs += 31000;
+  TEST_ASSERT_FALSE(broker_should_fail_back());
+  TEST_ASSERT_TRUE(poll_fail_back());
+  TEST_ASSERT_EQUAL_UINT16(0, broker_get(0)->connectFailures);
+
+  close(client);
+  client = reconnect(failback, index);
+
+  TEST_ASSERT_TRUE(client >= 0);
+  TEST_ASSERT_EQUAL_INT(0, index);
+  TEST_ASSERT_FALSE(broker_should_fail_back());
+
+  snprintf(message, sizeof(message), "failback: %.3f ms (%lu ms to the probe)",
+           failback.elapsed_ms(), failback.waitedMs);
+  TEST_MESSAGE(message);
+
+  close(client);
+  close(primary);
+  close(fallback);
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+
+  RUN_TEST(test_failover_and_failback_between_two_brokers);
+
+  return UNITY_END();
+}
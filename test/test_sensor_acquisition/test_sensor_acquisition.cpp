@@ -0,0 +1,230 @@
+/**
+ * This test_sensor_acquisition.cpp implements the host tests of the recovery
+ * of a BME280 driven by the timers of the acquisition, on a simulated bus.
+ *
+ * MIT License
+ *
+ * ESP32 MQTT - Samples code
+ * Copyright (c) 2021 Antonio Musarra's Blog - https://www.dontesta.it
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in the
+ * Software without restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the
+ * Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <host_clock.h>
+#include <unity.h>
+#include "sensor_acquisition.h"
+#include "timer_wheel.h"
+
+// Polls of the status that see the copy of the trimming parameters running
+#define TEST_UPDATE_POLLS 2
+
+/**
+ * BME280 simulated on the bus: a register map, the soft reset sets the
+ * im_update bit of the status for TEST_UPDATE_POLLS reads
+ */
+class SimulatedBus : public TwoWire
+{
+public:
+  bool present = true;
+  uint8_t registers[256] = {};
+  int resets = 0;
+  int updatePolls = 0;
+
+  void beginTransmission(uint8_t address) override
+  {
+    length = 0;
+  }
+
+  size_t write(uint8_t data) override
+  {
+    if (length < sizeof(written))
+    {
+      written[length++] = data;
+    }
+
+    return 1;
+  }
+
+  uint8_t endTransmission(bool stop = true) override
+  {
+    if (!present)
+    {
+      return 2;
+    }
+
+    if (length > 0)
+    {
+      pointer = written[0];
+    }
+
+    // Register write
+    if (length == 2)
+    {
+      registers[pointer] = written[1];
+
+      if (pointer == 0xE0 && written[1] == 0xB6)
+      {
+        resets++;
+        updatePolls = TEST_UPDATE_POLLS;
+      }
+    }
+
+    return 0;
+  }
+
+  uint8_t requestFrom(uint8_t address, uint8_t size, uint8_t stop = 1) override
+  {
+    if (!present)
+    {
+      return 0;
+    }
+
+    // The status of a poll during the copy of the trimming parameters
+    if (pointer == 0xF3)
+    {
+      registers[0xF3] = updatePolls > 0 ? 0x01 : 0x00;
+      updatePolls -= updatePolls > 0;
+    }
+
+    return size;
+  }
+
+  int read() override
+  {
+    return registers[pointer++];
+  }
+
+private:
+  uint8_t written[4];
+  size_t length = 0;
+  uint8_t pointer = 0;
+};
+
+static SimulatedBus bus;
+static Bme280 device;
+static SensorAcquisition acquisition;
+
+static int recoveries;
+static bool recoveredOk;
+static int failedReads;
+
+static void on_recovered(void *arg, bool ok)
+{
+  recoveries++;
+  recoveredOk = ok;
+}
+
+static void on_read(void *arg, bool ok, const Bme280Sample &sample)
+{
+  failedReads += !ok;
+}
+
+/**
+ * Advance the wheel 1 ms at a time, as the sampler does
+ */
+static void advance_ms(int ms)
+{
+  for (int i = 0; i < ms; i++)
+  {
+    host_clock_advance(1000);
+    timer_wheel_advance(millis());
+  }
+}
+
+void setUp(void)
+{
+  bus.present = true;
+  memset(bus.registers, 0, sizeof(bus.registers));
+  bus.registers[0xD0] = 0x60;
+  recoveries = 0;
+  recoveredOk = false;
+  failedReads = 0;
+
+  timer_wheel_begin(millis(), NULL);
+
+  TEST_ASSERT_TRUE(device.begin(*bme280_profile(BME280_PROFILE_DEFAULT), BME280_ADDRESS, bus));
+  acquisition.begin(device);
+}
+
+void tearDown(void) {}
+
+void test_recovery_runs_on_timers(void)
+{
+  int64_t start = host_clock_us;
+  int resets = bus.resets;
+
+  // The sensor lost its configuration (power cycle)
+  bus.registers[0xF4] = 0;
+
+  acquisition.recover(device.profile(), on_recovered, NULL);
+
+  // Nothing waited for: the reset is sent and the call returns
+  TEST_ASSERT_EQUAL_INT64(start, host_clock_us);
+  TEST_ASSERT_EQUAL_INT(resets + 1, bus.resets);
+  TEST_ASSERT_EQUAL_INT(Sensor_Recovering, acquisition.state());
+  TEST_ASSERT_EQUAL_INT(0, recoveries);
+
+  // A read in the meanwhile fails at once
+  acquisition.request(on_read, NULL);
+  TEST_ASSERT_EQUAL_INT(1, failedReads);
+
+  // Two polls see the copy running, the third one configures the profile
+  advance_ms(BME280_RESET_MS * TEST_UPDATE_POLLS);
+  TEST_ASSERT_EQUAL_INT(0, recoveries);
+
+  advance_ms(BME280_RESET_MS);
+  TEST_ASSERT_EQUAL_INT(1, recoveries);
+  TEST_ASSERT_TRUE(recoveredOk);
+  TEST_ASSERT_EQUAL_INT(Sensor_Idle, acquisition.state());
+
+  // Oversampling x1 of temperature and pressure, sleep (forced mode)
+  TEST_ASSERT_EQUAL_UINT8(0x24, bus.registers[0xF4]);
+}
+
+void test_recovery_of_a_missing_sensor_fails_at_once(void)
+{
+  bus.present = false;
+
+  acquisition.recover(device.profile(), on_recovered, NULL);
+
+  TEST_ASSERT_EQUAL_INT(1, recoveries);
+  TEST_ASSERT_FALSE(recoveredOk);
+  TEST_ASSERT_EQUAL_INT(Sensor_Idle, acquisition.state());
+  TEST_ASSERT_EQUAL_UINT32(UINT32_MAX, timer_wheel_sleep_ms(millis()));
+}
+
+void test_recovery_fails_when_the_sensor_stops_answering(void)
+{
+  acquisition.recover(device.profile(), on_recovered, NULL);
+
+  bus.present = false;
+  advance_ms(BME280_RESET_MS);
+
+  TEST_ASSERT_EQUAL_INT(1, recoveries);
+  TEST_ASSERT_FALSE(recoveredOk);
+  TEST_ASSERT_EQUAL_UINT32(UINT32_MAX, timer_wheel_sleep_ms(millis()));
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+
+  RUN_TEST(test_recovery_runs_on_timers);
+  RUN_TEST(test_recovery_of_a_missing_sensor_fails_at_once);
+  RUN_TEST(test_recovery_fails_when_the_sensor_stops_answering);
+
+  return UNITY_END();
+}
@@ -0,0 +1,194 @@
+/**
+ * This test_sensor_calibration.cpp implements the host tests of the
+ * calibrations of the readings.
+ *
+ * MIT License
+ *
+ * ESP32 MQTT - Samples code
+ * Copyright (c) 2021 Antonio Musarra's Blog - https://www.dontesta.it
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in the
+ * Software without restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the
+ * Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <unity.h>
+#include "sensor.h"
+#include "sensor_calibration.h"
+
+void setUp(void)
+{
+  // Remove every calibration of the tests
+  for (uint32_t sensor = 0; sensor < SENSOR_CALIBRATION_MAX + 1; sensor++)
+  {
+    sensor_calibration_set(sensor_calibration_identity(sensor, Quantity_Temperature));
+    sensor_calibration_set(sensor_calibration_identity(sensor, Quantity_Humidity));
+  }
+}
+
+void tearDown(void) {}
+
+void test_offset_gain_and_table(void)
+{
+  SensorCalibration calibration = sensor_calibration_identity(0, Quantity_Humidity);
+
+  // Points given out of order are sorted
+  calibration.offset = 0.5F;
+  calibration.gain = 2.0F;
+  calibration.points = 2;
+  calibration.raw[0] = 80.0F;
+  calibration.corrected[0] = 79.0F;
+  calibration.raw[1] = 20.0F;
+  calibration.corrected[1] = 21.5F;
+
+  TEST_ASSERT_TRUE(sensor_calibration_set(calibration));
+
+  // 2 * table(50) + 0.5, with table(50) = 21.5 + 30 * 57.5 / 60
+  TEST_ASSERT_FLOAT_WITHIN(1e-4F, 2.0F * 50.25F + 0.5F,
+                           sensor_calibration_apply(0, Quantity_Humidity, 50.0F));
+
+  // The end segments extrapolate
+  TEST_ASSERT_FLOAT_WITHIN(1e-4F, 2.0F * (21.5F - 10.0F * 57.5F / 60.0F) + 0.5F,
+                           sensor_calibration_apply(0, Quantity_Humidity, 10.0F));
+
+  // Other quantities and sensors are not calibrated
+  TEST_ASSERT_EQUAL_FLOAT(50.0F, sensor_calibration_apply(0, Quantity_Temperature, 50.0F));
+  TEST_ASSERT_EQUAL_FLOAT(50.0F, sensor_calibration_apply(1, Quantity_Humidity, 50.0F));
+
+  // The identity removes it
+  TEST_ASSERT_TRUE(sensor_calibration_set(sensor_calibration_identity(0, Quantity_Humidity)));
+  TEST_ASSERT_EQUAL_FLOAT(50.0F, sensor_calibration_apply(0, Quantity_Humidity, 50.0F));
+}
+
+void test_table_with_too_many_points_is_refused(void)
+{
+  SensorCalibration calibration = sensor_calibration_identity(0, Quantity_Temperature);
+
+  calibration.offset = -1.8F;
+  calibration.points = SENSOR_CALIBRATION_POINTS + 1;
+
+  TEST_ASSERT_FALSE(sensor_calibration_set(calibration));
+  TEST_ASSERT_EQUAL_FLOAT(20.0F, sensor_calibration_apply(0, Quantity_Temperature, 20.0F));
+
+  // A full table is accepted
+  calibration.points = SENSOR_CALIBRATION_POINTS;
+
+  for (uint8_t i = 0; i < calibration.points; i++)
+  {
+    calibration.raw[i] = i * 10.0F;
+    calibration.corrected[i] = i * 10.0F;
+  }
+
+  TEST_ASSERT_TRUE(sensor_calibration_set(calibration));
+  TEST_ASSERT_FLOAT_WITHIN(1e-4F, 18.2F,
+                           sensor_calibration_apply(0, Quantity_Temperature, 20.0F));
+}
+
+void test_full_table_of_calibrations_is_refused(void)
+{
+  SensorCalibration calibration;
+
+  for (uint32_t sensor = 0; sensor < SENSOR_CALIBRATION_MAX; sensor++)
+  {
+    calibration = sensor_calibration_identity(sensor, Quantity_Temperature);
+    calibration.offset = 1.0F;
+
+    TEST_ASSERT_TRUE(sensor_calibration_set(calibration));
+  }
+
+  calibration = sensor_calibration_identity(SENSOR_CALIBRATION_MAX, Quantity_Temperature);
+  calibration.offset = 1.0F;
+
+  TEST_ASSERT_FALSE(sensor_calibration_set(calibration));
+
+  // An update of a calibration already in the table is accepted
+  calibration = sensor_calibration_identity(0, Quantity_Temperature);
+  calibration.offset = 2.0F;
+
+  TEST_ASSERT_TRUE(sensor_calibration_set(calibration));
+  TEST_ASSERT_EQUAL_FLOAT(22.0F, sensor_calibration_apply(0, Quantity_Temperature, 20.0F));
+}
+
+/**
+ * Driver of the tests, only its name and its location
+ */
+class LocatedSensor : public SensorDriver
+{
+public:
+  LocatedSensor(const char *driverName, uint16_t driverLocation)
+      : driverName(driverName), driverLocation(driverLocation)
+  {
+  }
+
+  const char *name() const override
+  {
+    return driverName;
+  }
+
+  uint16_t location() const override
+  {
+    return driverLocation;
+  }
+
+  void read(SensorCallback callback, void *arg) override {}
+
+private:
+  const char *driverName;
+  uint16_t driverLocation;
+};
+
+void test_sensor_ids_follow_the_sensor(void)
+{
+  // The sensor at 0x76 missing at boot: the one at 0x77 is the channel 0
+  static LocatedSensor second("bme280", 0x77);
+  static LocatedSensor remote("bme280", 0x0176);
+  static LocatedSensor simulated[] = {LocatedSensor("simulated", 0),
+                                      LocatedSensor("simulated", 0)};
+
+  TEST_ASSERT_EQUAL_INT(0, sensor_register(&second, 1000, 1000));
+  TEST_ASSERT_EQUAL_INT(1, sensor_register(&remote, 1000, 1000));
+  TEST_ASSERT_EQUAL_INT(2, sensor_register(&simulated[0], 1000, 1000));
+  TEST_ASSERT_EQUAL_INT(3, sensor_register(&simulated[1], 1000, 1000));
+
+  // The ids are the keys of the calibrations in NVS: they must not change
+  // from a firmware to the next
+  TEST_ASSERT_EQUAL_HEX32(0xc79481b8, sensor_id(0));
+  TEST_ASSERT_EQUAL_HEX32(0xe078ba9a, sensor_id(1));
+
+  // The same driver at the same location: the order tells them apart
+  TEST_ASSERT_EQUAL_HEX32(0xe125f83b, sensor_id(2));
+  TEST_ASSERT_EQUAL_HEX32(0xe025f6a8, sensor_id(3));
+
+  // The calibration of the sensor at 0x76 doesn't apply to the channel 0
+  SensorCalibration calibration = sensor_calibration_identity(0x067b3503, Quantity_Pressure);
+
+  calibration.offset = 120.0F;
+
+  TEST_ASSERT_TRUE(sensor_calibration_set(calibration));
+  TEST_ASSERT_EQUAL_FLOAT(100000.0F,
+                          sensor_calibration_apply(sensor_id(0), Quantity_Pressure, 100000.0F));
+  TEST_ASSERT_TRUE(sensor_calibration_set(sensor_calibration_identity(0x067b3503, Quantity_Pressure)));
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+
+  RUN_TEST(test_offset_gain_and_table);
+  RUN_TEST(test_table_with_too_many_points_is_refused);
+  RUN_TEST(test_full_table_of_calibrations_is_refused);
+  RUN_TEST(test_sensor_ids_follow_the_sensor);
+
+  return UNITY_END();
+}
@@ -0,0 +1,196 @@
+/**
+ * This test_sensor_registry.cpp implements the host tests of the sensor
+ * registry: throughput of the sampling and encode pipeline with simulated
+ * drivers.
+ *
+ * MIT License
+ *
+ * ESP32 MQTT - Samples code
+ * Copyright (c) 2021 Antonio Musarra's Blog - https://www.dontesta.it
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in the
+ * Software without restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the
+ * Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <chrono>
+#include <host_clock.h>
+#include <unity.h>
+#include "sensor.h"
+#include "sensor_simulated.h"
+#include "timer_wheel.h"
+
+// Sampling period and window of the simulated sensors in ms
+#define TEST_PERIOD 10
+#define TEST_WINDOW 1000
+
+// Simulated time of the run in ms
+#define TEST_DURATION 600000
+
+static SimulatedSensor sensors[SENSOR_REGISTRY_MAX];
+
+// Records delivered to the sink, by channel
+static uint32_t records[SENSOR_REGISTRY_MAX];
+static uint32_t incompleteRecords;
+static uint32_t encodeErrors;
+static size_t encodedBytes;
+
+/**
+ * Sink of the records: the work of the telemetry of the firmware (encode
+ * and serialize every record)
+ */
+static void encode_record(const SensorRecord &record)
+{
+  StaticJsonDocument<1536> message;
+  char payload[1024];
+
+  records[record.channel]++;
+
+  // Every window is full: one aggregate, all the reads of the window
+  if (record.count != 1 || record.reads != TEST_WINDOW / TEST_PERIOD ||
+      record.aggregates[0].count != TEST_WINDOW / TEST_PERIOD)
+  {
+    incompleteRecords++;
+  }
+
+  sensor_encode(record, message);
+
+  size_t length = measureJson(message);
+
+  if (message.overflowed() || length >= sizeof(payload) ||
+      serializeJson(message, payload, sizeof(payload)) != length)
+  {
+    encodeErrors++;
+  }
+
+  encodedBytes += length;
+}
+
+void setUp(void) {}
+
+void tearDown(void) {}
+
+void test_pipeline_throughput_with_simulated_drivers(void)
+{
+  timer_wheel_begin(millis(), NULL);
+
+  for (int i = 0; i < SENSOR_REGISTRY_MAX; i++)
+  {
+    TEST_ASSERT_EQUAL_INT(i, sensor_register(&sensors[i], TEST_PERIOD, TEST_WINDOW));
+  }
+
+  sensors_start(encode_record);
+
+  auto begin = std::chrono::steady_clock::now();
+
+  // The sampler wakes up at every ms of the simulated clock
+  for (int ms = 0; ms < TEST_DURATION; ms++)
+  {
+    host_clock_advance(1000);
+    timer_wheel_advance(millis());
+  }
+
+  auto elapsed = std::chrono::steady_clock::now() - begin;
+  double seconds = std::chrono::duration<double>(elapsed).count();
+  uint32_t total = 0;
+
+  for (int i = 0; i < SENSOR_REGISTRY_MAX; i++)
+  {
+    TEST_ASSERT_EQUAL_UINT32(TEST_DURATION / TEST_WINDOW, records[i]);
+    total += records[i];
+  }
+
+  TEST_ASSERT_EQUAL_UINT32(0, incompleteRecords);
+  TEST_ASSERT_EQUAL_UINT32(0, encodeErrors);
+  TEST_ASSERT_EQUAL_INT(0, sensors_failed());
+
+  char message[160];
+
+  snprintf(message, sizeof(message),
+           "%u reads and %u records (%u bytes) in %.3f s: %.0f reads/s, %.0f records/s",
+           (unsigned)(total * (TEST_WINDOW / TEST_PERIOD)), (unsigned)total,
+           (unsigned)encodedBytes, seconds, total * (TEST_WINDOW / TEST_PERIOD) / seconds,
+           total / seconds);
+  TEST_MESSAGE(message);
+}
+
+void test_full_registry_refuses_a_sensor(void)
+{
+  static SimulatedSensor extra;
+
+  TEST_ASSERT_EQUAL_INT(SENSOR_REGISTRY_MAX, sensor_count());
+  TEST_ASSERT_EQUAL_INT(-1, sensor_register(&extra, TEST_PERIOD, TEST_WINDOW));
+}
+
+static void on_filler_timer(void *arg, uint32_t scheduledMs) {}
+
+void test_timers_not_started_are_retried(void)
+{
+  static TimerId fillers[TIMER_WHEEL_POOL_SIZE];
+  int filled = 0;
+
+  // A new wheel with an empty pool: no sensor can be scheduled (filled
+  // twice, so the ids of the old wheel kept by the sensors are stale)
+  timer_wheel_begin(millis(), NULL);
+
+  for (int round = 0; round < 2; round++)
+  {
+    for (int i = 0; i < filled; i++)
+    {
+      timer_cancel(fillers[i]);
+    }
+
+    filled = 0;
+
+    while (filled < TIMER_WHEEL_POOL_SIZE &&
+           (fillers[filled] = timer_start(3600000, 0, on_filler_timer, NULL)) != TIMER_INVALID)
+    {
+      filled++;
+    }
+  }
+
+  sensors_schedule();
+  TEST_ASSERT_EQUAL_UINT32(SENSOR_TIMER_RETRY_MS, sensors_retry_timers());
+
+  for (int i = 0; i < filled; i++)
+  {
+    timer_cancel(fillers[i]);
+  }
+
+  // Started again at the next attempt, once the pool has room
+  host_clock_advance(SENSOR_TIMER_RETRY_MS * 1000);
+  TEST_ASSERT_EQUAL_UINT32(UINT32_MAX, sensors_retry_timers());
+
+  uint32_t before = records[0];
+
+  for (int ms = 0; ms < 2 * TEST_WINDOW; ms++)
+  {
+    host_clock_advance(1000);
+    timer_wheel_advance(millis());
+  }
+
+  TEST_ASSERT_TRUE(records[0] > before);
+  TEST_ASSERT_EQUAL_INT(0, sensors_failed());
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+
+  RUN_TEST(test_pipeline_throughput_with_simulated_drivers);
+  RUN_TEST(test_full_registry_refuses_a_sensor);
+  RUN_TEST(test_timers_not_started_are_retried);
+
+  return UNITY_END();
+}
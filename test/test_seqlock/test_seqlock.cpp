@@ -0,0 +1,151 @@
+/**
+ * This test_seqlock.cpp implements the torture test of the sequence lock: a
+ * writer thread publishes snapshots while reader threads check that every
+ * snapshot read is whole and matches its number.
+ *
+ * MIT License
+ *
+ * ESP32 MQTT - Samples code
+ * Copyright (c) 2021 Antonio Musarra's Blog - https://www.dontesta.it
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in the
+ * Software without restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the
+ * Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <atomic>
+#include <thread>
+#include <unity.h>
+#include "seqlock.h"
+
+// Snapshots published by the writer thread
+#define TEST_WRITES 50000
+
+// Reader threads
+#define TEST_READERS 3
+
+// Words of a snapshot (a large one widens the window of a torn copy)
+#define TEST_WORDS 32
+
+struct Snapshot
+{
+  uint32_t words[TEST_WORDS];
+};
+
+static Seqlock<Snapshot> seqlock;
+
+void setUp()
+{
+}
+
+void tearDown()
+{
+}
+
+void test_read_before_any_write()
+{
+  Seqlock<Snapshot> empty;
+  Snapshot snapshot;
+
+  TEST_ASSERT_EQUAL_UINT32(0, empty.read(snapshot));
+  TEST_ASSERT_EQUAL_UINT32(0, snapshot.words[0]);
+  TEST_ASSERT_EQUAL_UINT32(0, snapshot.words[TEST_WORDS - 1]);
+}
+
+void test_readers_never_see_a_torn_snapshot()
+{
+  std::atomic<bool> done(false);
+  std::atomic<uint32_t> torn(0);
+  std::atomic<uint32_t> backwards(0);
+  std::atomic<uint32_t> reads(0);
+
+  std::thread writer([&]() {
+    Snapshot snapshot;
+
+    // Every word of the snapshot n is n (the number returned by read)
+    for (uint32_t n = 1; n <= TEST_WRITES; n++)
+    {
+      for (int i = 0; i < TEST_WORDS; i++)
+      {
+        snapshot.words[i] = n;
+      }
+
+      seqlock.write(snapshot);
+
+      if ((n & 0x3F) == 0)
+      {
+        std::this_thread::yield();
+      }
+    }
+
+    done.store(true, std::memory_order_release);
+  });
+
+  std::thread readers[TEST_READERS];
+
+  for (int r = 0; r < TEST_READERS; r++)
+  {
+    readers[r] = std::thread([&]() {
+      Snapshot snapshot;
+      uint32_t last = 0;
+
+      while (!done.load(std::memory_order_acquire))
+      {
+        uint32_t number = seqlock.read(snapshot);
+
+        for (int i = 0; i < TEST_WORDS; i++)
+        {
+          if (snapshot.words[i] != number)
+          {
+            torn++;
+            break;
+          }
+        }
+
+        if (number < last)
+        {
+          backwards++;
+        }
+
+        last = number;
+        reads++;
+      }
+    });
+  }
+
+  writer.join();
+
+  for (int r = 0; r < TEST_READERS; r++)
+  {
+    readers[r].join();
+  }
+
+  Snapshot snapshot;
+
+  TEST_ASSERT_EQUAL_UINT32(0, torn.load());
+  TEST_ASSERT_EQUAL_UINT32(0, backwards.load());
+  TEST_ASSERT_GREATER_THAN(0, reads.load());
+  TEST_ASSERT_EQUAL_UINT32(TEST_WRITES, seqlock.read(snapshot));
+  TEST_ASSERT_EQUAL_UINT32(TEST_WRITES, snapshot.words[TEST_WORDS - 1]);
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+
+  RUN_TEST(test_read_before_any_write);
+  RUN_TEST(test_readers_never_see_a_torn_snapshot);
+
+  return UNITY_END();
+}
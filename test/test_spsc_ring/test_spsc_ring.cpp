@@ -0,0 +1,237 @@
+/**
+ * This test_spsc_ring.cpp implements the host tests of the lock-free ring:
+ * the full policies on one thread, then a producer and a consumer thread
+ * checking the order of the records and the counts of the drops.
+ *
+ * MIT License
+ *
+ * ESP32 MQTT - Samples code
+ * Copyright (c) 2021 Antonio Musarra's Blog - https://www.dontesta.it
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in the
+ * Software without restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the
+ * Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <atomic>
+#include <thread>
+#include <unity.h>
+#include "spsc_ring.h"
+
+// Records pushed by the producer thread
+#define TEST_RECORDS 1000000
+
+/**
+ * Record with a sequence number and fields derived from it, so a torn copy
+ * is detected by the consumer
+ */
+struct Record
+{
+  uint32_t sequence;
+  uint32_t inverse;
+  uint32_t square;
+  uint32_t check;
+};
+
+static Record make_record(uint32_t sequence)
+{
+  Record record;
+
+  record.sequence = sequence;
+  record.inverse = ~sequence;
+  record.square = sequence * sequence;
+  record.check = sequence ^ 0xA5A5A5A5;
+
+  return record;
+}
+
+static bool is_whole(const Record &record)
+{
+  return record.inverse == ~record.sequence &&
+         record.square == record.sequence * record.sequence &&
+         record.check == (record.sequence ^ 0xA5A5A5A5);
+}
+
+void setUp()
+{
+}
+
+void tearDown()
+{
+}
+
+void test_drop_newest_keeps_the_oldest()
+{
+  static SpscRing<uint32_t, 8, Spsc_Drop_Newest> ring;
+
+  for (uint32_t i = 0; i < 13; i++)
+  {
+    TEST_ASSERT_EQUAL(i < 8, ring.push(i));
+  }
+
+  TEST_ASSERT_EQUAL_UINT32(8, ring.size());
+
+  uint32_t value;
+
+  for (uint32_t i = 0; i < 8; i++)
+  {
+    TEST_ASSERT_TRUE(ring.pop(value));
+    TEST_ASSERT_EQUAL_UINT32(i, value);
+  }
+
+  TEST_ASSERT_FALSE(ring.pop(value));
+
+  SpscRingStats stats = ring.stats();
+
+  TEST_ASSERT_EQUAL_UINT32(8, stats.pushed);
+  TEST_ASSERT_EQUAL_UINT32(8, stats.popped);
+  TEST_ASSERT_EQUAL_UINT32(5, stats.dropped);
+  TEST_ASSERT_EQUAL_UINT32(0, stats.overwritten);
+}
+
+void test_overwrite_oldest_keeps_the_newest()
+{
+  static SpscRing<uint32_t, 8, Spsc_Overwrite_Oldest> ring;
+
+  for (uint32_t i = 0; i < 20; i++)
+  {
+    TEST_ASSERT_TRUE(ring.push(i));
+  }
+
+  TEST_ASSERT_EQUAL_UINT32(8, ring.size());
+
+  uint32_t value;
+
+  for (uint32_t i = 12; i < 20; i++)
+  {
+    TEST_ASSERT_TRUE(ring.pop(value));
+    TEST_ASSERT_EQUAL_UINT32(i, value);
+  }
+
+  TEST_ASSERT_TRUE(ring.empty());
+
+  SpscRingStats stats = ring.stats();
+
+  TEST_ASSERT_EQUAL_UINT32(20, stats.pushed);
+  TEST_ASSERT_EQUAL_UINT32(8, stats.popped);
+  TEST_ASSERT_EQUAL_UINT32(0, stats.dropped);
+  TEST_ASSERT_EQUAL_UINT32(12, stats.overwritten);
+}
+
+/**
+ * Run a producer thread against the consumer (the calling thread) and check
+ * that the records are whole and popped in order
+ *
+ * refused: Pushes refused by the ring
+ * return: Records popped
+ */
+template <typename Ring>
+static uint32_t run_producer_consumer(Ring &ring, uint32_t &refused)
+{
+  std::atomic<bool> done(false);
+  uint32_t rejected = 0;
+
+  std::thread producer([&]() {
+    for (uint32_t i = 0; i < TEST_RECORDS; i++)
+    {
+      if (!ring.push(make_record(i)))
+      {
+        rejected++;
+      }
+
+      // Hand over the core now and then (hosts with a single core)
+      if ((i & 0xFF) == 0)
+      {
+        std::this_thread::yield();
+      }
+    }
+
+    done.store(true, std::memory_order_release);
+  });
+
+  uint32_t count = 0;
+  uint32_t next = 0;
+  bool whole = true;
+  bool ordered = true;
+  Record record;
+
+  for (;;)
+  {
+    // The end is checked before the pop, so the records left are drained
+    bool finished = done.load(std::memory_order_acquire);
+
+    if (ring.pop(record))
+    {
+      whole = whole && is_whole(record);
+      ordered = ordered && record.sequence >= next;
+      next = record.sequence + 1;
+      count++;
+    }
+    else if (finished)
+    {
+      break;
+    }
+  }
+
+  producer.join();
+
+  TEST_ASSERT_TRUE_MESSAGE(whole, "torn record popped");
+  TEST_ASSERT_TRUE_MESSAGE(ordered, "record popped out of order");
+
+  refused = rejected;
+
+  return count;
+}
+
+void test_overwrite_oldest_with_two_threads()
+{
+  static SpscRing<Record, 64, Spsc_Overwrite_Oldest> ring;
+  uint32_t refused;
+  uint32_t count = run_producer_consumer(ring, refused);
+  SpscRingStats stats = ring.stats();
+
+  // Every record is either popped or overwritten, never refused
+  TEST_ASSERT_EQUAL_UINT32(0, refused);
+  TEST_ASSERT_EQUAL_UINT32(TEST_RECORDS, stats.pushed);
+  TEST_ASSERT_EQUAL_UINT32(count, stats.popped);
+  TEST_ASSERT_EQUAL_UINT32(0, stats.dropped);
+  TEST_ASSERT_EQUAL_UINT32(TEST_RECORDS, stats.popped + stats.overwritten);
+}
+
+void test_drop_newest_with_two_threads()
+{
+  static SpscRing<Record, 64, Spsc_Drop_Newest> ring;
+  uint32_t refused;
+  uint32_t count = run_producer_consumer(ring, refused);
+  SpscRingStats stats = ring.stats();
+
+  // Every record is either popped or dropped at the push
+  TEST_ASSERT_EQUAL_UINT32(refused, stats.dropped);
+  TEST_ASSERT_EQUAL_UINT32(TEST_RECORDS - refused, stats.pushed);
+  TEST_ASSERT_EQUAL_UINT32(stats.pushed, count);
+  TEST_ASSERT_EQUAL_UINT32(count, stats.popped);
+  TEST_ASSERT_EQUAL_UINT32(0, stats.overwritten);
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+
+  RUN_TEST(test_drop_newest_keeps_the_oldest);
+  RUN_TEST(test_overwrite_oldest_keeps_the_newest);
+  RUN_TEST(test_overwrite_oldest_with_two_threads);
+  RUN_TEST(test_drop_newest_with_two_threads);
+
+  return UNITY_END();
+}
@@ -0,0 +1,210 @@
+/**
+ * This test_timer_wheel.cpp implements the host tests of the timer wheel and
+ * the benchmark of the start and the cancel of 10k timers.
+ *
+ * MIT License
+ *
+ * ESP32 MQTT - Samples code
+ * Copyright (c) 2021 Antonio Musarra's Blog - https://www.dontesta.it
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in the
+ * Software without restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the
+ * Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <chrono>
+#include <unity.h>
+#include "timer_wheel.h"
+
+// Timers of the benchmark (the native env enlarges the pool to fit them)
+#define TEST_TIMERS 10000
+#define TEST_ROUNDS 20
+
+#if TIMER_WHEEL_POOL_SIZE < TEST_TIMERS
+#error "The native env must set TIMER_WHEEL_POOL_SIZE to TEST_TIMERS at least"
+#endif
+
+// Expiries recorded by the callback
+static uint32_t fired[64];
+static uint32_t firedAt[64];
+static int firedCount;
+static uint32_t wheelMs;
+
+static void record(void *arg, uint32_t scheduledMs)
+{
+  if (firedCount < 64)
+  {
+    fired[firedCount] = (uint32_t)(uintptr_t)arg;
+    firedAt[firedCount] = scheduledMs;
+  }
+
+  firedCount++;
+}
+
+/**
+ * Advance the wheel 1 ms at a time, as the owner does when it wakes up late
+ * at most by a tick
+ */
+static void advance_to(uint32_t nowMs)
+{
+  while ((int32_t)(nowMs - wheelMs) > 0)
+  {
+    wheelMs++;
+    timer_wheel_advance(wheelMs);
+  }
+}
+
+void setUp(void)
+{
+  firedCount = 0;
+  wheelMs = 1000;
+  timer_wheel_begin(wheelMs, NULL);
+}
+
+void tearDown(void) {}
+
+void test_timers_expire_in_order_on_every_level(void)
+{
+  // First level, second level and third level (cascaded twice)
+  TEST_ASSERT_NOT_EQUAL(TIMER_INVALID, timer_start_at(1005, 0, record, (void *)1));
+  TEST_ASSERT_NOT_EQUAL(TIMER_INVALID, timer_start_at(1300, 0, record, (void *)2));
+  TEST_ASSERT_NOT_EQUAL(TIMER_INVALID, timer_start_at(71000, 0, record, (void *)3));
+
+  advance_to(1004);
+  TEST_ASSERT_EQUAL_INT(0, firedCount);
+
+  advance_to(71000);
+  TEST_ASSERT_EQUAL_INT(3, firedCount);
+  TEST_ASSERT_EQUAL_UINT32(1, fired[0]);
+  TEST_ASSERT_EQUAL_UINT32(1005, firedAt[0]);
+  TEST_ASSERT_EQUAL_UINT32(2, fired[1]);
+  TEST_ASSERT_EQUAL_UINT32(1300, firedAt[1]);
+  TEST_ASSERT_EQUAL_UINT32(3, fired[2]);
+  TEST_ASSERT_EQUAL_UINT32(71000, firedAt[2]);
+
+  // The one-shot timers are back in the pool
+  TEST_ASSERT_EQUAL_UINT32(UINT32_MAX, timer_wheel_sleep_ms(wheelMs));
+}
+
+void test_periodic_timer_keeps_its_phase(void)
+{
+  TimerId timerId = timer_start_at(1010, 100, record, NULL);
+
+  advance_to(1310);
+
+  // Exact multiples of the period from the first expiry
+  TEST_ASSERT_EQUAL_INT(4, firedCount);
+  TEST_ASSERT_EQUAL_UINT32(1010, firedAt[0]);
+  TEST_ASSERT_EQUAL_UINT32(1110, firedAt[1]);
+  TEST_ASSERT_EQUAL_UINT32(1210, firedAt[2]);
+  TEST_ASSERT_EQUAL_UINT32(1310, firedAt[3]);
+
+  TEST_ASSERT_TRUE(timer_cancel(timerId));
+  TEST_ASSERT_FALSE(timer_cancel(timerId));
+}
+
+void test_stale_id_does_not_cancel_the_reused_timer(void)
+{
+  // Cancelled, then its entry reused by the next start
+  TimerId cancelled = timer_start_at(1100, 0, record, (void *)1);
+
+  TEST_ASSERT_TRUE(timer_cancel(cancelled));
+
+  TimerId reused = timer_start_at(1100, 0, record, (void *)2);
+
+  TEST_ASSERT_NOT_EQUAL(cancelled, reused);
+  TEST_ASSERT_EQUAL_INT32(cancelled & 0xFFFF, reused & 0xFFFF);
+  TEST_ASSERT_FALSE(timer_cancel(cancelled));
+
+  // Expired, then its entry reused
+  TimerId expired = timer_start_at(1050, 0, record, (void *)3);
+
+  advance_to(1050);
+  TEST_ASSERT_EQUAL_INT(1, firedCount);
+
+  TimerId next = timer_start_at(1100, 0, record, (void *)4);
+
+  TEST_ASSERT_EQUAL_INT32(expired & 0xFFFF, next & 0xFFFF);
+  TEST_ASSERT_FALSE(timer_cancel(expired));
+
+  // Both the new timers still expire
+  advance_to(1100);
+  TEST_ASSERT_EQUAL_INT(3, firedCount);
+  TEST_ASSERT_FALSE(timer_cancel(TIMER_INVALID));
+}
+
+void test_start_and_cancel_of_10k_timers(void)
+{
+  static TimerId timerIds[TEST_TIMERS];
+  uint32_t random = 12345;
+  std::chrono::nanoseconds startTime(0);
+  std::chrono::nanoseconds cancelTime(0);
+
+  for (int round = 0; round < TEST_ROUNDS; round++)
+  {
+    auto begin = std::chrono::steady_clock::now();
+
+    // Delays spread on all the levels, up to about 5.6 hours
+    for (int i = 0; i < TEST_TIMERS; i++)
+    {
+      random = random * 1664525 + 1013904223;
+      timerIds[i] = timer_start_at(wheelMs + 1 + (random >> 8) % 20000000, 0,
+                                   record, NULL);
+    }
+
+    auto started = std::chrono::steady_clock::now();
+
+    // Cancelled out of the order of the start
+    for (int i = 0; i < TEST_TIMERS; i++)
+    {
+      int index = (i * 7919) % TEST_TIMERS;
+
+      TEST_ASSERT_NOT_EQUAL(TIMER_INVALID, timerIds[index]);
+      TEST_ASSERT_TRUE(timer_cancel(timerIds[index]));
+    }
+
+    auto cancelled = std::chrono::steady_clock::now();
+
+    startTime += started - begin;
+    cancelTime += cancelled - started;
+
+    // The ids of the round are all stale now
+    TEST_ASSERT_FALSE(timer_cancel(timerIds[0]));
+  }
+
+  char message[128];
+
+  snprintf(message, sizeof(message), "start %.1f ns, cancel %.1f ns per timer",
+           (double)startTime.count() / (TEST_TIMERS * TEST_ROUNDS),
+           (double)cancelTime.count() / (TEST_TIMERS * TEST_ROUNDS));
+  TEST_MESSAGE(message);
+
+  // Nothing left in the wheel, and O(1) operations stay well under 1 us
+  TEST_ASSERT_EQUAL_UINT32(UINT32_MAX, timer_wheel_sleep_ms(wheelMs));
+  TEST_ASSERT_LESS_THAN(1000, startTime.count() / (TEST_TIMERS * TEST_ROUNDS));
+  TEST_ASSERT_LESS_THAN(1000, cancelTime.count() / (TEST_TIMERS * TEST_ROUNDS));
+  TEST_ASSERT_EQUAL_INT(0, firedCount);
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+
+  RUN_TEST(test_timers_expire_in_order_on_every_level);
+  RUN_TEST(test_periodic_timer_keeps_its_phase);
+  RUN_TEST(test_stale_id_does_not_cancel_the_reused_timer);
+  RUN_TEST(test_start_and_cancel_of_10k_timers);
+
+  return UNITY_END();
+}
@@ -0,0 +1,148 @@
+/**
+ * This test_window_stats.cpp implements the host tests of the streaming
+ * statistics of a window.
+ *
+ * MIT License
+ *
+ * ESP32 MQTT - Samples code
+ * Copyright (c) 2021 Antonio Musarra's Blog - https://www.dontesta.it
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in the
+ * Software without restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the
+ * Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <unity.h>
+#include "window_stats.h"
+
+void setUp()
+{
+}
+
+void tearDown()
+{
+}
+
+void test_known_mean_and_stddev()
+{
+  const float values[] = {2, 4, 4, 4, 5, 5, 7, 9};
+  WindowStats stats;
+
+  for (float value : values)
+  {
+    stats.add(value);
+  }
+
+  // Sample variance: sum of the squared differences (32) over n - 1
+  TEST_ASSERT_EQUAL_UINT32(8, stats.count());
+  TEST_ASSERT_EQUAL_FLOAT(5.0F, stats.mean());
+  TEST_ASSERT_FLOAT_WITHIN(1e-5, 32.0 / 7.0, stats.variance());
+  TEST_ASSERT_FLOAT_WITHIN(1e-5, sqrt(32.0 / 7.0), stats.stddev());
+  TEST_ASSERT_EQUAL_FLOAT(2.0F, stats.min());
+  TEST_ASSERT_EQUAL_FLOAT(9.0F, stats.max());
+}
+
+void test_empty_window()
+{
+  WindowStats stats;
+
+  TEST_ASSERT_EQUAL_UINT32(0, stats.count());
+  TEST_ASSERT_FLOAT_IS_NAN(stats.mean());
+  TEST_ASSERT_FLOAT_IS_NAN(stats.min());
+  TEST_ASSERT_FLOAT_IS_NAN(stats.max());
+  TEST_ASSERT_EQUAL_FLOAT(0.0F, stats.variance());
+  TEST_ASSERT_EQUAL_FLOAT(0.0F, stats.stddev());
+}
+
+void test_single_sample()
+{
+  WindowStats stats;
+
+  stats.add(21.5F);
+
+  TEST_ASSERT_EQUAL_UINT32(1, stats.count());
+  TEST_ASSERT_EQUAL_FLOAT(21.5F, stats.mean());
+  TEST_ASSERT_EQUAL_FLOAT(21.5F, stats.min());
+  TEST_ASSERT_EQUAL_FLOAT(21.5F, stats.max());
+  TEST_ASSERT_EQUAL_FLOAT(0.0F, stats.variance());
+}
+
+void test_nan_values_are_skipped()
+{
+  WindowStats stats;
+
+  stats.add(NAN);
+  stats.add(1.0F);
+  stats.add(NAN);
+  stats.add(3.0F);
+
+  TEST_ASSERT_EQUAL_UINT32(2, stats.count());
+  TEST_ASSERT_EQUAL_FLOAT(2.0F, stats.mean());
+  TEST_ASSERT_EQUAL_FLOAT(2.0F, stats.variance());
+}
+
+void test_large_offset_without_cancellation()
+{
+  // Small spread on a large offset (pressure in Pa, counters): the sum of
+  // the squares would cancel out in float, Welford keeps the variance
+  const float offset = 1e7F;
+  const float deltas[] = {4, 7, 13, 16};
+  WindowStats stats;
+
+  for (int round = 0; round < 1000; round++)
+  {
+    for (float delta : deltas)
+    {
+      stats.add(offset + delta);
+    }
+  }
+
+  // Variance of the deltas: 90 / 4 over the population, 4000 / 3999 to
+  // the sample variance
+  TEST_ASSERT_EQUAL_UINT32(4000, stats.count());
+  TEST_ASSERT_FLOAT_WITHIN(1e-3, offset + 10.0, stats.mean());
+  TEST_ASSERT_FLOAT_WITHIN(1e-3, 22.5 * 4000.0 / 3999.0, stats.variance());
+  TEST_ASSERT_EQUAL_FLOAT(offset + 4.0F, stats.min());
+  TEST_ASSERT_EQUAL_FLOAT(offset + 16.0F, stats.max());
+}
+
+void test_reset_starts_a_new_window()
+{
+  WindowStats stats;
+
+  stats.add(100.0F);
+  stats.add(200.0F);
+  stats.reset();
+  stats.add(7.0F);
+
+  TEST_ASSERT_EQUAL_UINT32(1, stats.count());
+  TEST_ASSERT_EQUAL_FLOAT(7.0F, stats.mean());
+  TEST_ASSERT_EQUAL_FLOAT(7.0F, stats.min());
+  TEST_ASSERT_EQUAL_FLOAT(7.0F, stats.max());
+  TEST_ASSERT_EQUAL_FLOAT(0.0F, stats.variance());
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+
+  RUN_TEST(test_known_mean_and_stddev);
+  RUN_TEST(test_empty_window);
+  RUN_TEST(test_single_sample);
+  RUN_TEST(test_nan_values_are_skipped);
+  RUN_TEST(test_large_offset_without_cancellation);
+  RUN_TEST(test_reset_starts_a_new_window);
+
+  return UNITY_END();
+}
@@ -0,0 +1,55 @@
+#!/bin/sh
+#
+# Compile the sources of the firmware on the host against the stubs of
+# test/stubs (Arduino core, ESP-IDF, FreeRTOS) and tools/host_stubs (the
+# libraries bound to the hardware), at the default and at the production
+# log level, and print the size of the objects of both builds. Then run
+# tools/log_bench.cpp at both levels: the cycles of the log calls of the
+# command hot path.
+#
+# The sizes and the cycles are x86-64 ones: they compare the log levels,
+# not the image.
+# ArduinoJson is the real library: the one fetched by "pio test -e native",
+# or the one of the ARDUINOJSON_DIR directory.
+#
+# Usage: tools/host_check.sh [extra compiler flags]
+
+cd "$(dirname "$0")/.." || exit 1
+
+ARDUINOJSON_DIR=${ARDUINOJSON_DIR:-.pio/libdeps/native/ArduinoJson/src}
+CXX=${CXX:-g++}
+
+if [ ! -f "$ARDUINOJSON_DIR/ArduinoJson.h" ]; then
+  echo "ArduinoJson not found in $ARDUINOJSON_DIR (run pio test -e native or set ARDUINOJSON_DIR)" >&2
+  exit 1
+fi
+
+OUT=$(mktemp -d)
+trap 'rm -rf "$OUT"' EXIT
+
+rc=0
+
+for level in 6 2; do
+  mkdir -p "$OUT/$level"
+
+  for source in src/*.cpp; do
+    $CXX -std=gnu++17 -Os -c -Wall -Wno-unused-variable \
+      -Itest/stubs -Itools/host_stubs -I"$ARDUINOJSON_DIR" -Iinclude \
+      -DWIFI_SSID='"ssid"' -DWIFI_PASSWORD='"password"' \
+      -DMQTT_USERNAME='"user"' -DMQTT_PASSWORD='"password"' \
+      -DMQTT_SERVER='"localhost"' -DMQTT_PORT=1883 -DDEVICE_NAME='"esp32-zone-1"' \
+      -DLOG_COMPILE_LEVEL=$level "$@" \
+      -o "$OUT/$level/$(basename "$source" .cpp).o" "$source" || rc=1
+  done
+
+  echo "LOG_COMPILE_LEVEL=$level"
+  size -t "$OUT/$level"/*.o | tail -1
+
+  $CXX -std=gnu++17 -Os -Wall \
+    -Itest/stubs -Itools/host_stubs -I"$ARDUINOJSON_DIR" -Iinclude \
+    -DLOG_COMPILE_LEVEL=$level "$@" \
+    -o "$OUT/$level/log_bench" tools/log_bench.cpp src/async_log.cpp &&
+    "$OUT/$level/log_bench" || rc=1
+done
+
+exit $rc
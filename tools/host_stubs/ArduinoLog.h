@@ -0,0 +1,61 @@
+/**
+ * This ArduinoLog.h declares the host stub of the logger of the host check
+ * (the messages are discarded).
+ *
+ * MIT License
+ *
+ * ESP32 MQTT - Samples code
+ * Copyright (c) 2021 Antonio Musarra's Blog - https://www.dontesta.it
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in the
+ * Software without restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the
+ * Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef HOST_STUBS_ARDUINOLOG_H
+#define HOST_STUBS_ARDUINOLOG_H
+
+#include <Arduino.h>
+
+#define LOG_LEVEL_SILENT 0
+#define LOG_LEVEL_FATAL 1
+#define LOG_LEVEL_ERROR 2
+#define LOG_LEVEL_WARNING 3
+#define LOG_LEVEL_NOTICE 4
+#define LOG_LEVEL_TRACE 5
+#define LOG_LEVEL_VERBOSE 6
+
+class Logging
+{
+public:
+  void begin(int level, Print *output, bool showLevel = true) {}
+  void setPrefix(void (*prefix)(Print *)) {}
+
+  template <class T, typename... Args>
+  void fatal(T message, Args... args) {}
+  template <class T, typename... Args>
+  void error(T message, Args... args) {}
+  template <class T, typename... Args>
+  void warning(T message, Args... args) {}
+  template <class T, typename... Args>
+  void notice(T message, Args... args) {}
+  template <class T, typename... Args>
+  void trace(T message, Args... args) {}
+  template <class T, typename... Args>
+  void verbose(T message, Args... args) {}
+};
+
+inline Logging Log;
+
+#endif
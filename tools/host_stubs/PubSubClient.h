@@ -0,0 +1,73 @@
+/**
+ * This PubSubClient.h declares the host stub of the MQTT client of the host
+ * check (always connected, every publish succeeds).
+ *
+ * MIT License
+ *
+ * ESP32 MQTT - Samples code
+ * Copyright (c) 2021 Antonio Musarra's Blog - https://www.dontesta.it
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in the
+ * Software without restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the
+ * Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef HOST_STUBS_PUBSUBCLIENT_H
+#define HOST_STUBS_PUBSUBCLIENT_H
+
+#include <functional>
+#include <Arduino.h>
+#include <WiFi.h>
+
+#define MQTT_CALLBACK_SIGNATURE std::function<void(char *, uint8_t *, unsigned int)> callback
+
+class PubSubClient
+{
+public:
+  PubSubClient() {}
+  PubSubClient(Client &client) {}
+  PubSubClient(const char *host, uint16_t port, MQTT_CALLBACK_SIGNATURE, Client &client) {}
+
+  PubSubClient &setServer(IPAddress address, uint16_t port) { return *this; }
+  PubSubClient &setServer(const char *host, uint16_t port) { return *this; }
+  PubSubClient &setCallback(MQTT_CALLBACK_SIGNATURE) { return *this; }
+  PubSubClient &setClient(Client &client) { return *this; }
+  PubSubClient &setKeepAlive(uint16_t seconds) { return *this; }
+  PubSubClient &setSocketTimeout(uint16_t seconds) { return *this; }
+  bool setBufferSize(uint16_t size) { return true; }
+
+  bool connect(const char *id) { return true; }
+  bool connect(const char *id, const char *user, const char *pass) { return true; }
+  bool connect(const char *id, const char *user, const char *pass, const char *willTopic,
+               uint8_t willQos, bool willRetain, const char *willMessage, bool cleanSession)
+  {
+    return true;
+  }
+  void disconnect() {}
+  bool connected() { return true; }
+  int state() { return 0; }
+  bool loop() { return true; }
+
+  bool publish(const char *topic, const char *payload) { return true; }
+  bool publish(const char *topic, const char *payload, bool retained) { return true; }
+  bool publish(const char *topic, const uint8_t *payload, unsigned int length) { return true; }
+  bool publish(const char *topic, const uint8_t *payload, unsigned int length, bool retained)
+  {
+    return true;
+  }
+  bool subscribe(const char *topic) { return true; }
+  bool subscribe(const char *topic, uint8_t qos) { return true; }
+};
+
+#endif
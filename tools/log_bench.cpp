@@ -0,0 +1,96 @@
+/**
+ * This log_bench.cpp implements the host benchmark of the log calls of the
+ * command hot path, built by tools/host_check.sh at every LOG_COMPILE_LEVEL.
+ *
+ * MIT License
+ *
+ * ESP32 MQTT - Samples code
+ * Copyright (c) 2021 Antonio Musarra's Blog - https://www.dontesta.it
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in the
+ * Software without restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the
+ * Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <Arduino.h>
+#include <chrono>
+#include <x86intrin.h>
+#include "async_log.h"
+
+// Commands of the benchmark
+#define BENCH_COMMANDS 100000
+
+/**
+ * Output of the drained records (the formatting is not on the hot path)
+ */
+class NullOutput : public Print
+{
+};
+
+static NullOutput output;
+
+// Stand-ins of the handles of the command and of the logger task
+static int commandTask;
+static int loggerTask;
+
+/**
+ * The log calls that the command task makes for a relay command, with the
+ * arguments of a real one
+ */
+static void command_hot_path(const char *topic, const char *text, const char *command,
+                             int relayId, const char *deviceName)
+{
+  LOG_NOTICE(F("Message arrived on topic: %s" CR), topic);
+  LOG_NOTICE(F("Message Content: %s" CR), text);
+  LOG_NOTICE(F("Try to execute this statement (command %s): %s for relay %d on the device name: %s" CR),
+             command, "on", relayId, deviceName);
+  LOG_NOTICE(F("Switch On relay 0" CR));
+}
+
+int main()
+{
+  const char *text = "{\"command\":\"set\",\"relay_id\":0,\"status\":\"on\"}";
+  volatile int relayId = 0;
+
+  Logger.begin(LOG_COMPILE_LEVEL, &output);
+  Logger.registerTask(Task_Command, &commandTask);
+  Logger.start(&loggerTask);
+  host_current_task = &commandTask;
+
+  uint64_t cycles = 0;
+  auto started = std::chrono::steady_clock::now();
+
+  for (int i = 0; i < BENCH_COMMANDS; i++)
+  {
+    _mm_lfence();
+    uint64_t begin = __rdtsc();
+
+    command_hot_path("esp32/command", text, "set", relayId, "esp32-zone-1");
+
+    _mm_lfence();
+    cycles += __rdtsc() - begin;
+
+    // The logger task empties the ring between two commands
+    Logger.drain();
+  }
+
+  double elapsedNs = std::chrono::duration<double, std::nano>(
+                         std::chrono::steady_clock::now() - started)
+                         .count();
+
+  printf("hot path: %.1f TSC cycles per command (%.1f ns per command with the drain)\n",
+         (double)cycles / BENCH_COMMANDS, elapsedNs / BENCH_COMMANDS);
+
+  return 0;
+}
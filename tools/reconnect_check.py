@@ -0,0 +1,164 @@
+#!/usr/bin/env python3
+#
+# This reconnect_check.py measures, against a local Mosquitto broker, the
+# time from the reconnect of the ESP32 firmware to the delivery of a command
+# queued while the device was offline (persistent MQTT session).
+#
+# MIT License
+#
+# ESP32 MQTT - Samples code
+# Copyright (c) 2021 Antonio Musarra's Blog - https://www.dontesta.it
+#
+# The broker is started by the script with persistence, the device must be
+# built with MQTT_SERVER and MQTT_PORT pointing to it. At every run the
+# broker is stopped (the device goes offline), started again and a relay
+# command is published with QoS 1 before the device is back: the broker
+# queues it in the session of the device. The time is measured from the
+# connect of the device (log of the broker) to the relay status published
+# by the device after the execution of the command.
+#
+# Usage:
+#  pip install "paho-mqtt<2"
+#  tools/reconnect_check.py --device esp32-zone-1 --port 1883 --runs 10
+
+import argparse
+import os
+import re
+import shutil
+import statistics
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+
+import paho.mqtt.client as mqtt
+
+CONNECTED = re.compile(r"New client connected from \S+ as (esp32-client-\S+) \(.*c(\d)")
+
+
+class Broker:
+    """Mosquitto with persistence, its log read by a thread"""
+
+    def __init__(self, mosquitto, port):
+        self.mosquitto = mosquitto
+        self.directory = tempfile.mkdtemp(prefix="reconnect_check")
+        self.config = os.path.join(self.directory, "mosquitto.conf")
+        self.process = None
+        self.connected = threading.Event()
+        self.connected_at = None
+        self.clean_session = None
+
+        with open(self.config, "w") as config:
+            config.write("listener %d\n" % port)
+            config.write("allow_anonymous true\n")
+            config.write("persistence true\n")
+            config.write("persistence_location %s/\n" % self.directory)
+
+    def start(self):
+        self.connected.clear()
+        self.process = subprocess.Popen(
+            [self.mosquitto, "-v", "-c", self.config],
+            stdout=subprocess.PIPE, stderr=subprocess.STDOUT, text=True)
+        threading.Thread(target=self.read_log, args=(self.process,), daemon=True).start()
+        time.sleep(0.5)
+
+    def stop(self):
+        # SIGTERM: the sessions are saved in the persistence file
+        self.process.terminate()
+        self.process.wait()
+
+    def read_log(self, process):
+        for line in process.stdout:
+            match = CONNECTED.search(line)
+
+            if match:
+                self.connected_at = time.monotonic()
+                self.clean_session = match.group(2) == "1"
+                self.connected.set()
+
+    def remove(self):
+        shutil.rmtree(self.directory, ignore_errors=True)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("--device", required=True, help="DEVICE_NAME of the firmware")
+    parser.add_argument("--relay", type=int, default=0, help="relay to toggle")
+    parser.add_argument("--port", type=int, default=1883)
+    parser.add_argument("--mosquitto", default="mosquitto")
+    parser.add_argument("--runs", type=int, default=10)
+    parser.add_argument("--down", type=float, default=3.0,
+                        help="seconds offline (the device backs off meanwhile)")
+    parser.add_argument("--timeout", type=float, default=60.0)
+    args = parser.parse_args()
+
+    broker = Broker(args.mosquitto, args.port)
+    delivered = threading.Event()
+    delivered_at = [None]
+    status_topic = "esp32/relay_%02d_status" % args.relay
+
+    def on_connect(client, userdata, flags, rc):
+        client.subscribe(status_topic, 1)
+
+    def on_message(client, userdata, message):
+        # The retained status sent at the subscribe is not a delivery
+        if not message.retain:
+            delivered_at[0] = time.monotonic()
+            delivered.set()
+
+    client = mqtt.Client(client_id="reconnect-check", clean_session=True)
+    client.on_connect = on_connect
+    client.on_message = on_message
+
+    broker.start()
+    client.connect("localhost", args.port)
+    client.loop_start()
+
+    if not broker.connected.wait(args.timeout):
+        sys.exit("The device didn't connect to the broker")
+
+    if broker.clean_session:
+        print("warning: the device connects with a clean session (MQTT_CLEAN_SESSION)")
+
+    times = []
+    lost = 0
+
+    try:
+        for run in range(args.runs):
+            broker.stop()
+            time.sleep(args.down)
+            broker.start()
+            delivered.clear()
+
+            # Queued in the session of the device, still offline (backoff)
+            client.reconnect()
+            command = "%s:relay;%d;%s" % (args.device, args.relay, "on" if run % 2 == 0 else "off")
+            client.publish("esp32/command", command, qos=1).wait_for_publish()
+
+            if broker.connected.is_set():
+                print("run %d: the device reconnected before the command was queued, skipped" % run)
+                continue
+
+            if not broker.connected.wait(args.timeout) or not delivered.wait(args.timeout):
+                lost += 1
+                print("run %d: command not delivered" % run)
+                continue
+
+            elapsed = (delivered_at[0] - broker.connected_at) * 1000
+            times.append(elapsed)
+            print("run %d: %.0f ms from the connect to the relay status" % (run, elapsed))
+    finally:
+        client.loop_stop()
+        broker.stop()
+        broker.remove()
+
+    if times:
+        print("delivered %d of %d, median %.0f ms, max %.0f ms"
+              % (len(times), args.runs, statistics.median(times), max(times)))
+
+    sys.exit(1 if lost else 0)
+
+
+if __name__ == "__main__":
+    main()
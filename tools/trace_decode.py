@@ -0,0 +1,241 @@
+#!/usr/bin/env python3
+#
+# This trace_decode.py converts a trace of the ESP32 firmware (binary chunks
+# received by MQTT or hexadecimal dump of the console) in Chrome trace-event
+# JSON, to open with chrome://tracing or https://ui.perfetto.dev
+#
+# MIT License
+#
+# ESP32 MQTT - Samples code
+# Copyright (c) 2021 Antonio Musarra's Blog - https://www.dontesta.it
+#
+# Usage:
+#  mosquitto_sub -h broker -t 'esp32/esp32-client-XXXXXXXXXXXX/trace' -N > trace.bin
+#  tools/trace_decode.py --mqtt trace.bin > trace.json
+#
+#  pio device monitor | tee console.log
+#  tools/trace_decode.py --serial console.log > trace.json
+#
+#  tools/trace_decode.py --check
+
+import argparse
+import bisect
+import json
+import struct
+import sys
+
+MAGIC = b"TRC1"
+CHUNK_HEADER = struct.Struct("<4sHHHH")
+RECORD = struct.Struct("<HBBIII")
+
+# Sync records written at the start of the trace, one per core, that come
+# before the ring in a dump
+START_SYNCS = 2
+
+# TRACE_RING_SIZE of include/trace.h
+RING_SIZE = 1024
+
+# Events of include/trace.h: name and phase (i instant, B begin, E end)
+EVENTS = {
+    0: ("sync", None),
+    1: ("command received", "i"),
+    2: ("command queued", "i"),
+    3: ("command", "B"),
+    4: ("command parsed", "i"),
+    5: ("gpio written", "i"),
+    6: ("command", "E"),
+    7: ("relay status queued", "i"),
+    8: ("publish", "B"),
+    9: ("publish serialized", "i"),
+    10: ("publish", "E"),
+    11: ("sample", "B"),
+    12: ("sample", "E"),
+    13: ("telemetry", "B"),
+    14: ("telemetry serialized", "i"),
+    15: ("telemetry", "E"),
+    16: ("sensor trigger", "i"),
+}
+
+# Tasks of include/task_metrics.h
+TASKS = ["mqtt", "sampler", "command", "logger", "other"]
+
+
+def read_mqtt(path):
+    """Return the CPU MHz and the records of the binary chunks"""
+    data = open(path, "rb").read()
+    chunks = {}
+    cpu_mhz = None
+    offset = 0
+
+    while offset + CHUNK_HEADER.size <= len(data):
+        magic, mhz, index, _, count = CHUNK_HEADER.unpack_from(data, offset)
+
+        if magic != MAGIC:
+            # Skip the bytes until the next chunk (e.g. a newline)
+            offset += 1
+            continue
+
+        offset += CHUNK_HEADER.size
+        size = count * RECORD.size
+        chunks[index] = data[offset:offset + size]
+        cpu_mhz = mhz
+        offset += size
+
+    records = b"".join(chunks[i] for i in sorted(chunks))
+
+    return cpu_mhz, [RECORD.unpack_from(records, i) for i in range(0, len(records), RECORD.size)]
+
+
+def read_serial(path):
+    """Return the CPU MHz and the records of the last dump on the console"""
+    cpu_mhz = None
+    records = None
+
+    for line in open(path, errors="replace"):
+        line = line.strip()
+
+        if line.startswith("trace ") and line != "trace end":
+            cpu_mhz = int(line.split()[1])
+            records = []
+        elif line == "trace end":
+            break
+        elif records is not None and len(line) == RECORD.size * 2:
+            records.append(RECORD.unpack(bytes.fromhex(line)))
+
+    return cpu_mhz, records or []
+
+
+def decode(cpu_mhz, records, ring_size=RING_SIZE):
+    """Return the Chrome trace events of the records"""
+    # Once the ring wrapped, the start syncs can be older than a lap of the
+    # cycle counter (17.9 s at 240 MHz): only the syncs in the ring are used
+    wrapped = len(records) - START_SYNCS >= ring_size
+
+    # Sync records of every core: position, cycle counter and time (µs)
+    syncs = {}
+
+    for position, (event, core, _, cycles, arg0, arg1) in enumerate(records):
+        if event == 0 and not (wrapped and position < START_SYNCS):
+            syncs.setdefault(core, []).append((position, cycles, arg0 | (arg1 << 32)))
+
+    positions = {core: [sync[0] for sync in syncs[core]] for core in syncs}
+
+    events = []
+
+    for core in sorted(syncs):
+        events.append({"name": "process_name", "ph": "M", "pid": core,
+                       "args": {"name": "core %d" % core}})
+
+        for tid, task in enumerate(TASKS):
+            events.append({"name": "thread_name", "ph": "M", "pid": core, "tid": tid,
+                           "args": {"name": task}})
+
+    for position, (event, core, task, cycles, arg0, arg1) in enumerate(records):
+        name, phase = EVENTS.get(event, ("event %d" % event, "i"))
+
+        if phase is None or core not in syncs:
+            continue
+
+        # The sync of the records older than the first sync of the core in
+        # the ring was overwritten: they can't be placed
+        if position < positions[core][0]:
+            continue
+
+        # Nearest sync of the core, before or after the record
+        index = bisect.bisect_left(positions[core], position)
+
+        if index == len(positions[core]) or (
+                index > 0 and position - positions[core][index - 1] <= positions[core][index] - position):
+            index -= 1
+
+        anchor = syncs[core][index]
+
+        # Signed difference of the 32-bit cycle counters
+        delta = (cycles - anchor[1]) & 0xFFFFFFFF
+
+        if delta >= 0x80000000:
+            delta -= 0x100000000
+
+        trace_event = {
+            "name": name,
+            "ph": phase,
+            "ts": anchor[2] + delta / cpu_mhz,
+            "pid": core,
+            "tid": min(task, len(TASKS) - 1),
+            "args": {"arg0": arg0, "arg1": arg1},
+        }
+
+        if phase == "i":
+            trace_event["s"] = "t"
+
+        events.append(trace_event)
+
+    events.sort(key=lambda e: e.get("ts", -1))
+
+    return {"traceEvents": events, "displayTimeUnit": "ns"}
+
+
+def check():
+    """Decode synthetic dumps at 240 MHz, before and after the wrap of the ring"""
+    mhz = 240
+
+    def sync(core, us):
+        return (0, core, 0, (us * mhz) & 0xFFFFFFFF, us & 0xFFFFFFFF, us >> 32)
+
+    def sample(core, us):
+        return (11, core, 1, (us * mhz) & 0xFFFFFFFF, 0, 0)
+
+    def times(trace):
+        return [e["ts"] for e in trace["traceEvents"] if e["ph"] != "M"]
+
+    failures = 0
+
+    def expect(name, got, wanted):
+        nonlocal failures
+        ok = len(got) == len(wanted) and all(abs(g - w) < 1 for g, w in zip(got, wanted))
+        print("%s: %s" % (name, "ok" if ok else "FAIL %s (expected %s)" % (got, wanted)))
+        failures += not ok
+
+    # Ring not wrapped: the start syncs place the records before the first
+    # sync of the ring, a record right before a sync uses it
+    records = [sync(0, 0), sync(1, 0), sample(0, 500000), sync(0, 1200000),
+               sample(0, 1199000), sample(0, 1300000)]
+    expect("ring not wrapped", times(decode(mhz, records)),
+           [500000, 1199000, 1300000])
+
+    # Ring wrapped at 30 s: the start syncs are 30 s old (more than a lap of
+    # the counter), the records before the first sync of the ring are
+    # dropped, the others are placed by the syncs of the ring
+    ring = [sample(0, 29900000 + i) for i in range(10)]
+    ring += [sync(0, 30000000), sample(0, 30000000)]
+    ring += [sample(0, 30000100 + i) for i in range(RING_SIZE - len(ring))]
+    trace = decode(mhz, [sync(0, 0), sync(1, 0)] + ring)
+    expect("ring wrapped", times(trace)[:2], [30000000, 30000100])
+    expect("ring wrapped, dropped", [len(times(trace))], [RING_SIZE - 11])
+
+    return failures
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Decode a trace of the ESP32 firmware")
+    source = parser.add_mutually_exclusive_group(required=True)
+    source.add_argument("--mqtt", help="binary chunks received on esp32/{clientId}/trace")
+    source.add_argument("--serial", help="console log with a trace;dump;serial")
+    source.add_argument("--check", action="store_true", help="decode synthetic dumps and exit")
+    parser.add_argument("--ring-size", type=int, default=RING_SIZE,
+                        help="TRACE_RING_SIZE of the firmware (default %(default)s)")
+    args = parser.parse_args()
+
+    if args.check:
+        sys.exit(1 if check() else 0)
+
+    cpu_mhz, records = read_mqtt(args.mqtt) if args.mqtt else read_serial(args.serial)
+
+    if not records or not cpu_mhz:
+        sys.exit("No trace found")
+
+    json.dump(decode(cpu_mhz, records, args.ring_size), sys.stdout, indent=1)
+
+
+if __name__ == "__main__":
+    main()